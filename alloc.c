@@ -0,0 +1,273 @@
+#include "alloc.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *heap_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *heap_resize(void *ctx, void *p, size_t old_size, size_t size) {
+    (void)ctx;
+    (void)old_size;
+    return realloc(p, size);
+}
+
+static void heap_release(void *ctx, void *p, size_t size) {
+    (void)ctx;
+    (void)size;
+    free(p);
+}
+
+const struct allocator heap_allocator = {heap_alloc, heap_resize,
+                                         heap_release, NULL};
+
+static _Thread_local const struct allocator *current = &heap_allocator;
+
+const struct allocator *allocator_current(void) { return current; }
+
+const struct allocator *allocator_use(const struct allocator *a) {
+    const struct allocator *prev = current;
+    current = a != NULL ? a : &heap_allocator;
+    return prev;
+}
+
+static inline size_t align16(size_t n) { return (n + 15) & ~(size_t)15; }
+
+// ---- arena ----
+
+// the header is 32 bytes so the data that follows it stays 16 byte aligned
+struct arena_block {
+    struct arena_block *prev;
+    size_t size, used, pad;
+};
+
+struct arena {
+    struct allocator alloc;
+    struct arena_block *head;
+    // one freed block is kept around, so a loop that rewinds past a block
+    // boundary does not hit malloc every iteration
+    struct arena_block *spare;
+    size_t block_size;
+};
+
+static inline unsigned char *block_data(struct arena_block *b) {
+    return (unsigned char *)(b + 1);
+}
+
+static void *arena_ctx_alloc(void *ctx, size_t size) {
+    return arena_alloc(ctx, size);
+}
+
+// the most recent allocation can grow or shrink in place
+static void *arena_ctx_resize(void *ctx, void *p, size_t old_size,
+                              size_t size) {
+    struct arena *a = ctx;
+    struct arena_block *b = a->head;
+    if (p != NULL && b != NULL &&
+        (unsigned char *)p + align16(old_size) == block_data(b) + b->used &&
+        (unsigned char *)p - block_data(b) + align16(size) <= b->size) {
+        b->used = (unsigned char *)p - block_data(b) + align16(size);
+        return p;
+    }
+    void *q = arena_alloc(a, size);
+    if (p != NULL)
+        memcpy(q, p, old_size < size ? old_size : size);
+    return q;
+}
+
+static void arena_ctx_release(void *ctx, void *p, size_t size) {
+    struct arena *a = ctx;
+    struct arena_block *b = a->head;
+    if (b != NULL &&
+        (unsigned char *)p + align16(size) == block_data(b) + b->used)
+        b->used -= align16(size);
+}
+
+struct arena *arena_create(size_t block_size) {
+    struct arena *a = calloc(1, sizeof(struct arena));
+    assert(a != NULL);
+    a->alloc = (struct allocator){arena_ctx_alloc, arena_ctx_resize,
+                                  arena_ctx_release, a};
+    a->block_size = align16(block_size);
+    return a;
+}
+
+void arena_destroy(struct arena *a) {
+    if (a == NULL)
+        return;
+    while (a->head != NULL) {
+        struct arena_block *prev = a->head->prev;
+        free(a->head);
+        a->head = prev;
+    }
+    free(a->spare);
+    free(a);
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = align16(size);
+    STATS_COUNT(STATS_SCRATCH_BYTES, size);
+    struct arena_block *b = a->head;
+    if (b == NULL || b->size - b->used < size) {
+        size_t want = size > a->block_size ? size : a->block_size;
+        if (a->spare != NULL && a->spare->size >= want) {
+            b = a->spare;
+            a->spare = NULL;
+        } else {
+            b = malloc(sizeof(struct arena_block) + want);
+            assert(b != NULL);
+            b->size = want;
+        }
+        b->used = 0;
+        b->prev = a->head;
+        a->head = b;
+    }
+    void *p = block_data(b) + b->used;
+    b->used += size;
+    return p;
+}
+
+struct arena_mark arena_mark(struct arena *a) {
+    return (struct arena_mark){a->head, a->head ? a->head->used : 0};
+}
+
+static void arena_pop_block(struct arena *a) {
+    struct arena_block *b = a->head;
+    a->head = b->prev;
+    if (a->spare == NULL || a->spare->size < b->size) {
+        free(a->spare);
+        a->spare = b;
+    } else {
+        free(b);
+    }
+}
+
+void arena_rewind(struct arena *a, struct arena_mark m) {
+    while (a->head != NULL && a->head != m.block)
+        arena_pop_block(a);
+    if (a->head != NULL)
+        a->head->used = m.used;
+}
+
+void arena_reset(struct arena *a) {
+    while (a->head != NULL && a->head->prev != NULL)
+        arena_pop_block(a);
+    if (a->head != NULL)
+        a->head->used = 0;
+    free(a->spare);
+    a->spare = NULL;
+}
+
+const struct allocator *arena_allocator(struct arena *a) { return &a->alloc; }
+
+struct arena *arena_scratch(void) {
+    static _Thread_local struct arena *scratch;
+    if (scratch == NULL)
+        scratch = arena_create(1 << 20);
+    return scratch;
+}
+
+// ---- pool ----
+
+#define POOL_MIN_SHIFT 4
+#define POOL_MAX_SHIFT 16
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_SLAB ((size_t)1 << POOL_MAX_SHIFT)
+
+struct pool_slab {
+    struct pool_slab *next;
+    size_t pad;
+};
+
+struct pool {
+    struct allocator alloc;
+    void *free_list[POOL_CLASSES];
+    struct pool_slab *slabs;
+    unsigned char *bump;
+    size_t bump_left;
+};
+
+static inline int pool_class(size_t size) {
+    if (size <= ((size_t)1 << POOL_MIN_SHIFT))
+        return 0;
+    return (int)(sizeof(unsigned long long) * 8 -
+                 __builtin_clzll((unsigned long long)size - 1)) -
+           POOL_MIN_SHIFT;
+}
+
+static void *pool_ctx_alloc(void *ctx, size_t size) {
+    struct pool *pl = ctx;
+    if (size > POOL_SLAB)
+        return malloc(size);
+    int c = pool_class(size);
+    void *p = pl->free_list[c];
+    if (p != NULL) {
+        pl->free_list[c] = *(void **)p;
+        return p;
+    }
+    size_t class_size = (size_t)1 << (c + POOL_MIN_SHIFT);
+    if (pl->bump_left < class_size) {
+        struct pool_slab *s = malloc(sizeof(struct pool_slab) + POOL_SLAB);
+        assert(s != NULL);
+        s->next = pl->slabs;
+        pl->slabs = s;
+        pl->bump = (unsigned char *)(s + 1);
+        pl->bump_left = POOL_SLAB;
+    }
+    p = pl->bump;
+    pl->bump += class_size;
+    pl->bump_left -= class_size;
+    return p;
+}
+
+static void pool_ctx_release(void *ctx, void *p, size_t size) {
+    struct pool *pl = ctx;
+    if (size > POOL_SLAB) {
+        free(p);
+        return;
+    }
+    int c = pool_class(size);
+    *(void **)p = pl->free_list[c];
+    pl->free_list[c] = p;
+}
+
+static void *pool_ctx_resize(void *ctx, void *p, size_t old_size,
+                             size_t size) {
+    if (p == NULL)
+        return pool_ctx_alloc(ctx, size);
+    if (old_size > POOL_SLAB && size > POOL_SLAB)
+        return realloc(p, size);
+    if (old_size <= POOL_SLAB && size <= POOL_SLAB &&
+        pool_class(old_size) == pool_class(size))
+        return p;
+    void *q = pool_ctx_alloc(ctx, size);
+    memcpy(q, p, old_size < size ? old_size : size);
+    pool_ctx_release(ctx, p, old_size);
+    return q;
+}
+
+struct pool *pool_create(void) {
+    struct pool *pl = calloc(1, sizeof(struct pool));
+    assert(pl != NULL);
+    pl->alloc = (struct allocator){pool_ctx_alloc, pool_ctx_resize,
+                                   pool_ctx_release, pl};
+    return pl;
+}
+
+// allocations above the slab size are the caller's to release beforehand
+void pool_destroy(struct pool *pl) {
+    if (pl == NULL)
+        return;
+    while (pl->slabs != NULL) {
+        struct pool_slab *next = pl->slabs->next;
+        free(pl->slabs);
+        pl->slabs = next;
+    }
+    free(pl);
+}
+
+const struct allocator *pool_allocator(struct pool *pl) { return &pl->alloc; }
@@ -0,0 +1,81 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include "stats.h"
+
+#include <stddef.h>
+
+// Pluggable allocator. Polynomials and hash tables remember the allocator
+// that was current when they were created and route every allocation of
+// their own through it, so a whole session can be pointed at a pool or an
+// arena and torn down at once.
+struct allocator {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*resize)(void *ctx, void *p, size_t old_size, size_t size);
+    void (*release)(void *ctx, void *p, size_t size);
+    void *ctx;
+};
+
+static inline void *allocator_alloc(const struct allocator *a, size_t size) {
+    STATS_COUNT(STATS_ALLOCS, 1);
+    STATS_COUNT(STATS_ALLOC_BYTES, size);
+    return a->alloc(a->ctx, size);
+}
+
+static inline void *allocator_resize(const struct allocator *a, void *p,
+                                     size_t old_size, size_t size) {
+    STATS_COUNT(STATS_RESIZES, 1);
+    STATS_COUNT(STATS_RESIZE_BYTES,
+                size > old_size ? size - old_size : old_size - size);
+    return a->resize(a->ctx, p, old_size, size);
+}
+
+static inline void allocator_release(const struct allocator *a, void *p,
+                                     size_t size) {
+    if (p != NULL) {
+        STATS_COUNT(STATS_RELEASES, 1);
+        a->release(a->ctx, p, size);
+    }
+}
+
+// malloc, realloc and free
+extern const struct allocator heap_allocator;
+
+// Allocator picked up by new polynomials and tables of the calling thread,
+// heap_allocator unless changed. allocator_use returns the previous one.
+const struct allocator *allocator_current(void);
+const struct allocator *allocator_use(const struct allocator *);
+
+// Bump allocator for temporaries. Memory comes in blocks, release is a no-op
+// and everything goes away on rewind or reset.
+struct arena;
+
+struct arena_mark {
+    void *block;
+    size_t used;
+};
+
+struct arena *arena_create(size_t block_size);
+void arena_destroy(struct arena *);
+// 16 byte aligned, never fails
+void *arena_alloc(struct arena *, size_t size);
+struct arena_mark arena_mark(struct arena *);
+// drop every allocation made since the mark
+void arena_rewind(struct arena *, struct arena_mark);
+// drop everything and give all but the first block back to the system
+void arena_reset(struct arena *);
+const struct allocator *arena_allocator(struct arena *);
+
+// Per-thread arena used for the scratch buffers of polynomial operations
+struct arena *arena_scratch(void);
+
+// Size-class pool: power-of-two classes from 16 bytes to 64 KiB, each with
+// its own free list carved from 64 KiB slabs, larger requests go to the heap.
+// Not thread safe.
+struct pool;
+
+struct pool *pool_create(void);
+void pool_destroy(struct pool *);
+const struct allocator *pool_allocator(struct pool *);
+
+#endif
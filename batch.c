@@ -0,0 +1,1394 @@
+#include "batch.h"
+#include "alloc.h"
+#include "cache.h"
+#include "expr.h"
+#include "extmul.h"
+#include "modular.h"
+#include "mpoly.h"
+#include "packed.h"
+#include "polynomial.h"
+#include "setup.h"
+#include "soa.h"
+#include "stats.h"
+#include "store.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void poly_free_adapter(void *p) {
+    polynomial_release((struct polynomial *)p);
+}
+
+static void poly_move_adapter(void *to, const void *from) {
+    polynomial_moved(to, from);
+}
+
+static void packed_free_adapter(void *p) {
+    packed_release((struct poly_packed *)p);
+}
+
+static void soa_free_adapter(void *p) { soa_release((struct poly_soa *)p); }
+
+static void mod_free_adapter(void *p) { mod_release((struct poly_mod *)p); }
+
+static void multi_free_adapter(void *p) { mpoly_release((struct mpoly *)p); }
+
+static int fail(struct batch *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(b->err, "line %ld: error: ", b->line);
+    vfprintf(b->err, fmt, ap);
+    fputc('\n', b->err);
+    va_end(ap);
+    b->errors++;
+    return 1;
+}
+
+// cut the next whitespace separated word out of *s
+static char *next_word(char **s) {
+    char *it = *s;
+    for (; isspace((unsigned char)*it); ++it)
+        ;
+    if (!*it) {
+        *s = it;
+        return NULL;
+    }
+    char *word = it;
+    for (; *it && !isspace((unsigned char)*it); ++it)
+        ;
+    if (*it)
+        *it++ = 0;
+    *s = it;
+    return word;
+}
+
+static int parse_int(const char *s, int *out) {
+    if (s == NULL)
+        return 1;
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 10);
+    if (end == s || *end || errno || v != (int)v)
+        return 1;
+    *out = (int)v;
+    return 0;
+}
+
+static int parse_modulus(const char *s, struct mod_field *f) {
+    if (s == NULL || !isdigit((unsigned char)*s))
+        return 1;
+    char *end;
+    errno = 0;
+    unsigned long long p = strtoull(s, &end, 10);
+    return *end || errno || mod_field_init(f, p) != 0;
+}
+
+static int parse_double(const char *s, double *out) {
+    if (s == NULL)
+        return 1;
+    char *end;
+    *out = strtod(s, &end);
+    return end == s || *end;
+}
+
+// Polynomials of opened stores enter the table as views on first use, so
+// opening a store costs nothing per entry. Later stores shadow earlier ones.
+static struct polynomial *lookup_store(struct batch *b, const char *name) {
+    struct batch *s = b->session;
+    for (int i = s->nstores - 1; i >= 0; --i) {
+        long idx = store_find(s->stores[i], name);
+        struct polynomial p;
+        if (idx < 0 || store_view(s->stores[i], idx, &p) != 0)
+            continue;
+        table_emplace(b->table, name, &p, sizeof(struct polynomial));
+        return table_query(b->table, name)->data;
+    }
+    return NULL;
+}
+
+static struct polynomial *lookup(struct batch *b, const char *name);
+static void define(struct batch *b, const char *name,
+                   const struct polynomial *p);
+
+static struct polynomial *resolve(void *b, const char *name) {
+    return lookup(b, name);
+}
+
+// A pending let is evaluated on first use and replaces whatever the table
+// held under its name. It leaves the pending set first, so a formula that
+// refers to its own name sees the previous value.
+static struct polynomial *lookup_let(struct batch *b, const char *name,
+                                     int root) {
+    table_erase(b->lets, name);
+    struct polynomial p;
+    const char *missing;
+    if (expr_eval(b->expr, root, &p, resolve, b, &missing) != 0) {
+        fail(b, "let %s: cannot find polynomial '%s'", name, missing);
+        table_emplace(b->lets, name, &root, sizeof(root));
+        return NULL;
+    }
+    // a packed, modular or multivariate value the formula replaces must not
+    // resurface
+    define(b, name, &p);
+    return table_query(b->table, name)->data;
+}
+
+// packed polynomial of this name, unless a pending let takes precedence
+static struct poly_packed *find_packed(struct batch *b, const char *name) {
+    if (name == NULL || b->packed->size == 0 ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return NULL;
+    Item *itm = table_query(b->packed, name);
+    return itm != NULL ? itm->data : NULL;
+}
+
+// structure-of-arrays polynomial of this name, the same precedence
+static struct poly_soa *find_soa(struct batch *b, const char *name) {
+    if (name == NULL || b->soa->size == 0 ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return NULL;
+    Item *itm = table_query(b->soa, name);
+    return itm != NULL ? itm->data : NULL;
+}
+
+// polynomial with modular coefficients of this name, the same precedence
+static struct poly_mod *find_mod(struct batch *b, const char *name) {
+    if (name == NULL || b->mod->size == 0 ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return NULL;
+    Item *itm = table_query(b->mod, name);
+    return itm != NULL ? itm->data : NULL;
+}
+
+// multivariate polynomial of this name, the same precedence
+static struct mpoly *find_multi(struct batch *b, const char *name) {
+    if (name == NULL || b->multi->size == 0 ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return NULL;
+    Item *itm = table_query(b->multi, name);
+    return itm != NULL ? itm->data : NULL;
+}
+
+// a packed polynomial goes back into the table when it is used
+static struct polynomial *lookup_packed(struct batch *b, const char *name) {
+    struct poly_packed *q = find_packed(b, name);
+    if (q == NULL)
+        return NULL;
+    struct polynomial p;
+    packed_to_terms(&p, q);
+    table_erase(b->packed, name);
+    table_emplace(b->table, name, &p, sizeof(struct polynomial));
+    return table_query(b->table, name)->data;
+}
+
+// and so does one in the SoA layout
+static struct polynomial *lookup_soa(struct batch *b, const char *name) {
+    struct poly_soa *q = find_soa(b, name);
+    if (q == NULL)
+        return NULL;
+    struct polynomial p;
+    soa_to_terms(&p, q);
+    table_erase(b->soa, name);
+    table_emplace(b->table, name, &p, sizeof(struct polynomial));
+    return table_query(b->table, name)->data;
+}
+
+static struct polynomial *lookup(struct batch *b, const char *name) {
+    if (name == NULL)
+        return NULL;
+    Item *itm;
+    if (b->lets->size > 0 && (itm = table_query(b->lets, name)) != NULL)
+        return lookup_let(b, name, *(int *)itm->data);
+    itm = table_query(b->table, name);
+    if (itm != NULL)
+        return itm->data;
+    struct polynomial *p = lookup_packed(b, name);
+    if (p == NULL)
+        p = lookup_soa(b, name);
+    return p != NULL ? p : lookup_store(b, name);
+}
+
+// Look up every name of set. The names are copied out first since a lookup
+// may change the set.
+static void lookup_all(struct batch *b, HashTable *set) {
+    size_t count = set->size, pos = 0;
+    char **names = malloc(sizeof(char *) * (count + 1));
+    for (size_t i = 0; i < count; ++i)
+        names[i] = strdup(table_next(set, &pos)->key);
+    for (size_t i = 0; i < count; ++i) {
+        lookup(b, names[i]);
+        free(names[i]);
+    }
+    free(names);
+}
+
+// store p as name, dropping a pending let, packed, SoA, modular or
+// multivariate value of the same name
+static void define(struct batch *b, const char *name,
+                   const struct polynomial *p) {
+    table_emplace(b->table, name, p, sizeof(struct polynomial));
+    if (b->lets->size > 0)
+        table_erase(b->lets, name);
+    if (b->packed->size > 0)
+        table_erase(b->packed, name);
+    if (b->soa->size > 0)
+        table_erase(b->soa, name);
+    if (b->mod->size > 0)
+        table_erase(b->mod, name);
+    if (b->multi->size > 0)
+        table_erase(b->multi, name);
+}
+
+// the same for a packed polynomial
+static void define_packed(struct batch *b, const char *name,
+                          const struct poly_packed *p) {
+    table_emplace(b->packed, name, p, sizeof(struct poly_packed));
+    table_erase(b->table, name);
+    if (b->lets->size > 0)
+        table_erase(b->lets, name);
+    if (b->soa->size > 0)
+        table_erase(b->soa, name);
+    if (b->mod->size > 0)
+        table_erase(b->mod, name);
+    if (b->multi->size > 0)
+        table_erase(b->multi, name);
+}
+
+// one in the SoA layout
+static void define_soa(struct batch *b, const char *name,
+                       const struct poly_soa *p) {
+    table_emplace(b->soa, name, p, sizeof(struct poly_soa));
+    table_erase(b->table, name);
+    if (b->lets->size > 0)
+        table_erase(b->lets, name);
+    if (b->packed->size > 0)
+        table_erase(b->packed, name);
+    if (b->mod->size > 0)
+        table_erase(b->mod, name);
+    if (b->multi->size > 0)
+        table_erase(b->multi, name);
+}
+
+// the same for a polynomial with modular coefficients
+static void define_mod(struct batch *b, const char *name,
+                       const struct poly_mod *p) {
+    table_emplace(b->mod, name, p, sizeof(struct poly_mod));
+    table_erase(b->table, name);
+    if (b->lets->size > 0)
+        table_erase(b->lets, name);
+    if (b->packed->size > 0)
+        table_erase(b->packed, name);
+    if (b->soa->size > 0)
+        table_erase(b->soa, name);
+    if (b->multi->size > 0)
+        table_erase(b->multi, name);
+}
+
+// and for a multivariate one
+static void define_multi(struct batch *b, const char *name,
+                         const struct mpoly *p) {
+    table_emplace(b->multi, name, p, sizeof(struct mpoly));
+    table_erase(b->table, name);
+    if (b->lets->size > 0)
+        table_erase(b->lets, name);
+    if (b->packed->size > 0)
+        table_erase(b->packed, name);
+    if (b->soa->size > 0)
+        table_erase(b->soa, name);
+    if (b->mod->size > 0)
+        table_erase(b->mod, name);
+}
+
+void batch_init(struct batch *b, FILE *out) {
+    // everything the session creates comes from its own pool
+    b->pool = pool_create();
+    b->prev_alloc = allocator_use(pool_allocator(b->pool));
+    b->table = table_create(poly_free_adapter);
+    table_set_move_callback(b->table, poly_move_adapter);
+    b->expr = expr_create();
+    b->lets = table_create(NULL);
+    b->packed = table_create(packed_free_adapter);
+    b->soa = table_create(soa_free_adapter);
+    b->soa_results = false;
+    b->mod = table_create(mod_free_adapter);
+    b->multi = table_create(multi_free_adapter);
+    b->cache = cache_create(BATCH_CACHE_BUDGET);
+    b->stores = NULL;
+    b->nstores = 0;
+    b->out = out;
+    b->err = stderr;
+    b->session = b;
+    b->line = 0;
+    b->errors = 0;
+    b->has_prepared = false;
+}
+
+void batch_view(struct batch *view, struct batch *b, FILE *out) {
+    *view = *b->session;
+    view->out = view->err = out;
+    view->line = 0;
+    view->errors = 0;
+    view->has_prepared = false;
+}
+
+// the polynomial name resolves to without evaluating, unpacking or mapping
+// anything, the precedence of lookup; packed covers the SoA layout too
+static bool resolved(struct batch *b, const char *name, bool packed) {
+    if (name == NULL ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return false;
+    return table_query(b->table, name) != NULL ||
+           (b->mod->size > 0 && table_query(b->mod, name) != NULL) ||
+           (b->multi->size > 0 && table_query(b->multi, name) != NULL) ||
+           (packed && b->packed->size > 0 &&
+            table_query(b->packed, name) != NULL) ||
+           (packed && b->soa->size > 0 && table_query(b->soa, name) != NULL);
+}
+
+// copy the command of line to buf to parse it without modifying line, false
+// if it does not fit
+static bool copy_line(char buf[STRING_MAX_LEN], const char *line) {
+    size_t len = strcspn(line, "\n");
+    if (len >= STRING_MAX_LEN)
+        return false;
+    memcpy(buf, line, len);
+    buf[len] = 0;
+    return true;
+}
+
+bool batch_read_only(struct batch *b, const char *line) {
+    char buf[STRING_MAX_LEN];
+    if (!copy_line(buf, line))
+        return false;
+    char *args = buf, *cmd = next_word(&args);
+    if (cmd == NULL || *cmd == '#')
+        return true;
+    char *name = next_word(&args);
+    // print and get read packed and SoA polynomials as they are, eval
+    // converts them
+    if (!strcmp(cmd, "print") || !strcmp(cmd, "get"))
+        return resolved(b, name, true);
+    if (!strcmp(cmd, "eval"))
+        return resolved(b, name, false);
+    return !strcmp(cmd, "stats") || (!strcmp(cmd, "cache") && name == NULL);
+}
+
+// a polynomial of the table, what lookup returns for name if that changes
+// nothing
+static struct polynomial *find_plain(struct batch *b, const char *name) {
+    if (name == NULL ||
+        (b->lets->size > 0 && table_query(b->lets, name) != NULL))
+        return NULL;
+    Item *itm = table_query(b->table, name);
+    return itm != NULL ? itm->data : NULL;
+}
+
+static void drop_prepared(struct batch *b) {
+    if (b->has_prepared)
+        polynomial_release(&b->prepared);
+    b->has_prepared = false;
+}
+
+bool batch_prepare(struct batch *b, const char *line) {
+    char buf[STRING_MAX_LEN];
+    drop_prepared(b);
+    if (!copy_line(buf, line))
+        return false;
+    char *args = buf, *cmd = next_word(&args);
+    if (cmd == NULL || strcmp(cmd, "mul") != 0 || next_word(&args) == NULL)
+        return false;
+    struct polynomial *x = find_plain(b, next_word(&args));
+    struct polynomial *y = find_plain(b, next_word(&args));
+    if (x == NULL || y == NULL)
+        return false;
+    // a product the cache holds is left for batch_exec to copy
+    double cost = cache_prepare(b->cache, CACHE_MUL, &b->prepared, x, y);
+    if (cost < 0)
+        return false;
+    b->prepared_versions[0] = x->version;
+    b->prepared_versions[1] = y->version;
+    b->prepared_cost = cost;
+    b->has_prepared = true;
+    return true;
+}
+
+// dest = x * y from batch_prepare, if neither operand has changed since
+static bool take_prepared(struct batch *b, enum cache_op cop,
+                          struct polynomial *dest, const struct polynomial *x,
+                          const struct polynomial *y) {
+    if (!b->has_prepared || cop != CACHE_MUL ||
+        x->version != b->prepared_versions[0] ||
+        y->version != b->prepared_versions[1])
+        return false;
+    polynomial_move(dest, &b->prepared);
+    b->has_prepared = false;
+    cache_commit(b->cache, cop, dest, x, y, b->prepared_cost);
+    return true;
+}
+
+void batch_free(struct batch *b) {
+    drop_prepared(b);
+    // the views into the stores go first
+    table_free(&b->table);
+    table_free(&b->lets);
+    table_free(&b->packed);
+    table_free(&b->soa);
+    table_free(&b->mod);
+    table_free(&b->multi);
+    expr_free(b->expr);
+    cache_free(b->cache);
+    for (int i = 0; i < b->nstores; ++i)
+        store_close(b->stores[i]);
+    free(b->stores);
+    allocator_use(b->prev_alloc);
+    pool_destroy(b->pool);
+}
+
+static int cmd_def(struct batch *b, char *args) {
+    char *name = next_word(&args);
+    if (name == NULL)
+        return fail(b, "def: missing name");
+    for (; isspace((unsigned char)*args); ++args)
+        ;
+    if (*args == '=')
+        ++args;
+    struct polynomial p;
+    size_t pos;
+    if (polynomial_parse(&p, args, strlen(args), &pos) != 0)
+        return fail(b, "def: invalid polynomial at '%.16s'", args + pos);
+    if (b->session->soa_results) {
+        struct poly_soa q;
+        soa_from_terms(&q, &p);
+        polynomial_release(&p);
+        define_soa(b, name, &q);
+        return 0;
+    }
+    // the table keeps a shallow copy of the struct
+    define(b, name, &p);
+    return 0;
+}
+
+static int cmd_defmod(struct batch *b, char *args) {
+    char *name = next_word(&args);
+    struct mod_field f;
+    if (name == NULL)
+        return fail(b, "defmod: missing name");
+    if (parse_modulus(next_word(&args), &f))
+        return fail(b, "defmod: modulus is not an odd prime below 2^62");
+    for (; isspace((unsigned char)*args); ++args)
+        ;
+    if (*args == '=')
+        ++args;
+    struct poly_mod p;
+    size_t pos;
+    if (mod_parse(&p, &f, args, strlen(args), &pos) != 0)
+        return fail(b, "defmod: invalid polynomial at '%.16s'", args + pos);
+    define_mod(b, name, &p);
+    return 0;
+}
+
+static int cmd_defmulti(struct batch *b, char *args) {
+    char *name = next_word(&args), *vars = next_word(&args);
+    struct mpoly_ring r;
+    if (name == NULL)
+        return fail(b, "defmulti: missing name");
+    if (vars == NULL || mpoly_ring_init(&r, vars) != 0)
+        return fail(b, "defmulti: variables are not 1 to %d distinct "
+                       "lowercase letters",
+                    MPOLY_MAX_VARS);
+    for (; isspace((unsigned char)*args); ++args)
+        ;
+    if (*args == '=')
+        ++args;
+    struct mpoly p;
+    size_t pos;
+    if (mpoly_parse(&p, &r, args, strlen(args), &pos) != 0)
+        return fail(b, "defmulti: invalid polynomial at '%.16s'", args + pos);
+    define_multi(b, name, &p);
+    return 0;
+}
+
+// Parse the definition lines in [data, data + n). A trailing line without a
+// newline is left alone unless final is set. Returns the bytes consumed.
+static size_t ingest(struct batch *b, const char *data, size_t n,
+                     const char *path, long *line, long *loaded, bool final) {
+    const char *it = data, *end = data + n;
+    while (it < end) {
+        const char *eol = memchr(it, '\n', end - it);
+        if (eol == NULL) {
+            if (!final)
+                break;
+            eol = end;
+        }
+        ++*line;
+        const char *start = it, *s = it;
+        it = eol < end ? eol + 1 : end;
+        for (; s < eol && isspace((unsigned char)*s); ++s)
+            ;
+        if (s == eol || *s == '#')
+            continue;
+        if (eol - s > 4 && memcmp(s, "def", 3) == 0 &&
+            isspace((unsigned char)s[3]))
+            for (s += 3; s < eol && isspace((unsigned char)*s); ++s)
+                ;
+        const char *name = s;
+        for (; s < eol && !isspace((unsigned char)*s) && *s != '='; ++s)
+            ;
+        char key[STRING_MAX_LEN];
+        size_t key_len = s - name;
+        if (key_len == 0 || key_len >= sizeof(key)) {
+            fprintf(b->err, "%s:%ld: error: invalid name\n", path, *line);
+            b->errors++;
+            continue;
+        }
+        memcpy(key, name, key_len);
+        key[key_len] = 0;
+        for (; s < eol && isspace((unsigned char)*s); ++s)
+            ;
+        if (s < eol && *s == '=')
+            ++s;
+        struct polynomial p;
+        size_t pos;
+        if (polynomial_parse(&p, s, eol - s, &pos) != 0) {
+            fprintf(b->err, "%s:%ld:%ld: error: invalid polynomial\n", path,
+                    *line, (long)(s + pos - start) + 1);
+            b->errors++;
+            continue;
+        }
+        define(b, key, &p);
+        ++*loaded;
+    }
+    return it - data;
+}
+
+long batch_load(struct batch *b, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        b->errors++;
+        return -1;
+    }
+    long line = 0, loaded = 0;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        ingest(b, map, st.st_size, path, &line, &loaded, true);
+        munmap(map, st.st_size);
+    } else {
+        // pipes and the like are streamed through a large buffer instead
+        size_t cap = 1 << 20, len = 0;
+        char *buf = malloc(cap);
+        ssize_t got;
+        while ((got = read(fd, buf + len, cap - len)) > 0) {
+            len += got;
+            size_t used = ingest(b, buf, len, path, &line, &loaded, false);
+            memmove(buf, buf + used, len - used);
+            len -= used;
+            if (len == cap) // a single line longer than the buffer
+                buf = realloc(buf, cap *= 2);
+        }
+        ingest(b, buf, len, path, &line, &loaded, true);
+        free(buf);
+    }
+    close(fd);
+    return loaded;
+}
+
+static int cmd_load(struct batch *b, char *args) {
+    char *path = next_word(&args);
+    if (path == NULL)
+        return fail(b, "load: missing file name");
+    long errors = b->errors;
+    if (batch_load(b, path) < 0 || b->errors != errors)
+        return 1;
+    return 0;
+}
+
+// drop the formula nodes no pending let needs any more
+static void collect_formulas(struct batch *b) {
+    int **roots = malloc(sizeof(int *) * (b->lets->size + 1));
+    size_t pos = 0;
+    int n = 0;
+    for (Item *itm; (itm = table_next(b->lets, &pos)) != NULL;)
+        roots[n++] = itm->data;
+    expr_collect(b->expr, roots, n);
+    free(roots);
+}
+
+static int cmd_let(struct batch *b, char *args) {
+    char *name = next_word(&args);
+    if (name == NULL)
+        return fail(b, "let: missing name");
+    for (; isspace((unsigned char)*args); ++args)
+        ;
+    if (*args == '=')
+        ++args;
+    if (expr_collect_due(b->expr))
+        collect_formulas(b);
+    size_t pos;
+    int root = expr_parse(b->expr, args, &pos);
+    if (root < 0)
+        return fail(b, "let: invalid expression at '%.16s'", args + pos);
+    table_emplace(b->lets, name, &root, sizeof(root));
+    return 0;
+}
+
+static int cmd_save(struct batch *b, char *args) {
+    char *path = next_word(&args);
+    if (path == NULL)
+        return fail(b, "save: missing file name");
+    // pending lets are evaluated, packed and SoA polynomials converted
+    lookup_all(b, b->lets);
+    lookup_all(b, b->packed);
+    lookup_all(b, b->soa);
+    // whatever the stores still hold has to be in the table to be written
+    struct batch *s = b->session;
+    for (int i = 0; i < s->nstores; ++i)
+        for (size_t j = 0; j < store_count(s->stores[i]); ++j)
+            if (table_query(b->table, store_name(s->stores[i], j)) == NULL)
+                lookup_store(b, store_name(s->stores[i], j));
+    if (store_save(b->table, path) != 0)
+        return fail(b, "save: %s: %s", path, strerror(errno));
+    return 0;
+}
+
+static int cmd_open(struct batch *b, char *args) {
+    char *path = next_word(&args);
+    if (path == NULL)
+        return fail(b, "open: missing file name");
+    struct store *s = store_open(path);
+    if (s == NULL)
+        return fail(b, "open: %s: %s", path, strerror(errno));
+    struct batch *session = b->session;
+    session->stores = realloc(session->stores,
+                              sizeof(struct store *) * (session->nstores + 1));
+    session->stores[session->nstores++] = s;
+    return 0;
+}
+
+static int cmd_pack(struct batch *b, char *args) {
+    HashTable *names = table_create(NULL);
+    for (char *word; (word = next_word(&args)) != NULL;)
+        table_emplace(names, word, "", 1);
+    if (names->size == 0) {
+        size_t pos = 0;
+        for (Item *itm; (itm = table_next(b->table, &pos)) != NULL;)
+            table_emplace(names, itm->key, "", 1);
+    }
+    size_t pos = 0, before = 0, after = 0;
+    long packed = 0;
+    int ret = 0;
+    for (Item *itm; (itm = table_next(names, &pos)) != NULL;) {
+        if (find_packed(b, itm->key) != NULL)
+            continue;
+        struct polynomial *p = lookup(b, itm->key);
+        if (p == NULL) {
+            ret = fail(b, "pack: cannot find polynomial '%s'", itm->key);
+            continue;
+        }
+        struct poly_packed q;
+        packed_from_terms(&q, p);
+        // the structs the table holds and what they own, short polynomials
+        // keep their terms in the struct
+        before += sizeof(struct polynomial) +
+                  (p->terms != p->small ? sizeof(struct term) * p->cap : 0);
+        after += sizeof(struct poly_packed) + packed_bytes(&q);
+        packed++;
+        table_erase(b->table, itm->key);
+        table_emplace(b->packed, itm->key, &q, sizeof(q));
+    }
+    table_free(&names);
+    fprintf(b->out, "packed %ld polynomials, %zu -> %zu bytes\n", packed,
+            before, after);
+    return ret;
+}
+
+static int cmd_layout(struct batch *b, char *args) {
+    char *kind = next_word(&args);
+    bool soa = kind != NULL && !strcmp(kind, "soa");
+    if (!soa && (kind == NULL || strcmp(kind, "terms") != 0))
+        return fail(b, "layout: expected soa or terms");
+    HashTable *names = table_create(NULL);
+    for (char *word; (word = next_word(&args)) != NULL;)
+        table_emplace(names, word, "", 1);
+    // without names every polynomial, and the results from now on
+    if (names->size == 0) {
+        b->session->soa_results = soa;
+        size_t pos = 0;
+        for (Item *itm; (itm = table_next(soa ? b->table : b->soa, &pos));)
+            table_emplace(names, itm->key, "", 1);
+    }
+    size_t pos = 0;
+    int ret = 0;
+    for (Item *itm; (itm = table_next(names, &pos)) != NULL;) {
+        if (soa && find_soa(b, itm->key) != NULL)
+            continue;
+        // the lookup converts an SoA polynomial back
+        struct polynomial *p = lookup(b, itm->key);
+        if (p == NULL) {
+            ret = fail(b, "layout: cannot find polynomial '%s'", itm->key);
+            continue;
+        }
+        if (soa) {
+            struct poly_soa q;
+            soa_from_terms(&q, p);
+            define_soa(b, itm->key, &q);
+        }
+    }
+    table_free(&names);
+    return ret;
+}
+
+static int cmd_mod(struct batch *b, char *args) {
+    struct mod_field f;
+    if (parse_modulus(next_word(&args), &f))
+        return fail(b, "mod: modulus is not an odd prime below 2^62");
+    int ret = 0;
+    for (char *name; (name = next_word(&args)) != NULL;) {
+        struct poly_mod *m = find_mod(b, name), q;
+        struct polynomial *p = m == NULL ? lookup(b, name) : NULL;
+        if (m == NULL && p == NULL) {
+            ret = fail(b, "mod: cannot find polynomial '%s'", name);
+            continue;
+        }
+        // already reduced, which can only be repeated with the same modulus
+        if (m != NULL) {
+            if (m->field.p != f.p)
+                ret = fail(b, "mod: '%s' is already reduced modulo %" PRIu64,
+                           name, m->field.p);
+            continue;
+        }
+        if (mod_from_terms(&q, &f, p) != 0) {
+            ret = fail(b, "mod: '%s' has a coefficient that is not an integer",
+                       name);
+            continue;
+        }
+        define_mod(b, name, &q);
+    }
+    return ret;
+}
+
+static int cmd_print(struct batch *b, char *args) {
+    char *name = next_word(&args);
+    struct poly_mod *m = find_mod(b, name);
+    if (m != NULL) {
+        mod_print_fp(m, b->out);
+        fputc('\n', b->out);
+        return 0;
+    }
+    struct mpoly *mp = find_multi(b, name);
+    if (mp != NULL) {
+        mpoly_print_fp(mp, b->out);
+        fputc('\n', b->out);
+        return 0;
+    }
+    struct poly_soa *v = find_soa(b, name);
+    if (v != NULL) {
+        soa_print_fp(v, b->out);
+        fputc('\n', b->out);
+        return 0;
+    }
+    struct poly_packed *q = find_packed(b, name);
+    struct polynomial *p = q == NULL ? lookup(b, name) : NULL;
+    if (p == NULL && q == NULL)
+        return fail(b, "print: cannot find polynomial");
+    if (q != NULL)
+        packed_print_fp(q, b->out);
+    else
+        polynomial_print_fp(p, b->out);
+    fputc('\n', b->out);
+    return 0;
+}
+
+// the monomial of a multivariate polynomial is written as a term ("x^2y")
+static int multi_get(struct batch *b, const struct mpoly *p, char *args) {
+    struct mpoly mono;
+    if (mpoly_parse(&mono, &p->ring, args, strlen(args), NULL) != 0)
+        return fail(b, "get: invalid monomial");
+    bool single = mono.size == 1 && mono.terms[0].coeff == 1;
+    uint64_t key = single ? mono.terms[0].mono : 0;
+    mpoly_release(&mono);
+    if (!single)
+        return fail(b, "get: invalid monomial");
+    fprintf(b->out, "%lg\n", mpoly_get_term(p, key));
+    return 0;
+}
+
+static int cmd_get(struct batch *b, char *args) {
+    char *name = next_word(&args);
+    struct mpoly *mp = find_multi(b, name);
+    if (mp != NULL)
+        return multi_get(b, mp, args);
+    struct poly_mod *m = find_mod(b, name);
+    struct poly_soa *v = m == NULL ? find_soa(b, name) : NULL;
+    struct poly_packed *q = m == NULL && v == NULL ? find_packed(b, name)
+                                                   : NULL;
+    struct polynomial *p =
+        m == NULL && v == NULL && q == NULL ? lookup(b, name) : NULL;
+    int exp;
+    if (p == NULL && q == NULL && m == NULL && v == NULL)
+        return fail(b, "get: cannot find polynomial");
+    if (parse_int(next_word(&args), &exp))
+        return fail(b, "get: invalid exponent");
+    if (m != NULL) {
+        fprintf(b->out, "%" PRIu64 "\n", mod_get_term(m, exp));
+        return 0;
+    }
+    if (v != NULL) {
+        fprintf(b->out, "%lg\n", soa_get_term(v, exp));
+        return 0;
+    }
+    fprintf(b->out, "%lg\n", q != NULL ? packed_get_term(q, exp)
+                                        : polynomial_get_term(p, exp));
+    return 0;
+}
+
+static int cmd_eval(struct batch *b, char *args) {
+    struct polynomial *p = lookup(b, next_word(&args));
+    if (p == NULL)
+        return fail(b, "eval: cannot find polynomial");
+    // a point and its separator take at least two characters, so the points
+    // and their values both fit in one double per character
+    size_t len = strlen(args) + 1;
+    double *xs = arena_alloc(arena_scratch(), sizeof(double) * len);
+    size_t n = 0;
+    for (char *w; (w = next_word(&args)) != NULL; ++n)
+        if (parse_double(w, &xs[n]))
+            return fail(b, "eval: invalid point '%s'", w);
+    if (n == 0)
+        return fail(b, "eval: missing point");
+    double *ys = xs + n;
+    polynomial_eval_many(p, xs, ys, n);
+    for (size_t i = 0; i < n; ++i)
+        fprintf(b->out, i + 1 < n ? "%lg " : "%lg\n", ys[i]);
+    return 0;
+}
+
+static int cmd_set(struct batch *b, char *args) {
+    struct polynomial *p = lookup(b, next_word(&args));
+    if (p == NULL)
+        return fail(b, "set: cannot find polynomial");
+    // a pair takes at least four characters
+    struct term *terms = arena_alloc(
+        arena_scratch(), sizeof(struct term) * (strlen(args) / 4 + 1));
+    int n = 0;
+    for (char *word; (word = next_word(&args)) != NULL; ++n) {
+        if (parse_int(word, &terms[n].exp))
+            return fail(b, "set: invalid exponent");
+        if (parse_double(next_word(&args), &terms[n].coeff))
+            return fail(b, "set: invalid coefficient");
+    }
+    if (n == 0)
+        return fail(b, "set: missing exponent");
+    // a zero coefficient removes the term, however many pairs there are
+    polynomial_set_terms(p, terms, n);
+    return 0;
+}
+
+static int cmd_del(struct batch *b, char *args) {
+    struct polynomial *p = lookup(b, next_word(&args));
+    if (p == NULL)
+        return fail(b, "del: cannot find polynomial");
+    int *exps =
+        arena_alloc(arena_scratch(), sizeof(int) * (strlen(args) / 2 + 1));
+    int n = 0;
+    for (char *word; (word = next_word(&args)) != NULL; ++n)
+        if (parse_int(word, &exps[n]))
+            return fail(b, "del: invalid exponent");
+    if (n == 0)
+        return fail(b, "del: missing exponent");
+    // a del that fails leaves the polynomial as it is
+    for (int i = 0; i < n; ++i)
+        if (!polynomial_has_term(p, exps[i]))
+            return fail(b, "del: term not found");
+    polynomial_remove_terms(p, exps, n);
+    return 0;
+}
+
+// add, sub and mul of two polynomials with modular coefficients
+static int mod_binary(struct batch *b, const char *dest, const char *op,
+                      enum cache_op cop, const struct poly_mod *x,
+                      const struct poly_mod *y) {
+    if (x->field.p != y->field.p)
+        return fail(b, "%s: the moduli differ", op);
+    struct poly_mod r;
+    if (cop == CACHE_ADD)
+        mod_add(&r, x, y);
+    else if (cop == CACHE_SUB)
+        mod_sub(&r, x, y);
+    else if (mod_mul(&r, x, y) != 0)
+        return fail(b, "%s: an exponent of the result is out of range", op);
+    define_mod(b, dest, &r);
+    return 0;
+}
+
+// and of two multivariate polynomials
+static int multi_binary(struct batch *b, const char *dest, const char *op,
+                        enum cache_op cop, const struct mpoly *x,
+                        const struct mpoly *y) {
+    if (strcmp(x->ring.vars, y->ring.vars) != 0)
+        return fail(b, "%s: the variables differ", op);
+    struct mpoly r;
+    if (cop == CACHE_ADD)
+        mpoly_add(&r, x, y);
+    else if (cop == CACHE_SUB)
+        mpoly_sub(&r, x, y);
+    else if (mpoly_mul(&r, x, y) != 0)
+        return fail(b, "%s: an exponent exceeds %d", op,
+                    mpoly_max_exp(&x->ring));
+    define_multi(b, dest, &r);
+    return 0;
+}
+
+// Packed operands stay packed: the packed kernels stream them and the result
+// is stored packed. A plain operand is packed for the operation only.
+static int packed_binary(struct batch *b, const char *dest, const char *op,
+                         enum cache_op cop, const char *xname,
+                         const char *yname) {
+    struct poly_packed tmp[2];
+    const struct poly_packed *q[2];
+    const char *names[2] = {xname, yname};
+    int ntmp = 0;
+    for (int i = 0; i < 2; ++i) {
+        // a plain lookup never unpacks the other operand
+        if ((q[i] = find_packed(b, names[i])) != NULL)
+            continue;
+        struct polynomial *p = lookup(b, names[i]);
+        if (p == NULL) {
+            while (ntmp > 0)
+                packed_release(&tmp[--ntmp]);
+            return fail(b, "%s: cannot find polynomial", op);
+        }
+        packed_from_terms(&tmp[ntmp], p);
+        q[i] = &tmp[ntmp++];
+    }
+    struct poly_packed r;
+    if (cop == CACHE_ADD)
+        packed_add(&r, q[0], q[1]);
+    else if (cop == CACHE_SUB)
+        packed_sub(&r, q[0], q[1]);
+    else
+        packed_mul(&r, q[0], q[1]);
+    while (ntmp > 0)
+        packed_release(&tmp[--ntmp]);
+    define_packed(b, dest, &r);
+    return 0;
+}
+
+// The same for the SoA layout: add and sub run the merge kernels of soa.h
+// on SoA operands and every result is stored SoA, mul goes through the
+// terms. A plain operand is converted for the operation only.
+static int soa_binary(struct batch *b, const char *dest, const char *op,
+                      enum cache_op cop, const char *xname,
+                      const char *yname) {
+    struct poly_soa tmp[2];
+    const struct poly_soa *q[2];
+    const char *names[2] = {xname, yname};
+    int ntmp = 0;
+    for (int i = 0; i < 2; ++i) {
+        if ((q[i] = find_soa(b, names[i])) != NULL)
+            continue;
+        struct polynomial *p = lookup(b, names[i]);
+        if (p == NULL) {
+            while (ntmp > 0)
+                soa_release(&tmp[--ntmp]);
+            return fail(b, "%s: cannot find polynomial", op);
+        }
+        soa_from_terms(&tmp[ntmp], p);
+        q[i] = &tmp[ntmp++];
+    }
+    struct poly_soa r;
+    if (cop == CACHE_ADD)
+        soa_add(&r, q[0], q[1]);
+    else if (cop == CACHE_SUB)
+        soa_sub(&r, q[0], q[1]);
+    else {
+        struct polynomial x, y, p;
+        soa_to_terms(&x, q[0]);
+        soa_to_terms(&y, q[1]);
+        polynomial_mul(&p, &x, &y);
+        soa_from_terms(&r, &p);
+        polynomial_release(&x);
+        polynomial_release(&y);
+        polynomial_release(&p);
+    }
+    while (ntmp > 0)
+        soa_release(&tmp[--ntmp]);
+    define_soa(b, dest, &r);
+    return 0;
+}
+
+static int cmd_binary(struct batch *b, char *args, const char *op,
+                      enum cache_op cop) {
+    char *dest = next_word(&args);
+    char *xname = next_word(&args), *yname = next_word(&args);
+    if (dest == NULL)
+        return fail(b, "%s: missing result name", op);
+    struct mpoly *px = find_multi(b, xname), *py = find_multi(b, yname);
+    if (px != NULL && py != NULL)
+        return multi_binary(b, dest, op, cop, px, py);
+    if (px != NULL || py != NULL)
+        return fail(b, "%s: cannot mix multivariate and univariate "
+                       "polynomials",
+                    op);
+    struct poly_mod *mx = find_mod(b, xname), *my = find_mod(b, yname);
+    if ((mx == NULL && find_packed(b, xname) != NULL) ||
+        (my == NULL && find_packed(b, yname) != NULL)) {
+        if (mx != NULL || my != NULL)
+            return fail(b, "%s: cannot mix modular and real coefficients",
+                        op);
+        return packed_binary(b, dest, op, cop, xname, yname);
+    }
+    if ((mx == NULL && find_soa(b, xname) != NULL) ||
+        (my == NULL && find_soa(b, yname) != NULL) ||
+        (b->session->soa_results && mx == NULL && my == NULL)) {
+        if (mx != NULL || my != NULL)
+            return fail(b, "%s: cannot mix modular and real coefficients",
+                        op);
+        return soa_binary(b, dest, op, cop, xname, yname);
+    }
+    struct polynomial *x = mx == NULL ? lookup(b, xname) : NULL;
+    struct polynomial *y = my == NULL ? lookup(b, yname) : NULL;
+    if ((x == NULL && mx == NULL) || (y == NULL && my == NULL))
+        return fail(b, "%s: cannot find polynomial", op);
+    if (mx != NULL && my != NULL)
+        return mod_binary(b, dest, op, cop, mx, my);
+    if (mx != NULL || my != NULL)
+        return fail(b, "%s: cannot mix modular and real coefficients", op);
+    struct polynomial r;
+    if (!take_prepared(b, cop, &r, x, y))
+        cache_binary(b->cache, cop, &r, x, y);
+    define(b, dest, &r);
+    return 0;
+}
+
+static int cmd_pow(struct batch *b, char *args) {
+    char *dest = next_word(&args), *name = next_word(&args);
+    struct poly_mod *m = find_mod(b, name);
+    struct polynomial *x = m == NULL ? lookup(b, name) : NULL;
+    int k;
+    if (dest == NULL)
+        return fail(b, "pow: missing result name");
+    if (x == NULL && m == NULL)
+        return fail(b, "pow: cannot find polynomial");
+    if (parse_int(next_word(&args), &k) || k < 0)
+        return fail(b, "pow: invalid exponent");
+    if (m != NULL) {
+        struct poly_mod r;
+        if (mod_pow(&r, m, k) != 0)
+            return fail(b, "pow: an exponent of the result is out of range");
+        define_mod(b, dest, &r);
+        return 0;
+    }
+    struct polynomial r;
+    if (polynomial_pow(&r, x, k) != 0)
+        return fail(b, "pow: an exponent of the result is out of range");
+    define(b, dest, &r);
+    return 0;
+}
+
+static int cmd_div(struct batch *b, char *args) {
+    char *qname = next_word(&args), *rname = next_word(&args);
+    struct polynomial *x = lookup(b, next_word(&args));
+    struct polynomial *y = lookup(b, next_word(&args));
+    if (qname == NULL || rname == NULL)
+        return fail(b, "div: missing result name");
+    if (x == NULL || y == NULL)
+        return fail(b, "div: cannot find polynomial");
+    struct polynomial q, r;
+    if (polynomial_divmod(&q, &r, x, y) != 0)
+        return fail(b, "div: division by zero");
+    define(b, qname, &q);
+    define(b, rname, &r);
+    return 0;
+}
+
+static int cmd_inplace(struct batch *b, char *args, const char *op,
+                       void (*fn)(struct polynomial *,
+                                  const struct polynomial *)) {
+    struct polynomial *dest = lookup(b, next_word(&args));
+    struct polynomial *x = lookup(b, next_word(&args));
+    if (dest == NULL || x == NULL)
+        return fail(b, "%s: cannot find polynomial", op);
+    fn(dest, x);
+    return 0;
+}
+
+static int cmd_fma(struct batch *b, char *args) {
+    struct polynomial *dest = lookup(b, next_word(&args));
+    struct polynomial *x = lookup(b, next_word(&args));
+    struct polynomial *y = lookup(b, next_word(&args));
+    if (dest == NULL || x == NULL || y == NULL)
+        return fail(b, "fma: cannot find polynomial");
+    polynomial_fma(dest, x, y);
+    return 0;
+}
+
+static int cmd_cache(struct batch *b, char *args) {
+    char *word = next_word(&args);
+    if (word != NULL) {
+        char *end;
+        errno = 0;
+        unsigned long long budget = strtoull(word, &end, 10);
+        if (end == word || *end || errno)
+            return fail(b, "cache: invalid budget");
+        cache_set_budget(b->cache, budget);
+        return 0;
+    }
+    struct cache_stats s;
+    cache_stats(b->cache, &s);
+    fprintf(b->out,
+            "hits %llu misses %llu evictions %llu entries %zu bytes %zu "
+            "budget %zu\n",
+            (unsigned long long)s.hits, (unsigned long long)s.misses,
+            (unsigned long long)s.evictions, s.entries, s.bytes, s.budget);
+    return 0;
+}
+
+static int cmd_threads(struct batch *b, char *args) {
+    int n;
+    if (parse_int(next_word(&args), &n) || n < 0)
+        return fail(b, "threads: invalid thread count");
+    // the setting is global, one client must not change it for the others
+    if (b->session != b)
+        return fail(b, "threads: not available to server clients");
+    polynomial_mul_set_threads(n);
+    return 0;
+}
+
+static int cmd_stats(struct batch *b, char *args) {
+    char *word = next_word(&args);
+    if (word != NULL && strcmp(word, "reset") != 0)
+        return fail(b, "stats: unknown argument '%s'", word);
+    if (word != NULL)
+        stats_reset();
+    else
+        stats_print_json(b->out);
+    return 0;
+}
+
+// extmul writes the product either as a "NAME = POLY" line or to a store
+struct text_sink {
+    FILE *fp;
+    bool lead; // a term was written
+};
+
+// every coefficient in full (print rounds to 6 digits), so that load gets
+// back the very product the store format holds
+static int text_put(void *ctx, const struct term *terms, size_t n) {
+    struct text_sink *s = ctx;
+    for (size_t i = 0; i < n; ++i) {
+        double c = terms[i].coeff;
+        if (s->lead)
+            fprintf(s->fp, " %c ", "-+"[c > 0]);
+        fprintf(s->fp, "%.17g", s->lead ? fabs(c) : c);
+        if (terms[i].exp == 1)
+            fputc('x', s->fp);
+        else if (terms[i].exp != 0)
+            fprintf(s->fp, "x^%d", terms[i].exp);
+        s->lead = true;
+    }
+    return ferror(s->fp) ? -1 : 0;
+}
+
+static int store_put(void *ctx, const struct term *terms, size_t n) {
+    return store_writer_put(ctx, terms, n);
+}
+
+static long long extmul_text(const char *path, const char *name,
+                             const struct polynomial *x,
+                             const struct polynomial *y,
+                             const struct extmul_config *cfg) {
+    struct text_sink s = {.fp = fopen(path, "w")};
+    if (s.fp == NULL)
+        return -1;
+    fprintf(s.fp, "%s = ", name);
+    long long n = extmul(x, y, cfg, &(struct extmul_sink){text_put, &s});
+    fputs(s.lead ? "\n" : "0\n", s.fp);
+    if (fclose(s.fp) != 0)
+        n = -1;
+    if (n < 0) {
+        int err = errno;
+        unlink(path);
+        errno = err;
+    }
+    return n;
+}
+
+static long long extmul_store(const char *path, const char *name,
+                              const struct polynomial *x,
+                              const struct polynomial *y,
+                              const struct extmul_config *cfg) {
+    struct store_writer *w = store_writer_open(path, name);
+    if (w == NULL)
+        return -1;
+    long long n = extmul(x, y, cfg, &(struct extmul_sink){store_put, w});
+    if (store_writer_close(w, n >= 0) != 0)
+        n = -1;
+    return n;
+}
+
+static int cmd_extmul(struct batch *b, char *args) {
+    char *format = next_word(&args), *path = next_word(&args);
+    char *name = next_word(&args);
+    struct polynomial *x = lookup(b, next_word(&args));
+    struct polynomial *y = lookup(b, next_word(&args));
+    char *word = next_word(&args);
+    bool text = format != NULL && !strcmp(format, "text");
+    if (format == NULL || (!text && strcmp(format, "store") != 0))
+        return fail(b, "extmul: the format must be store or text");
+    if (path == NULL || name == NULL)
+        return fail(b, "extmul: missing file or result name");
+    if (x == NULL || y == NULL)
+        return fail(b, "extmul: cannot find polynomial");
+    struct extmul_config cfg = {.memory = EXTMUL_MEMORY};
+    if (word != NULL) {
+        char *end;
+        errno = 0;
+        cfg.memory = strtoull(word, &end, 10);
+        if (end == word || *end || errno)
+            return fail(b, "extmul: invalid memory budget");
+    }
+    long long n = text ? extmul_text(path, name, x, y, &cfg)
+                       : extmul_store(path, name, x, y, &cfg);
+    if (n < 0)
+        return fail(b, "extmul: %s: %s", path, strerror(errno));
+    return 0;
+}
+
+#define UNKNOWN_COMMAND 2
+
+static int dispatch(struct batch *b, const char *cmd, char *args) {
+    switch (cmd[0]) {
+    case 'a':
+        if (!strcmp(cmd, "add"))
+            return cmd_binary(b, args, "add", CACHE_ADD);
+        break;
+    case 'c':
+        if (!strcmp(cmd, "cache"))
+            return cmd_cache(b, args);
+        break;
+    case 'd':
+        if (!strcmp(cmd, "def"))
+            return cmd_def(b, args);
+        if (!strcmp(cmd, "defmod"))
+            return cmd_defmod(b, args);
+        if (!strcmp(cmd, "defmulti"))
+            return cmd_defmulti(b, args);
+        if (!strcmp(cmd, "del"))
+            return cmd_del(b, args);
+        if (!strcmp(cmd, "div"))
+            return cmd_div(b, args);
+        break;
+    case 'e':
+        if (!strcmp(cmd, "eval"))
+            return cmd_eval(b, args);
+        if (!strcmp(cmd, "extmul"))
+            return cmd_extmul(b, args);
+        break;
+    case 'f':
+        if (!strcmp(cmd, "fma"))
+            return cmd_fma(b, args);
+        break;
+    case 'g':
+        if (!strcmp(cmd, "get"))
+            return cmd_get(b, args);
+        break;
+    case 'i':
+        if (!strcmp(cmd, "iadd"))
+            return cmd_inplace(b, args, "iadd", polynomial_add_inplace);
+        if (!strcmp(cmd, "isub"))
+            return cmd_inplace(b, args, "isub", polynomial_sub_inplace);
+        break;
+    case 'l':
+        if (!strcmp(cmd, "layout"))
+            return cmd_layout(b, args);
+        if (!strcmp(cmd, "let"))
+            return cmd_let(b, args);
+        if (!strcmp(cmd, "load"))
+            return cmd_load(b, args);
+        break;
+    case 'm':
+        if (!strcmp(cmd, "mod"))
+            return cmd_mod(b, args);
+        if (!strcmp(cmd, "mul"))
+            return cmd_binary(b, args, "mul", CACHE_MUL);
+        break;
+    case 'o':
+        if (!strcmp(cmd, "open"))
+            return cmd_open(b, args);
+        break;
+    case 'p':
+        if (!strcmp(cmd, "pack"))
+            return cmd_pack(b, args);
+        if (!strcmp(cmd, "pow"))
+            return cmd_pow(b, args);
+        if (!strcmp(cmd, "print"))
+            return cmd_print(b, args);
+        break;
+    case 'q':
+        if (!strcmp(cmd, "quit"))
+            return -1;
+        break;
+    case 's':
+        if (!strcmp(cmd, "save"))
+            return cmd_save(b, args);
+        if (!strcmp(cmd, "set"))
+            return cmd_set(b, args);
+        if (!strcmp(cmd, "stats"))
+            return cmd_stats(b, args);
+        if (!strcmp(cmd, "sub"))
+            return cmd_binary(b, args, "sub", CACHE_SUB);
+        break;
+    case 't':
+        if (!strcmp(cmd, "threads"))
+            return cmd_threads(b, args);
+        break;
+    }
+    return UNKNOWN_COMMAND;
+}
+
+int batch_exec(struct batch *b, char *line) {
+    STATS_TIMER(start);
+    char *args = line;
+    char *cmd = next_word(&args);
+    if (cmd == NULL || *cmd == '#')
+        return 0;
+    int ret = dispatch(b, cmd, args);
+    // a product batch_prepare kept for a command that did not use it
+    drop_prepared(b);
+    if (ret == UNKNOWN_COMMAND)
+        return fail(b, "unknown command '%s'", cmd);
+    // every known command gets a latency histogram
+    STATS_LATENCY(cmd, start);
+    return ret;
+}
+
+long batch_run(struct batch *b, FILE *in) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, in)) != -1) {
+        b->line++;
+        int ret = batch_exec(b, line);
+        // scratch memory never outlives a command
+        arena_reset(arena_scratch());
+        if (ret < 0)
+            break;
+    }
+    free(line);
+    return b->errors;
+}
@@ -0,0 +1,148 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "hash_map.h"
+#include "polynomial.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Line-oriented command interpreter for non-interactive use. Every line holds
+// one command, results go to out and diagnostics to stderr:
+//
+//   def NAME = POLY        define (or redefine) a polynomial
+//   let NAME = EXPR        define a polynomial by a formula (see expr.h),
+//                          evaluated when NAME is first used
+//   print NAME             print a polynomial
+//   get NAME EXP           print the coefficient of x^EXP
+//   eval NAME X...         print the value at every point X
+//   set NAME EXP COEFF...  set the coefficient of x^EXP for every pair, a
+//                          zero coefficient removes the term
+//   del NAME EXP...        remove the terms x^EXP
+//   add|sub|mul R A B      store A + B, A - B or A * B as R, results are
+//                          cached (see cache.h)
+//   pow R A K              store A^K as R
+//   div Q R A B            store the quotient and remainder of A / B as Q
+//                          and R
+//   iadd|isub R A          R += A or R -= A in place
+//   fma R A B              R += A * B in place
+//   extmul store|text FILE R A B [BYTES]
+//                          multiply A and B out of core in about BYTES of
+//                          memory (default 64 MiB, see extmul.h) and write
+//                          the product as R to FILE, a store for open or a
+//                          text file for load; R is not defined
+//   load FILE              define every polynomial listed in FILE
+//   threads N              multiply on N threads (0: one per CPU); not
+//                          for the clients of a server, see server.h
+//   save FILE              write every polynomial to a binary store
+//   open FILE              make the polynomials of a store available
+//   pack [NAME...]         keep polynomials (default: all defined ones)
+//                          compressed, see packed.h; print and get read them
+//                          as they are, add, sub and mul on them keep the
+//                          result packed, other commands unpack them on use
+//   layout soa|terms [NAME...]
+//                          keep polynomials in the structure-of-arrays
+//                          layout of soa.h or back in terms; without names
+//                          all defined ones, and the results of def, add,
+//                          sub and mul from then on. print and get read SoA
+//                          polynomials as they are, add and sub on them run
+//                          the vector merge and keep the result SoA, as mul
+//                          does, other commands convert them on use
+//   defmod NAME P = POLY   define a polynomial with coefficients modulo the
+//                          prime P, see modular.h
+//   mod P NAME...          reduce polynomials with integer coefficients
+//                          modulo P; print, get, add, sub, mul and pow work
+//                          on them exactly, the other commands and save do
+//                          not see them
+//   defmulti NAME VARS = POLY
+//                          define a polynomial in the variables VARS ("xyz"),
+//                          see mpoly.h; print, get (with a monomial such as
+//                          x^2y for EXP), add, sub and mul work on them
+//   cache [BYTES]          print cache statistics, or set the cache budget
+//   stats [reset]          print the instrumentation counters and latency
+//                          histograms as JSON (see stats.h), or zero them
+//   quit                   stop reading commands
+//
+// Blank lines and lines starting with '#' are ignored.
+struct pool;
+struct allocator;
+struct store;
+struct expr;
+struct poly_cache;
+
+// default memory budget of the result cache
+#define BATCH_CACHE_BUDGET ((size_t)64 << 20)
+
+struct batch {
+    HashTable *table;
+    // formulas shared by every let, and the lets not evaluated yet (name to
+    // root node)
+    struct expr *expr;
+    HashTable *lets;
+    // compressed polynomials, name to struct poly_packed
+    HashTable *packed;
+    // structure-of-arrays polynomials, name to struct poly_soa, and whether
+    // def, add, sub and mul store their results so (read from the session)
+    HashTable *soa;
+    bool soa_results;
+    // polynomials with modular coefficients, name to struct poly_mod
+    HashTable *mod;
+    // multivariate polynomials, name to struct mpoly
+    HashTable *multi;
+    struct poly_cache *cache;
+    struct pool *pool;
+    const struct allocator *prev_alloc;
+    // opened with the open command, closed by batch_free
+    struct store **stores;
+    int nstores;
+    FILE *out;
+    FILE *err; // diagnostics, stderr unless a view
+    // the batch views are made from, the batch itself otherwise
+    struct batch *session;
+    long line;
+    long errors;
+    // product kept by batch_prepare for the batch_exec that follows, the
+    // versions of its operands and what computing it cost (see cache_prepare)
+    struct polynomial prepared;
+    uint64_t prepared_versions[2];
+    double prepared_cost;
+    bool has_prepared;
+};
+
+// batch_init makes a fresh pool the current allocator of the calling thread
+// until batch_free
+void batch_init(struct batch *, FILE *out);
+void batch_free(struct batch *);
+
+// Execute a single command, line is modified in place. Returns 0 on success,
+// 1 on error and -1 on quit.
+int batch_exec(struct batch *, char *line);
+
+// A view of b for another client: it works on the polynomials of b but
+// writes its results and diagnostics to out and counts its own lines and
+// errors. Views need no freeing, they must not outlive b and their commands
+// must be serialized with those of b and every other view, except that
+// commands for which batch_read_only holds may run at the same time.
+void batch_view(struct batch *view, struct batch *b, FILE *out);
+// Whether executing line leaves every polynomial, table and cache of b as it
+// is (print, get and eval of an already resolved name, stats and the like)
+bool batch_read_only(struct batch *, const char *line);
+// The multiplication of a mul on polynomials that are already resolved, done
+// ahead of the batch_exec of the same line and allowed wherever
+// batch_read_only commands are. batch_exec then only defines the product, or
+// multiplies again if an operand has changed in between. Returns whether
+// line was such a mul.
+bool batch_prepare(struct batch *, const char *line);
+
+// Execute every command of in until end of file or quit, returns the number
+// of failed commands
+long batch_run(struct batch *, FILE *in);
+
+// Define every "NAME = POLY" line of a file (a leading def is allowed, blank
+// and '#' lines are skipped). Regular files are mapped and parsed in place,
+// anything else is streamed. Bad lines are reported with their line and
+// column and counted in errors. Returns the number of polynomials loaded, or
+// -1 if the file cannot be opened.
+long batch_load(struct batch *, const char *path);
+
+#endif
@@ -0,0 +1,584 @@
+// Micro benchmarks for the parser, the arithmetic, evaluation and the hash
+// table.
+//
+//   bench.out [--terms N] [--degree D | --density F] [--seed S]
+//             [--min-time SEC] [--threads T] [--json]
+//
+// Without --terms a sweep of sizes is measured. Every row reports the time
+// per operation, the throughput in terms per second and the allocations the
+// library made per operation (counted by wrapping malloc at link time).
+#include "alloc.h"
+#include "extmul.h"
+#include "hash_map.h"
+#include "modular.h"
+#include "mpoly.h"
+#include "packed.h"
+#include "polynomial.h"
+#include "soa.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// allocation counters, fed by the --wrap linker option of the bench target
+static uint64_t alloc_calls, alloc_bytes;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *__wrap_malloc(size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    alloc_calls++;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_realloc(p, size);
+}
+
+struct config {
+    int terms;
+    long long degree;
+    double density;
+    uint64_t seed;
+    double min_time;
+    bool json;
+};
+
+static uint64_t rng_state;
+
+// xorshift64*, reproducible for a given seed across platforms
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int int_comp(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// random polynomial with up to n distinct exponents in [0, degree] and small
+// non-zero integer coefficients
+static void random_polynomial(struct polynomial *p, int n, long long degree) {
+    int *exps = malloc(sizeof(int) * (n > 0 ? n : 1));
+    for (int i = 0; i < n; ++i)
+        exps[i] = (int)(rng() % (uint64_t)(degree + 1));
+    qsort(exps, n, sizeof(int), int_comp);
+    polynomial_init(p);
+    polynomial_reserve(p, n);
+    for (int i = 0; i < n; ++i) {
+        if (i > 0 && exps[i] == exps[i - 1])
+            continue;
+        int c = (int)(rng() % 18) - 9;
+        p->terms[p->size++] =
+            (struct term){.coeff = c >= 0 ? c + 1 : c, .exp = exps[i]};
+    }
+    free(exps);
+}
+
+struct result {
+    const char *op;
+    int terms;
+    double ns_per_op;
+    double terms_per_sec;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+static bool first_row = true;
+
+static void report(const struct config *cfg, const struct result *r) {
+    if (cfg->json) {
+        printf("%s\n  {\"op\": \"%s\", \"terms\": %d, \"ns_per_op\": %.2f, "
+               "\"terms_per_sec\": %.0f, \"allocs_per_op\": %.2f, "
+               "\"bytes_per_op\": %.0f}",
+               first_row ? "[" : ",", r->op, r->terms, r->ns_per_op,
+               r->terms_per_sec, r->allocs_per_op, r->bytes_per_op);
+    } else {
+        if (first_row)
+            printf("op,terms,ns_per_op,terms_per_sec,allocs_per_op,"
+                   "bytes_per_op\n");
+        printf("%s,%d,%.2f,%.0f,%.2f,%.0f\n", r->op, r->terms, r->ns_per_op,
+               r->terms_per_sec, r->allocs_per_op, r->bytes_per_op);
+    }
+    first_row = false;
+}
+
+// One benchmark case: run() performs `batch` operations touching `work`
+// terms each and returns nothing; it is repeated until min_time elapses.
+struct bench_case {
+    const char *op;
+    int terms;
+    long batch;
+    double work;
+    void (*run)(void *ctx, long batch);
+    void *ctx;
+};
+
+static void measure(const struct config *cfg, const struct bench_case *c) {
+    long rounds = 0;
+    uint64_t calls = alloc_calls, bytes = alloc_bytes;
+    double start = now(), elapsed;
+    do {
+        c->run(c->ctx, c->batch);
+        ++rounds;
+        elapsed = now() - start;
+    } while (elapsed < cfg->min_time);
+    double ops = (double)rounds * c->batch;
+    struct result r = {
+        .op = c->op,
+        .terms = c->terms,
+        .ns_per_op = elapsed * 1e9 / ops,
+        .terms_per_sec = c->work * ops / elapsed,
+        .allocs_per_op = (alloc_calls - calls) / ops,
+        .bytes_per_op = (alloc_bytes - bytes) / ops,
+    };
+    report(cfg, &r);
+}
+
+struct arith_ctx {
+    struct polynomial a, b;
+    char *text;
+    void (*fn)(struct polynomial *, const struct polynomial *,
+               const struct polynomial *);
+};
+
+static void run_parser(void *ctx, long batch) {
+    struct arith_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i)
+        polynomial_free(polynomial_parser(c->text));
+}
+
+static void run_arith(void *ctx, long batch) {
+    struct arith_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        struct polynomial r;
+        c->fn(&r, &c->a, &c->b);
+        polynomial_release(&r);
+    }
+}
+
+static void divide(struct polynomial *dest, const struct polynomial *a,
+                   const struct polynomial *b) {
+    polynomial_divmod(dest, NULL, a, b);
+}
+
+struct soa_ctx {
+    struct poly_soa a, b;
+    void (*fn)(struct poly_soa *, const struct poly_soa *,
+               const struct poly_soa *);
+};
+
+static void run_soa(void *ctx, long batch) {
+    struct soa_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        struct poly_soa r;
+        c->fn(&r, &c->a, &c->b);
+        soa_release(&r);
+    }
+}
+
+struct packed_ctx {
+    struct poly_packed a, b;
+    void (*fn)(struct poly_packed *, const struct poly_packed *,
+               const struct poly_packed *);
+};
+
+static void run_packed(void *ctx, long batch) {
+    struct packed_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        struct poly_packed r;
+        c->fn(&r, &c->a, &c->b);
+        packed_release(&r);
+    }
+}
+
+struct mod_ctx {
+    struct poly_mod a, b;
+};
+
+static void run_mod(void *ctx, long batch) {
+    struct mod_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        struct poly_mod r;
+        mod_mul(&r, &c->a, &c->b);
+        mod_release(&r);
+    }
+}
+
+struct multi_ctx {
+    struct mpoly a, b;
+};
+
+static void run_multi(void *ctx, long batch) {
+    struct multi_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        struct mpoly r;
+        mpoly_mul(&r, &c->a, &c->b);
+        mpoly_release(&r);
+    }
+}
+
+static int discard(void *ctx, const struct term *terms, size_t n) {
+    (void)ctx;
+    (void)terms;
+    (void)n;
+    return 0;
+}
+
+// the smallest budget, so that all but tiny products go through the disk
+static void run_extmul(void *ctx, long batch) {
+    struct arith_ctx *c = ctx;
+    struct extmul_config cfg = {.memory = EXTMUL_MIN_MEMORY};
+    for (long i = 0; i < batch; ++i)
+        extmul(&c->a, &c->b, &cfg, &(struct extmul_sink){discard, NULL});
+}
+
+static int mono_comp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// random polynomial in x, y and z with up to n distinct monomials, exponents
+// below side and small non-zero integer coefficients
+static void random_mpoly(struct mpoly *p, const struct mpoly_ring *r, int n,
+                         int side) {
+    uint64_t *monos = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+    for (int i = 0; i < n; ++i) {
+        int exps[3];
+        for (int v = 0; v < 3; ++v)
+            exps[v] = (int)(rng() % (uint64_t)side);
+        mpoly_pack(r, exps, &monos[i]);
+    }
+    qsort(monos, n, sizeof(uint64_t), mono_comp);
+    mpoly_init(p, r);
+    p->terms = allocator_resize(p->alloc, p->terms,
+                                sizeof(struct mpoly_term) * 16,
+                                sizeof(struct mpoly_term) * (n > 16 ? n : 16));
+    p->cap = n > 16 ? n : 16;
+    for (int i = 0; i < n; ++i) {
+        if (i > 0 && monos[i] == monos[i - 1])
+            continue;
+        int c = (int)(rng() % 18) - 9;
+        p->terms[p->size++] =
+            (struct mpoly_term){.coeff = c >= 0 ? c + 1 : c, .mono = monos[i]};
+    }
+    free(monos);
+}
+
+struct term_ctx {
+    struct polynomial p;
+    int *exps;
+    struct term *updates; // exps with a coefficient of 1
+    int count;
+    int next;
+};
+
+static void run_get_term(void *ctx, long batch) {
+    struct term_ctx *c = ctx;
+    volatile double sink = 0;
+    for (long i = 0; i < batch; ++i) {
+        sink += polynomial_get_term(&c->p, c->exps[c->next]);
+        c->next = (c->next + 1) % c->count;
+    }
+    (void)sink;
+}
+
+// insert an absent exponent and remove it again, so the size stays put
+static void run_add_remove_term(void *ctx, long batch) {
+    struct term_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        int exp = c->exps[c->next];
+        polynomial_add_term(&c->p, exp, 1.0);
+        polynomial_remove_term(&c->p, exp);
+        c->next = (c->next + 1) % c->count;
+    }
+}
+
+// the same absent exponents set and removed in bulk
+static void run_set_remove_terms(void *ctx, long batch) {
+    struct term_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i) {
+        polynomial_set_terms(&c->p, c->updates, c->count);
+        polynomial_remove_terms(&c->p, c->exps, c->count);
+    }
+}
+
+struct eval_ctx {
+    const struct polynomial *p;
+    double *xs, *ys;
+    size_t count;
+};
+
+static void run_eval(void *ctx, long batch) {
+    struct eval_ctx *c = ctx;
+    for (long i = 0; i < batch; ++i)
+        polynomial_eval_many(c->p, c->xs, c->ys, c->count);
+}
+
+struct table_ctx {
+    char **keys;
+    int count;
+    HashTable *table;
+};
+
+// batch is always the key count, the table is refilled from scratch
+static void run_table_emplace(void *ctx, long batch) {
+    struct table_ctx *c = ctx;
+    HashTable *t = table_create(NULL);
+    for (int i = 0; i < batch; ++i)
+        table_emplace(t, c->keys[i], &i, sizeof(i));
+    table_free(&t);
+}
+
+static void run_table_query(void *ctx, long batch) {
+    struct table_ctx *c = ctx;
+    volatile uintptr_t sink = 0;
+    for (long i = 0; i < batch; ++i)
+        sink += (uintptr_t)table_query(c->table, c->keys[i % c->count]);
+    (void)sink;
+}
+
+static void bench_size(const struct config *cfg, int n) {
+    long long degree = cfg->degree;
+    if (cfg->density > 0)
+        degree = (long long)(n / cfg->density);
+    if (degree < 1)
+        degree = 1;
+    rng_state = cfg->seed ? cfg->seed : 1;
+
+    struct arith_ctx arith;
+    random_polynomial(&arith.a, n, degree);
+    random_polynomial(&arith.b, n, degree);
+    size_t len;
+    FILE *fp = open_memstream(&arith.text, &len);
+    polynomial_print_fp(&arith.a, fp);
+    fclose(fp);
+
+    // scale the batch so every round takes roughly the same time
+    long linear = 1 + 100000 / (n + 1);
+    measure(cfg, &(struct bench_case){"parser", n, linear, n, run_parser,
+                                      &arith});
+    arith.fn = polynomial_add;
+    measure(cfg, &(struct bench_case){"add", n, linear, 2.0 * n, run_arith,
+                                      &arith});
+    arith.fn = polynomial_sub;
+    measure(cfg, &(struct bench_case){"sub", n, linear, 2.0 * n, run_arith,
+                                      &arith});
+    struct soa_ctx soa;
+    soa_from_terms(&soa.a, &arith.a);
+    soa_from_terms(&soa.b, &arith.b);
+    soa.fn = soa_add;
+    measure(cfg, &(struct bench_case){"soa_add", n, linear, 2.0 * n, run_soa,
+                                      &soa});
+    soa.fn = soa_sub;
+    measure(cfg, &(struct bench_case){"soa_sub", n, linear, 2.0 * n, run_soa,
+                                      &soa});
+    soa_release(&soa.a);
+    soa_release(&soa.b);
+    struct packed_ctx packed;
+    packed_from_terms(&packed.a, &arith.a);
+    packed_from_terms(&packed.b, &arith.b);
+    packed.fn = packed_add;
+    measure(cfg, &(struct bench_case){"packed_add", n, linear, 2.0 * n,
+                                      run_packed, &packed});
+    // a sparse product has n^2 terms, keep it to sizes that fit in memory
+    if ((double)n * n <= 5e7 ||
+        polynomial_mul_select(&arith.a, &arith.b) != POLY_MUL_HEAP) {
+        arith.fn = polynomial_mul;
+        measure(cfg, &(struct bench_case){"mul", n, 1, (double)n * n,
+                                          run_arith, &arith});
+        // Divide a product by b again. A random dense b makes the reciprocal
+        // of the fast path blow up and every size fall back to long division,
+        // so its leading coefficient is made to dominate the others.
+        struct arith_ctx div = {.fn = divide};
+        polynomial_copy(&div.b, &arith.b);
+        double lead = 1;
+        for (int i = 0; i + 1 < div.b.size; ++i)
+            lead += fabs(div.b.terms[i].coeff);
+        div.b.terms[div.b.size - 1].coeff = lead;
+        polynomial_mul(&div.a, &arith.a, &div.b);
+        measure(cfg, &(struct bench_case){"divmod", n, 1, (double)n * n,
+                                          run_arith, &div});
+        polynomial_release(&div.a);
+        polynomial_release(&div.b);
+        // exact products, by a transform modulo the prime itself and by
+        // three transforms joined by the Chinese remainder theorem
+        static const uint64_t primes[] = {998244353, (1ULL << 61) - 1};
+        static const char *names[] = {"mod_mul", "mod_mul_crt"};
+        for (int i = 0; i < 2; ++i) {
+            struct mod_field f;
+            struct mod_ctx mod;
+            mod_field_init(&f, primes[i]);
+            mod_from_terms(&mod.a, &f, &arith.a);
+            mod_from_terms(&mod.b, &f, &arith.b);
+            measure(cfg, &(struct bench_case){names[i], n, 1, (double)n * n,
+                                              run_mod, &mod});
+            mod_release(&mod.a);
+            mod_release(&mod.b);
+        }
+    }
+    if ((double)n * n <= 5e7) {
+        packed.fn = packed_mul;
+        measure(cfg, &(struct bench_case){"packed_mul", n, 1, (double)n * n,
+                                          run_packed, &packed});
+        // the same number of terms spread over a cube in three variables
+        struct mpoly_ring ring;
+        struct multi_ctx multi;
+        int side = (int)cbrt((double)degree) + 1;
+        mpoly_ring_init(&ring, "xyz");
+        random_mpoly(&multi.a, &ring, n, side);
+        random_mpoly(&multi.b, &ring, n, side);
+        measure(cfg, &(struct bench_case){"mpoly_mul", n, 1, (double)n * n,
+                                          run_multi, &multi});
+        mpoly_release(&multi.a);
+        mpoly_release(&multi.b);
+        measure(cfg, &(struct bench_case){"extmul", n, 1, (double)n * n,
+                                          run_extmul, &arith});
+    }
+    packed_release(&packed.a);
+    packed_release(&packed.b);
+
+    // points inside [-1, 1] keep the values finite at any degree
+    struct eval_ctx eval = {.p = &arith.a, .count = 4096};
+    eval.xs = malloc(sizeof(double) * eval.count);
+    eval.ys = malloc(sizeof(double) * eval.count);
+    for (size_t i = 0; i < eval.count; ++i)
+        eval.xs[i] = (double)(rng() % 2000001) / 1000000 - 1;
+    measure(cfg, &(struct bench_case){"eval", n, 1,
+                                      (double)n * eval.count, run_eval,
+                                      &eval});
+    free(eval.xs);
+    free(eval.ys);
+
+    struct term_ctx terms = {.count = 4096, .next = 0};
+    polynomial_copy(&terms.p, &arith.a);
+    terms.exps = malloc(sizeof(int) * terms.count);
+    for (int i = 0; i < terms.count; ++i) {
+        // look for an exponent the polynomial does not have yet
+        int exp = (int)(degree + 1 + i);
+        for (int tries = 0; tries < 8; ++tries) {
+            int e = (int)(rng() % (uint64_t)(degree + 1));
+            if (polynomial_get_term(&terms.p, e) == 0) {
+                exp = e;
+                break;
+            }
+        }
+        terms.exps[i] = exp;
+    }
+    measure(cfg, &(struct bench_case){"get_term", n, 1000, 1, run_get_term,
+                                      &terms});
+    measure(cfg, &(struct bench_case){"add_term+remove_term", n, 1000, 1,
+                                      run_add_remove_term, &terms});
+    // exponents repeat across the tries above, keep one of each
+    qsort(terms.exps, terms.count, sizeof(int), int_comp);
+    int distinct = 0;
+    for (int i = 0; i < terms.count; ++i)
+        if (distinct == 0 || terms.exps[distinct - 1] != terms.exps[i])
+            terms.exps[distinct++] = terms.exps[i];
+    terms.count = distinct;
+    terms.updates = malloc(sizeof(struct term) * terms.count);
+    for (int i = 0; i < terms.count; ++i)
+        terms.updates[i] = (struct term){.coeff = 1, .exp = terms.exps[i]};
+    measure(cfg, &(struct bench_case){"set_terms+remove_terms", n, 1,
+                                      terms.count, run_set_remove_terms,
+                                      &terms});
+    free(terms.updates);
+    free(terms.exps);
+    polynomial_release(&terms.p);
+
+    struct table_ctx table = {.count = n > 0 ? n : 1};
+    table.keys = malloc(sizeof(char *) * table.count);
+    for (int i = 0; i < table.count; ++i) {
+        table.keys[i] = malloc(24);
+        snprintf(table.keys[i], 24, "p%llx",
+                 (unsigned long long)(rng() & 0xffffffffffULL));
+    }
+    measure(cfg, &(struct bench_case){"table_emplace", n, table.count, 1,
+                                      run_table_emplace, &table});
+    table.table = table_create(NULL);
+    for (int i = 0; i < table.count; ++i)
+        table_emplace(table.table, table.keys[i], &i, sizeof(i));
+    measure(cfg, &(struct bench_case){"table_query", n, 10000, 1,
+                                      run_table_query, &table});
+    table_free(&table.table);
+    for (int i = 0; i < table.count; ++i)
+        free(table.keys[i]);
+    free(table.keys);
+
+    free(arith.text);
+    polynomial_release(&arith.a);
+    polynomial_release(&arith.b);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [--terms N] [--degree D | --density F] [--seed S] "
+            "[--min-time SEC] [--threads T] [--json]\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    struct config cfg = {.terms = 0,
+                         .degree = 0,
+                         .density = 0.5,
+                         .seed = 42,
+                         .min_time = 0.2,
+                         .json = false};
+    for (int i = 1; i < argc; ++i) {
+        bool has_arg = i + 1 < argc;
+        if (!strcmp(argv[i], "--terms") && has_arg)
+            cfg.terms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--degree") && has_arg) {
+            cfg.degree = atoll(argv[++i]);
+            cfg.density = 0;
+        } else if (!strcmp(argv[i], "--density") && has_arg)
+            cfg.density = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && has_arg)
+            cfg.seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--min-time") && has_arg)
+            cfg.min_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && has_arg)
+            polynomial_mul_set_threads(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--json"))
+            cfg.json = true;
+        else
+            usage(argv[0]);
+    }
+    if (cfg.density <= 0 && cfg.degree <= 0)
+        usage(argv[0]);
+
+    if (cfg.terms > 0) {
+        bench_size(&cfg, cfg.terms);
+    } else {
+        static const int sweep[] = {16, 256, 4096, 65536};
+        for (size_t i = 0; i < sizeof(sweep) / sizeof(sweep[0]); ++i)
+            bench_size(&cfg, sweep[i]);
+    }
+    if (cfg.json)
+        printf("\n]\n");
+    return 0;
+}
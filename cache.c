@@ -0,0 +1,204 @@
+#include "cache.h"
+#include "alloc.h"
+#include "hash_map.h"
+#include "polynomial.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// least recently used entries looked at for each eviction
+#define CACHE_EVICT_SAMPLE 8
+// a result is kept only if computing it took longer than this many
+// nanoseconds per term, roughly what copying it back out costs
+#define CACHE_MIN_NS_PER_TERM 4.0
+
+struct cache_entry {
+    struct polynomial value;
+    const char *key; // owned by the table
+    double cost;     // nanoseconds it took to compute
+    size_t bytes;
+    // LRU list, most recently used first
+    struct cache_entry *prev, *next;
+};
+
+struct poly_cache {
+    HashTable *table; // key to struct cache_entry
+    struct cache_entry *head, *tail;
+    size_t bytes, budget;
+    uint64_t hits, misses, evictions;
+};
+
+static void entry_free_adapter(void *e) {
+    polynomial_release(&((struct cache_entry *)e)->value);
+}
+
+static void entry_move_adapter(void *to, const void *from) {
+    polynomial_moved(&((struct cache_entry *)to)->value,
+                     &((const struct cache_entry *)from)->value);
+}
+
+struct poly_cache *cache_create(size_t budget) {
+    struct poly_cache *c = calloc(1, sizeof(struct poly_cache));
+    assert(c != NULL);
+    c->table = table_create(entry_free_adapter);
+    table_set_move_callback(c->table, entry_move_adapter);
+    c->budget = budget;
+    return c;
+}
+
+void cache_free(struct poly_cache *c) {
+    if (c == NULL)
+        return;
+    table_free(&c->table);
+    free(c);
+}
+
+static void unlink_entry(struct poly_cache *c, struct cache_entry *e) {
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        c->head = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        c->tail = e->prev;
+}
+
+static void push_front(struct poly_cache *c, struct cache_entry *e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head != NULL)
+        c->head->prev = e;
+    c->head = e;
+    if (c->tail == NULL)
+        c->tail = e;
+}
+
+// drop the entry that buys the least time per byte among the least recently
+// used ones
+static void evict_one(struct poly_cache *c) {
+    struct cache_entry *victim = c->tail;
+    struct cache_entry *e = c->tail;
+    // the most recent entry is never a candidate, it may be the one that
+    // was just added
+    for (int i = 0; i < CACHE_EVICT_SAMPLE && e != c->head; ++i, e = e->prev)
+        if (e->cost * victim->bytes < victim->cost * e->bytes)
+            victim = e;
+    unlink_entry(c, victim);
+    c->bytes -= victim->bytes;
+    c->evictions++;
+    table_erase(c->table, victim->key);
+}
+
+static void shrink_to(struct poly_cache *c, size_t budget) {
+    while (c->bytes > budget && c->tail != NULL)
+        evict_one(c);
+}
+
+void cache_set_budget(struct poly_cache *c, size_t budget) {
+    c->budget = budget;
+    shrink_to(c, budget);
+}
+
+static double now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void compute(enum cache_op op, struct polynomial *dest,
+                    const struct polynomial *a, const struct polynomial *b) {
+    switch (op) {
+    case CACHE_ADD:
+        polynomial_add(dest, a, b);
+        break;
+    case CACHE_SUB:
+        polynomial_sub(dest, a, b);
+        break;
+    case CACHE_MUL:
+        polynomial_mul(dest, a, b);
+        break;
+    }
+}
+
+// the key of a op b, which does not depend on the order of the operands for
+// a + b and a * b
+static void make_key(char key[48], enum cache_op op, const struct polynomial *a,
+                     const struct polynomial *b) {
+    uint64_t va = a->version, vb = b->version;
+    if (op != CACHE_SUB && va > vb) {
+        uint64_t t = va;
+        va = vb;
+        vb = t;
+    }
+    snprintf(key, 48, "%d:%" PRIx64 ":%" PRIx64, (int)op, va, vb);
+}
+
+static void insert(struct poly_cache *c, const char *key,
+                   const struct polynomial *value, double cost) {
+    c->misses++;
+    size_t bytes = sizeof(struct term) * value->size;
+    if (c->budget == 0 || bytes > c->budget ||
+        cost < CACHE_MIN_NS_PER_TERM * value->size)
+        return;
+    struct cache_entry e = {.cost = cost, .bytes = bytes};
+    polynomial_copy(&e.value, value);
+    table_emplace(c->table, key, &e, sizeof(e));
+    Item *itm = table_query(c->table, key);
+    struct cache_entry *entry = itm->data;
+    entry->key = itm->key;
+    push_front(c, entry);
+    c->bytes += bytes;
+    shrink_to(c, c->budget);
+}
+
+void cache_binary(struct poly_cache *c, enum cache_op op,
+                  struct polynomial *dest, const struct polynomial *a,
+                  const struct polynomial *b) {
+    char key[48];
+    make_key(key, op, a, b);
+    Item *itm = table_query(c->table, key);
+    if (itm != NULL) {
+        struct cache_entry *e = itm->data;
+        unlink_entry(c, e);
+        push_front(c, e);
+        c->hits++;
+        polynomial_copy(dest, &e->value);
+        return;
+    }
+    double start = now_ns();
+    compute(op, dest, a, b);
+    insert(c, key, dest, now_ns() - start);
+}
+
+double cache_prepare(const struct poly_cache *c, enum cache_op op,
+                     struct polynomial *dest, const struct polynomial *a,
+                     const struct polynomial *b) {
+    char key[48];
+    make_key(key, op, a, b);
+    if (table_query(c->table, key) != NULL)
+        return -1;
+    double start = now_ns();
+    compute(op, dest, a, b);
+    return now_ns() - start;
+}
+
+void cache_commit(struct poly_cache *c, enum cache_op op,
+                  const struct polynomial *value, const struct polynomial *a,
+                  const struct polynomial *b, double cost) {
+    char key[48];
+    make_key(key, op, a, b);
+    insert(c, key, value, cost);
+}
+
+void cache_stats(const struct poly_cache *c, struct cache_stats *s) {
+    *s = (struct cache_stats){.hits = c->hits,
+                              .misses = c->misses,
+                              .evictions = c->evictions,
+                              .entries = c->table->size,
+                              .bytes = c->bytes,
+                              .budget = c->budget};
+}
@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memoized binary operations. Results are keyed by the operation and the
+// versions of both operands, so changing an operand (which stamps it with a
+// new version) makes its old results unreachable without any bookkeeping;
+// they age out like every other entry.
+//
+// The cache holds at most budget bytes of terms. When it is over budget, the
+// least recently used entries are the candidates for eviction and the one
+// that was cheapest to compute for its size goes first. Results that were
+// about as cheap to compute as to copy are not kept at all.
+struct polynomial;
+struct poly_cache;
+
+enum cache_op { CACHE_ADD, CACHE_SUB, CACHE_MUL };
+
+struct cache_stats {
+    uint64_t hits, misses;
+    uint64_t evictions;
+    size_t entries, bytes, budget;
+};
+
+// The cache and its entries use the current allocator
+struct poly_cache *cache_create(size_t budget);
+void cache_free(struct poly_cache *);
+// evict entries until at most budget bytes are held, 0 disables the cache
+void cache_set_budget(struct poly_cache *, size_t budget);
+
+// dest = a op b, copied from the cache when possible. dest gets initialized.
+void cache_binary(struct poly_cache *, enum cache_op, struct polynomial *dest,
+                  const struct polynomial *a, const struct polynomial *b);
+
+// cache_binary in two steps, for callers that may only read the cache while
+// they compute. cache_prepare computes dest = a op b and returns what it cost,
+// or returns -1 and leaves dest alone if the cache holds the result (which
+// cache_binary then copies); it does not change the cache. cache_commit
+// offers a result of cache_prepare to the cache, the operands must not have
+// changed in between.
+double cache_prepare(const struct poly_cache *, enum cache_op,
+                     struct polynomial *dest, const struct polynomial *a,
+                     const struct polynomial *b);
+void cache_commit(struct poly_cache *, enum cache_op,
+                  const struct polynomial *value, const struct polynomial *a,
+                  const struct polynomial *b, double cost);
+
+void cache_stats(const struct poly_cache *, struct cache_stats *);
+
+#endif
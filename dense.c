@@ -0,0 +1,350 @@
+#include "dense.h"
+#include "alloc.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// coefficients are treated as integers only while they are exactly
+// representable together with their products' partial sums
+#define EXACT_LIMIT 4503599627370496.0 // 2^52
+
+// below these lengths recursion costs more than the quadratic loop
+#define KARATSUBA_CUTOFF 32
+#define TOOM3_CUTOFF 150
+
+void dense_mul_schoolbook(double *r, const double *a, int na, const double *b,
+                          int nb) {
+    memset(r, 0, sizeof(double) * (na + nb - 1));
+    for (int i = 0; i < na; ++i) {
+        if (a[i] == 0)
+            continue;
+        for (int j = 0; j < nb; ++j)
+            r[i + j] += a[i] * b[j];
+    }
+}
+
+// r[0..2n-1) = a * b for two operands of length n, scratch holds 4n + 64
+static void karatsuba(double *r, const double *a, const double *b, int n,
+                      double *scratch) {
+    if (n < KARATSUBA_CUTOFF) {
+        dense_mul_schoolbook(r, a, n, b, n);
+        return;
+    }
+    int m = (n + 1) / 2, h = n - m;
+    double *sa = scratch, *sb = sa + m, *z1 = sb + m, *rest = z1 + 2 * m;
+    // z0 = a0 * b0 goes to r[0..2m-1), z2 = a1 * b1 to r[2m..2n-1)
+    karatsuba(r, a, b, m, rest);
+    r[2 * m - 1] = 0;
+    if (h == m) {
+        karatsuba(r + 2 * m, a + m, b + m, h, rest);
+    } else {
+        // the upper half is one shorter, pad it with a zero
+        memcpy(sa, a + m, sizeof(double) * h);
+        memcpy(sb, b + m, sizeof(double) * h);
+        sa[h] = sb[h] = 0;
+        karatsuba(z1, sa, sb, m, rest);
+        memcpy(r + 2 * m, z1, sizeof(double) * (2 * h - 1));
+    }
+    for (int i = 0; i < m; ++i) {
+        sa[i] = a[i] + (i < h ? a[m + i] : 0);
+        sb[i] = b[i] + (i < h ? b[m + i] : 0);
+    }
+    karatsuba(z1, sa, sb, m, rest);
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    for (int i = 0; i < 2 * m - 1; ++i)
+        z1[i] -= r[i];
+    for (int i = 0; i < 2 * h - 1; ++i)
+        z1[i] -= r[2 * m + i];
+    for (int i = 0; i < 2 * m - 1; ++i)
+        r[m + i] += z1[i];
+}
+
+static void toom3(double *r, const double *a, const double *b, int n,
+                  double *scratch) {
+    if (n < TOOM3_CUTOFF) {
+        karatsuba(r, a, b, n, scratch);
+        return;
+    }
+    int k = (n + 2) / 3, last = n - 2 * k, len = 2 * k - 1;
+    // evaluations at 0, 1, -1, -2 and infinity, followed by their products
+    struct arena *arena = arena_scratch();
+    struct arena_mark mark = arena_mark(arena);
+    size_t buf_len = 8 * (size_t)k + 5 * (size_t)len;
+    double *buf = arena_alloc(arena, sizeof(double) * buf_len);
+    memset(buf, 0, sizeof(double) * buf_len);
+    double *a1 = buf, *am1 = a1 + k, *am2 = am1 + k, *a2 = am2 + k;
+    double *b1 = a2 + k, *bm1 = b1 + k, *bm2 = bm1 + k, *b2 = bm2 + k;
+    double *r0 = b2 + k, *r1 = r0 + len, *rm1 = r1 + len, *rm2 = rm1 + len,
+           *rinf = rm2 + len;
+    memcpy(a2, a + 2 * k, sizeof(double) * last);
+    memcpy(b2, b + 2 * k, sizeof(double) * last);
+    for (int i = 0; i < k; ++i) {
+        double t = a[i] + a2[i];
+        a1[i] = t + a[k + i];
+        am1[i] = t - a[k + i];
+        am2[i] = (am1[i] + a2[i]) * 2 - a[i];
+        t = b[i] + b2[i];
+        b1[i] = t + b[k + i];
+        bm1[i] = t - b[k + i];
+        bm2[i] = (bm1[i] + b2[i]) * 2 - b[i];
+    }
+    toom3(r0, a, b, k, scratch);
+    toom3(r1, a1, b1, k, scratch);
+    toom3(rm1, am1, bm1, k, scratch);
+    toom3(rm2, am2, bm2, k, scratch);
+    toom3(rinf, a2, b2, k, scratch);
+    // Bodrato's interpolation sequence, reusing the product buffers
+    for (int i = 0; i < len; ++i) {
+        double c3 = (rm2[i] - r1[i]) / 3;
+        double c1 = (r1[i] - rm1[i]) / 2;
+        double c2 = rm1[i] - r0[i];
+        c3 = (c2 - c3) / 2 + 2 * rinf[i];
+        c2 = c2 + c1 - rinf[i];
+        c1 = c1 - c3;
+        r1[i] = c1;
+        rm1[i] = c2;
+        rm2[i] = c3;
+    }
+    // the top parts are shorter than k, whatever lands past 2n - 1 is zero
+    memset(r, 0, sizeof(double) * (2 * n - 1));
+    for (int i = 0; i < len; ++i) {
+        r[i] += r0[i];
+        r[k + i] += r1[i];
+        r[2 * k + i] += rm1[i];
+        if (3 * k + i < 2 * n - 1)
+            r[3 * k + i] += rm2[i];
+        if (4 * k + i < 2 * n - 1)
+            r[4 * k + i] += rinf[i];
+    }
+    arena_rewind(arena, mark);
+}
+
+// Drive an equal-length kernel over operands of any length: the longer one is
+// cut into slices as long as the shorter one and the slice products summed.
+static void mul_sliced(double *r, const double *a, int na, const double *b,
+                       int nb,
+                       void (*kernel)(double *, const double *,
+                                      const double *, int, double *)) {
+    if (na < nb) {
+        const double *t = a;
+        a = b;
+        b = t;
+        int tn = na;
+        na = nb;
+        nb = tn;
+    }
+    struct arena *arena = arena_scratch();
+    struct arena_mark mark = arena_mark(arena);
+    double *buf = arena_alloc(arena, sizeof(double) * (7 * (size_t)nb + 64));
+    double *slice = buf, *prod = slice + nb, *scratch = prod + 2 * nb;
+    memset(r, 0, sizeof(double) * (na + nb - 1));
+    for (int off = 0; off < na; off += nb) {
+        int len = na - off < nb ? na - off : nb;
+        if (len == nb) {
+            memcpy(slice, a + off, sizeof(double) * len);
+            kernel(prod, slice, b, nb, scratch);
+        } else {
+            // a short tail slices b in turn instead of being zero padded
+            mul_sliced(prod, a + off, len, b, nb, kernel);
+        }
+        int count = len + nb - 1;
+        for (int i = 0; i < count; ++i)
+            r[off + i] += prod[i];
+    }
+    arena_rewind(arena, mark);
+}
+
+void dense_mul_karatsuba(double *r, const double *a, int na, const double *b,
+                         int nb) {
+    mul_sliced(r, a, na, b, nb, karatsuba);
+}
+
+void dense_mul_toom3(double *r, const double *a, int na, const double *b,
+                     int nb) {
+    mul_sliced(r, a, na, b, nb, toom3);
+}
+
+static int ceil_log2(int n) {
+    int k = 0;
+    while ((1 << k) < n)
+        ++k;
+    return k;
+}
+
+// in-place iterative radix-2 transform, tw holds exp(-2*pi*i*k/n) for k < n/2
+static void fft(double *re, double *im, int n, const double *tw_re,
+                const double *tw_im, bool inverse) {
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len >> 1, step = n / len;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; ++k) {
+                double wr = tw_re[k * step];
+                double wi = inverse ? -tw_im[k * step] : tw_im[k * step];
+                double *ur = &re[i + k], *ui = &im[i + k];
+                double *vr = &re[i + k + half], *vi = &im[i + k + half];
+                double xr = *vr * wr - *vi * wi;
+                double xi = *vr * wi + *vi * wr;
+                *vr = *ur - xr;
+                *vi = *ui - xi;
+                *ur += xr;
+                *ui += xi;
+            }
+        }
+    }
+}
+
+static double norm2(const double *a, int n) {
+    double s = 0;
+    for (int i = 0; i < n; ++i)
+        s += a[i] * a[i];
+    return sqrt(s);
+}
+
+// plain convolution: a goes in the real part and b in the imaginary part, a
+// single forward transform yields both spectra
+static void fft_convolve(double *r, const double *a, int na, const double *b,
+                         int nb) {
+    int nr = na + nb - 1;
+    int n = 1 << ceil_log2(nr);
+    struct arena *arena = arena_scratch();
+    struct arena_mark mark = arena_mark(arena);
+    double *buf = arena_alloc(arena, sizeof(double) * 5 * (size_t)n);
+    memset(buf, 0, sizeof(double) * 4 * (size_t)n);
+    double *re = buf, *im = buf + n, *pr = buf + 2 * n, *pi = buf + 3 * n;
+    double *tw_re = buf + 4 * n, *tw_im = tw_re + n / 2;
+    // twiddles are computed directly rather than by recurrence, which keeps
+    // their error at one ulp and the error bound below valid
+    for (int k = 0; k < n / 2; ++k) {
+        double angle = -2 * M_PI * k / n;
+        tw_re[k] = cos(angle);
+        tw_im[k] = sin(angle);
+    }
+    // Both spectra are separated out of one transform, so each carries the
+    // rounding error of the larger operand. b is scaled by a power of two to
+    // the size of a, or the product with the smaller one is lost in it.
+    int ea = 0, eb = 0;
+    frexp(norm2(a, na), &ea);
+    frexp(norm2(b, nb), &eb);
+    int shift = ea - eb;
+    memcpy(re, a, sizeof(double) * na);
+    for (int i = 0; i < nb; ++i)
+        im[i] = ldexp(b[i], shift);
+    fft(re, im, n, tw_re, tw_im, false);
+    for (int k = 0; k < n; ++k) {
+        int m = (n - k) & (n - 1);
+        // A = (Z[k] + conj(Z[m])) / 2, B = (Z[k] - conj(Z[m])) / 2i
+        double ar = (re[k] + re[m]) / 2, ai = (im[k] - im[m]) / 2;
+        double br = (im[k] + im[m]) / 2, bi = (re[m] - re[k]) / 2;
+        pr[k] = ar * br - ai * bi;
+        pi[k] = ar * bi + ai * br;
+    }
+    fft(pr, pi, n, tw_re, tw_im, true);
+    for (int i = 0; i < nr; ++i)
+        r[i] = ldexp(pr[i] / n, -shift);
+    arena_rewind(arena, mark);
+}
+
+// largest magnitude, or -1 if some coefficient is not a small integer
+static double integer_max(const double *a, int n) {
+    double m = 0;
+    for (int i = 0; i < n; ++i) {
+        double v = fabs(a[i]);
+        if (v != floor(v) || v >= EXACT_LIMIT)
+            return -1;
+        if (v > m)
+            m = v;
+    }
+    return m;
+}
+
+// Percival's bound on the max-norm error of a radix-2 convolution of length
+// 2^k with accurate twiddles: |a|_2 |b|_2 eps (3k + (3k + 1) sqrt(5) + 3k)
+static double fft_error_bound(const double *a, int na, const double *b,
+                              int nb) {
+    int k = ceil_log2(na + nb - 1);
+    return norm2(a, na) * norm2(b, nb) * DBL_EPSILON *
+           ((6 + 3 * sqrt(5)) * k + sqrt(5));
+}
+
+// split v = hi * 2^s + lo with |lo| < 2^s
+static void split(const double *v, int n, int s, double *hi, double *lo) {
+    double scale = ldexp(1, s);
+    for (int i = 0; i < n; ++i) {
+        hi[i] = trunc(v[i] / scale);
+        lo[i] = v[i] - hi[i] * scale;
+    }
+}
+
+static void dense_mul_exact(double *r, const double *a, int na,
+                            const double *b, int nb, double amax,
+                            double bmax) {
+    int nr = na + nb - 1;
+    if (fft_error_bound(a, na, b, nb) < 0.5 || (amax <= 1 && bmax <= 1)) {
+        fft_convolve(r, a, na, b, nb);
+        for (int i = 0; i < nr; ++i)
+            r[i] = nearbyint(r[i]);
+        return;
+    }
+    // split the wider operand in half, so the product terms narrow down until
+    // every partial convolution rounds exactly
+    if (amax < bmax) {
+        const double *t = a;
+        a = b;
+        b = t;
+        int tn = na;
+        na = nb;
+        nb = tn;
+        double tm = amax;
+        amax = bmax;
+        bmax = tm;
+    }
+    int s = (ilogb(amax) + 2) / 2;
+    struct arena *arena = arena_scratch();
+    struct arena_mark mark = arena_mark(arena);
+    double *hi = arena_alloc(arena, sizeof(double) * (2 * (size_t)na + nr));
+    double *lo = hi + na, *tmp = lo + na;
+    split(a, na, s, hi, lo);
+    double scale = ldexp(1, s);
+    dense_mul_exact(r, hi, na, b, nb, ldexp(amax, -s), bmax);
+    dense_mul_exact(tmp, lo, na, b, nb, scale - 1, bmax);
+    for (int i = 0; i < nr; ++i)
+        r[i] = r[i] * scale + tmp[i];
+    arena_rewind(arena, mark);
+}
+
+void dense_mul_fft(double *r, const double *a, int na, const double *b,
+                   int nb) {
+    double amax = integer_max(a, na), bmax = integer_max(b, nb);
+    if (amax >= 0 && bmax >= 0) {
+        dense_mul_exact(r, a, na, b, nb, amax, bmax);
+        return;
+    }
+    fft_convolve(r, a, na, b, nb);
+    // anything under the error bound is indistinguishable from a term that
+    // cancelled out, drop it instead of printing transform noise
+    double bound = fft_error_bound(a, na, b, nb);
+    for (int i = 0; i < na + nb - 1; ++i)
+        if (fabs(r[i]) <= bound)
+            r[i] = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef DENSE_H
+#define DENSE_H
+
+// Kernels on dense coefficient buffers, where a[i] is the coefficient of x^i.
+// The product buffer r must hold na + nb - 1 coefficients.
+
+// Quadratic reference product, used below the recursion cutoffs.
+void dense_mul_schoolbook(double *r, const double *a, int na, const double *b,
+                          int nb);
+
+// Divide-and-conquer products. Operands of different lengths are cut into
+// slices of the shorter length; results are exact for integer inputs as long
+// as they stay below 2^53.
+void dense_mul_karatsuba(double *r, const double *a, int na, const double *b,
+                         int nb);
+void dense_mul_toom3(double *r, const double *a, int na, const double *b,
+                     int nb);
+
+// Multiply through a floating-point FFT. Integer-valued inputs are split into
+// narrower halves until the error bound of the transform guarantees an exact
+// rounding, other inputs have results below the error bound flushed to zero.
+void dense_mul_fft(double *r, const double *a, int na, const double *b,
+                   int nb);
+
+#endif
@@ -0,0 +1,216 @@
+#include "polynomial.h"
+
+#include <pthread.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define EVAL_X86 1
+#endif
+
+// Every kernel runs Horner's scheme from the highest term down, multiplying
+// by x^gap between consecutive exponents. For a dense polynomial every gap is
+// 1 and this is plain Horner; a sparse one powers x by each gap, and since the
+// gap of a regular pattern repeats, the last power is reused until it changes.
+// What is left at the end is the lowest exponent, applied once.
+
+// x^g for g >= 1 by binary powering, left to right
+static inline double pow_gap(double x, unsigned g) {
+    double r = x;
+    for (int bit = 30 - __builtin_clz(g); bit >= 0; --bit) {
+        r *= r;
+        if (g >> bit & 1)
+            r *= x;
+    }
+    return r;
+}
+
+// scale by x^exp, exp may be negative
+static inline double scale_low(double acc, double x, int exp) {
+    if (exp > 0)
+        return acc * pow_gap(x, exp);
+    if (exp < 0)
+        return acc / pow_gap(x, -(unsigned)exp);
+    return acc;
+}
+
+static inline unsigned gap(const struct term *t, int i) {
+    return (unsigned)t[i].exp - (unsigned)t[i - 1].exp;
+}
+
+// four points at a time so the dependency chains of Horner overlap
+static void eval_scalar(const struct term *t, int n, const double *xs,
+                        double *ys, size_t m) {
+    size_t j = 0;
+    for (; j + 4 <= m; j += 4) {
+        double x[4], xg[4], acc[4];
+        for (int k = 0; k < 4; ++k) {
+            x[k] = xg[k] = xs[j + k];
+            acc[k] = t[n - 1].coeff;
+        }
+        unsigned prev = 1;
+        for (int i = n - 1; i > 0; --i) {
+            unsigned g = gap(t, i);
+            if (g != prev) {
+                for (int k = 0; k < 4; ++k)
+                    xg[k] = pow_gap(x[k], g);
+                prev = g;
+            }
+            for (int k = 0; k < 4; ++k)
+                acc[k] = acc[k] * xg[k] + t[i - 1].coeff;
+        }
+        for (int k = 0; k < 4; ++k)
+            ys[j + k] = scale_low(acc[k], x[k], t[0].exp);
+    }
+    for (; j < m; ++j) {
+        double x = xs[j], xg = x, acc = t[n - 1].coeff;
+        unsigned prev = 1;
+        for (int i = n - 1; i > 0; --i) {
+            unsigned g = gap(t, i);
+            if (g != prev) {
+                xg = pow_gap(x, g);
+                prev = g;
+            }
+            acc = acc * xg + t[i - 1].coeff;
+        }
+        ys[j] = scale_low(acc, x, t[0].exp);
+    }
+}
+
+#ifdef EVAL_X86
+
+// four vectors of points per pass, enough to cover the latency of the FMA
+
+__attribute__((target("avx2,fma"))) static inline __m256d
+pow_gap_avx2(__m256d x, unsigned g) {
+    __m256d r = x;
+    for (int bit = 30 - __builtin_clz(g); bit >= 0; --bit) {
+        r = _mm256_mul_pd(r, r);
+        if (g >> bit & 1)
+            r = _mm256_mul_pd(r, x);
+    }
+    return r;
+}
+
+__attribute__((target("avx2,fma"))) static void
+eval_avx2(const struct term *t, int n, const double *xs, double *ys,
+          size_t m) {
+    size_t j = 0;
+    for (; j + 16 <= m; j += 16) {
+        __m256d x[4], xg[4], acc[4];
+        for (int k = 0; k < 4; ++k) {
+            x[k] = xg[k] = _mm256_loadu_pd(xs + j + 4 * k);
+            acc[k] = _mm256_set1_pd(t[n - 1].coeff);
+        }
+        unsigned prev = 1;
+        for (int i = n - 1; i > 0; --i) {
+            unsigned g = gap(t, i);
+            if (g != prev) {
+                for (int k = 0; k < 4; ++k)
+                    xg[k] = pow_gap_avx2(x[k], g);
+                prev = g;
+            }
+            __m256d c = _mm256_set1_pd(t[i - 1].coeff);
+            for (int k = 0; k < 4; ++k)
+                acc[k] = _mm256_fmadd_pd(acc[k], xg[k], c);
+        }
+        int low = t[0].exp;
+        for (int k = 0; k < 4; ++k) {
+            if (low > 0)
+                acc[k] = _mm256_mul_pd(acc[k], pow_gap_avx2(x[k], low));
+            else if (low < 0)
+                acc[k] =
+                    _mm256_div_pd(acc[k], pow_gap_avx2(x[k], -(unsigned)low));
+            _mm256_storeu_pd(ys + j + 4 * k, acc[k]);
+        }
+    }
+    eval_scalar(t, n, xs + j, ys + j, m - j);
+}
+
+__attribute__((target("avx512f"))) static inline __m512d
+pow_gap_avx512(__m512d x, unsigned g) {
+    __m512d r = x;
+    for (int bit = 30 - __builtin_clz(g); bit >= 0; --bit) {
+        r = _mm512_mul_pd(r, r);
+        if (g >> bit & 1)
+            r = _mm512_mul_pd(r, x);
+    }
+    return r;
+}
+
+__attribute__((target("avx512f"))) static void
+eval_avx512(const struct term *t, int n, const double *xs, double *ys,
+            size_t m) {
+    size_t j = 0;
+    for (; j + 32 <= m; j += 32) {
+        __m512d x[4], xg[4], acc[4];
+        for (int k = 0; k < 4; ++k) {
+            x[k] = xg[k] = _mm512_loadu_pd(xs + j + 8 * k);
+            acc[k] = _mm512_set1_pd(t[n - 1].coeff);
+        }
+        unsigned prev = 1;
+        for (int i = n - 1; i > 0; --i) {
+            unsigned g = gap(t, i);
+            if (g != prev) {
+                for (int k = 0; k < 4; ++k)
+                    xg[k] = pow_gap_avx512(x[k], g);
+                prev = g;
+            }
+            __m512d c = _mm512_set1_pd(t[i - 1].coeff);
+            for (int k = 0; k < 4; ++k)
+                acc[k] = _mm512_fmadd_pd(acc[k], xg[k], c);
+        }
+        int low = t[0].exp;
+        for (int k = 0; k < 4; ++k) {
+            if (low > 0)
+                acc[k] = _mm512_mul_pd(acc[k], pow_gap_avx512(x[k], low));
+            else if (low < 0)
+                acc[k] = _mm512_div_pd(acc[k],
+                                       pow_gap_avx512(x[k], -(unsigned)low));
+            _mm512_storeu_pd(ys + j + 8 * k, acc[k]);
+        }
+    }
+    // the remaining points still fill whole AVX2 vectors
+    eval_avx2(t, n, xs + j, ys + j, m - j);
+}
+
+#endif
+
+typedef void (*eval_kernel)(const struct term *, int, const double *,
+                            double *, size_t);
+
+// the kernel for the running CPU, picked once by select_kernel
+static eval_kernel kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernel(void) {
+    eval_kernel k = eval_scalar;
+#ifdef EVAL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        k = eval_avx2;
+    if (k == eval_avx2 && __builtin_cpu_supports("avx512f"))
+        k = eval_avx512;
+#endif
+    kernel = k;
+}
+
+double polynomial_eval(const struct polynomial *p, double x) {
+    if (p->size == 0)
+        return 0;
+    double y;
+    eval_scalar(p->terms, p->size, &x, &y, 1);
+    return y;
+}
+
+void polynomial_eval_many(const struct polynomial *p, const double *xs,
+                          double *ys, size_t n) {
+    if (p->size == 0) {
+        for (size_t j = 0; j < n; ++j)
+            ys[j] = 0;
+        return;
+    }
+    // callers may be on several threads at once
+    pthread_once(&kernel_once, select_kernel);
+    kernel(p->terms, p->size, xs, ys, n);
+}
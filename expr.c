@@ -0,0 +1,471 @@
+#include "expr.h"
+#include "alloc.h"
+#include "hash_map.h"
+#include "polynomial.h"
+#include "setup.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum expr_op { EXPR_NAME, EXPR_CONST, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_NEG };
+
+struct expr_node {
+    enum expr_op op;
+    int l, r;         // children, -1 when absent
+    double value;     // EXPR_CONST
+    const char *name; // EXPR_NAME, owned by the intern table
+};
+
+// expr_collect is due once the DAG holds this many nodes more than twice
+// what the last collection kept
+#define EXPR_COLLECT_MIN 256
+
+struct expr {
+    struct expr_node *nodes;
+    int size, cap;
+    // structural key of every node to its id
+    HashTable *intern;
+    // nodes kept by the last expr_collect
+    int live;
+    // Position of every node in the innermost evaluation running (a name may
+    // resolve to a let evaluated from within another one), so an evaluation
+    // touches only the nodes under its root and never the whole DAG. seen
+    // marks the nodes a walk over the DAG has reached with its pass number.
+    int *slot;
+    uint64_t *seen, pass;
+};
+
+struct expr *expr_create(void) {
+    struct expr *e = calloc(1, sizeof(struct expr));
+    assert(e != NULL);
+    e->intern = table_create(NULL);
+    return e;
+}
+
+void expr_free(struct expr *e) {
+    if (e == NULL)
+        return;
+    table_free(&e->intern);
+    free(e->nodes);
+    free(e->slot);
+    free(e->seen);
+    free(e);
+}
+
+// id of the node with this key, which is created from n if it is new
+static int intern(struct expr *e, const char *key, struct expr_node n) {
+    Item *itm = table_query(e->intern, key);
+    if (itm != NULL)
+        return *(int *)itm->data;
+    if (e->size >= e->cap) {
+        e->cap = e->cap < 8 ? 16 : e->cap * 2;
+        e->nodes = realloc(e->nodes, sizeof(struct expr_node) * e->cap);
+        e->slot = realloc(e->slot, sizeof(int) * e->cap);
+        e->seen = realloc(e->seen, sizeof(uint64_t) * e->cap);
+        assert(e->nodes != NULL && e->slot != NULL && e->seen != NULL);
+    }
+    int id = e->size++;
+    e->slot[id] = -1;
+    e->seen[id] = 0;
+    table_emplace(e->intern, key, &id, sizeof(id));
+    if (n.op == EXPR_NAME)
+        n.name = table_query(e->intern, key)->key + 2;
+    e->nodes[id] = n;
+    return id;
+}
+
+static int node_op(struct expr *e, enum expr_op op, int l, int r) {
+    // operands of commutative operators in a fixed order, so a + b and b + a
+    // are the same node
+    if ((op == EXPR_ADD || op == EXPR_MUL) && l > r) {
+        int t = l;
+        l = r;
+        r = t;
+    }
+    char key[32];
+    snprintf(key, sizeof(key), "%d:%d,%d", (int)op, l, r);
+    return intern(e, key, (struct expr_node){.op = op, .l = l, .r = r});
+}
+
+static int node_name(struct expr *e, const char *name, size_t len) {
+    char key[STRING_MAX_LEN + 2];
+    snprintf(key, sizeof(key), "n:%.*s", (int)len, name);
+    return intern(e, key,
+                  (struct expr_node){.op = EXPR_NAME, .l = -1, .r = -1});
+}
+
+static int node_const(struct expr *e, double value) {
+    char key[40];
+    snprintf(key, sizeof(key), "c:%a", value);
+    return intern(e, key, (struct expr_node){.op = EXPR_CONST,
+                                             .l = -1,
+                                             .r = -1,
+                                             .value = value});
+}
+
+// ---- parser ----
+
+struct parser {
+    struct expr *e;
+    const char *str, *it;
+};
+
+static void skip_space(struct parser *p) {
+    for (; isspace((unsigned char)*p->it); ++p->it)
+        ;
+}
+
+static int parse_sum(struct parser *p);
+
+static int parse_primary(struct parser *p) {
+    skip_space(p);
+    const char *it = p->it;
+    if (*it == '(') {
+        ++p->it;
+        int id = parse_sum(p);
+        if (id < 0)
+            return -1;
+        skip_space(p);
+        if (*p->it != ')')
+            return -1;
+        ++p->it;
+        return id;
+    }
+    if (isalpha((unsigned char)*it) || *it == '_') {
+        for (; isalnum((unsigned char)*it) || *it == '_'; ++it)
+            ;
+        if ((size_t)(it - p->it) >= STRING_MAX_LEN)
+            return -1;
+        int id = node_name(p->e, p->it, it - p->it);
+        p->it = it;
+        return id;
+    }
+    if (isdigit((unsigned char)*it) || *it == '.') {
+        char *end;
+        double value = strtod(it, &end);
+        if (end == it)
+            return -1;
+        p->it = end;
+        return node_const(p->e, value);
+    }
+    return -1;
+}
+
+static int parse_unary(struct parser *p) {
+    skip_space(p);
+    if (*p->it == '-') {
+        ++p->it;
+        int id = parse_unary(p);
+        return id < 0 ? -1 : node_op(p->e, EXPR_NEG, id, -1);
+    }
+    return parse_primary(p);
+}
+
+static int parse_product(struct parser *p) {
+    int id = parse_unary(p);
+    for (;;) {
+        if (id < 0)
+            return -1;
+        skip_space(p);
+        if (*p->it != '*')
+            return id;
+        ++p->it;
+        int r = parse_unary(p);
+        id = r < 0 ? -1 : node_op(p->e, EXPR_MUL, id, r);
+    }
+}
+
+static int parse_sum(struct parser *p) {
+    int id = parse_product(p);
+    for (;;) {
+        if (id < 0)
+            return -1;
+        skip_space(p);
+        if (*p->it != '+' && *p->it != '-')
+            return id;
+        enum expr_op op = *p->it++ == '+' ? EXPR_ADD : EXPR_SUB;
+        int r = parse_product(p);
+        id = r < 0 ? -1 : node_op(p->e, op, id, r);
+    }
+}
+
+int expr_parse(struct expr *e, const char *str, size_t *err_pos) {
+    struct parser p = {e, str, str};
+    int id = parse_sum(&p);
+    if (id >= 0) {
+        skip_space(&p);
+        if (*p.it == 0)
+            return id;
+    }
+    if (err_pos != NULL)
+        *err_pos = p.it - str;
+    return -1;
+}
+
+// ---- evaluation ----
+
+enum node_state { NODE_PENDING, NODE_BORROWED, NODE_OWNED };
+
+struct eval_slot {
+    // consumers of the node that have not taken its value yet; a value is
+    // released as soon as the last one has
+    int uses;
+    enum node_state state;
+    const struct polynomial *value;
+    struct polynomial owned;
+};
+
+struct eval {
+    const struct expr *e;
+    expr_resolve resolve;
+    void *ctx;
+    const char *missing;
+    struct eval_slot *slots; // one per node of the cone
+};
+
+static inline struct eval_slot *at(struct eval *ev, int id) {
+    return &ev->slots[ev->e->slot[id]];
+}
+
+// whether id is reached for the first time in this pass
+static inline bool visit(struct expr *e, int id) {
+    if (e->seen[id] == e->pass)
+        return false;
+    e->seen[id] = e->pass;
+    return true;
+}
+
+static int count_cone(struct expr *e, int id) {
+    if (!visit(e, id))
+        return 0;
+    const struct expr_node *node = &e->nodes[id];
+    return 1 + (node->l >= 0 ? count_cone(e, node->l) : 0) +
+           (node->r >= 0 ? count_cone(e, node->r) : 0);
+}
+
+// Number the nodes under id in slot and list them in cone, keeping the slots
+// an evaluation further out gave them in saved
+static void number_cone(struct expr *e, int id, int *cone, int *saved,
+                        int *n) {
+    if (!visit(e, id))
+        return;
+    cone[*n] = id;
+    saved[*n] = e->slot[id];
+    e->slot[id] = (*n)++;
+    const struct expr_node *node = &e->nodes[id];
+    if (node->l >= 0)
+        number_cone(e, node->l, cone, saved, n);
+    if (node->r >= 0)
+        number_cone(e, node->r, cone, saved, n);
+}
+
+static void count_uses(struct eval *ev, int id) {
+    if (at(ev, id)->uses++ > 0)
+        return;
+    const struct expr_node *n = &ev->e->nodes[id];
+    if (n->l >= 0)
+        count_uses(ev, n->l);
+    if (n->r >= 0)
+        count_uses(ev, n->r);
+}
+
+static const struct polynomial *get(struct eval *ev, int id);
+
+// one consumer of id is done with its value
+static void put(struct eval *ev, int id) {
+    struct eval_slot *s = at(ev, id);
+    if (--s->uses == 0 && s->state == NODE_OWNED) {
+        polynomial_release(&s->owned);
+        s->state = NODE_PENDING;
+    }
+}
+
+static inline bool is_sum(const struct expr_node *n) {
+    return n->op == EXPR_ADD || n->op == EXPR_SUB || n->op == EXPR_NEG;
+}
+
+static bool accumulate(struct eval *ev, int id, double sign,
+                       struct polynomial *acc);
+
+// acc += sign * id. Sums and products nobody else uses are folded into acc
+// instead of being computed on their own.
+static bool accumulate_part(struct eval *ev, int id, double sign,
+                            struct polynomial *acc) {
+    const struct expr_node *n = &ev->e->nodes[id];
+    struct eval_slot *s = at(ev, id);
+    bool ok = true;
+    if (s->uses == 1 && s->state == NODE_PENDING && is_sum(n)) {
+        ok = accumulate(ev, id, sign, acc);
+        s->uses = 0;
+    } else if (s->uses == 1 && s->state == NODE_PENDING &&
+               n->op == EXPR_MUL) {
+        const struct polynomial *x = get(ev, n->l), *y = get(ev, n->r);
+        if (x != NULL && y != NULL)
+            (sign > 0 ? polynomial_fma : polynomial_fms)(acc, x, y);
+        else
+            ok = false;
+        put(ev, n->l);
+        put(ev, n->r);
+        s->uses = 0;
+    } else {
+        const struct polynomial *x = get(ev, id);
+        if (x != NULL)
+            (sign > 0 ? polynomial_add_inplace : polynomial_sub_inplace)(
+                acc, x);
+        else
+            ok = false;
+        put(ev, id);
+    }
+    return ok;
+}
+
+static bool accumulate(struct eval *ev, int id, double sign,
+                       struct polynomial *acc) {
+    const struct expr_node *n = &ev->e->nodes[id];
+    switch (n->op) {
+    case EXPR_ADD:
+        return accumulate_part(ev, n->l, sign, acc) &&
+               accumulate_part(ev, n->r, sign, acc);
+    case EXPR_SUB:
+        return accumulate_part(ev, n->l, sign, acc) &&
+               accumulate_part(ev, n->r, -sign, acc);
+    default: // EXPR_NEG
+        return accumulate_part(ev, n->l, -sign, acc);
+    }
+}
+
+// value of id, computed on first use; NULL if a name cannot be resolved
+static const struct polynomial *get(struct eval *ev, int id) {
+    struct eval_slot *s = at(ev, id);
+    if (s->state != NODE_PENDING)
+        return s->value;
+    const struct expr_node *n = &ev->e->nodes[id];
+    struct polynomial *out = &s->owned;
+    if (n->op == EXPR_NAME) {
+        s->value = ev->resolve(ev->ctx, n->name);
+        if (s->value == NULL) {
+            if (ev->missing == NULL)
+                ev->missing = n->name;
+            return NULL;
+        }
+        s->state = NODE_BORROWED;
+        return s->value;
+    }
+    bool ok = true;
+    if (n->op == EXPR_MUL) {
+        const struct polynomial *x = get(ev, n->l), *y = get(ev, n->r);
+        ok = x != NULL && y != NULL;
+        if (ok)
+            polynomial_mul(out, x, y);
+        put(ev, n->l);
+        put(ev, n->r);
+    } else {
+        polynomial_init(out);
+        if (n->op == EXPR_CONST && n->value != 0)
+            polynomial_add_term(out, 0, n->value);
+        else if (n->op != EXPR_CONST)
+            ok = accumulate(ev, id, 1, out);
+        if (!ok)
+            polynomial_release(out);
+    }
+    if (!ok)
+        return NULL;
+    s->state = NODE_OWNED;
+    s->value = out;
+    return out;
+}
+
+int expr_eval(struct expr *e, int root, struct polynomial *dest,
+              expr_resolve resolve, void *ctx, const char **missing) {
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    e->pass++;
+    int n = count_cone(e, root);
+    int *cone = arena_alloc(scratch, sizeof(int) * n);
+    int *saved = arena_alloc(scratch, sizeof(int) * n);
+    e->pass++;
+    n = 0;
+    number_cone(e, root, cone, saved, &n);
+    struct eval ev = {.e = e, .resolve = resolve, .ctx = ctx};
+    ev.slots = arena_alloc(scratch, sizeof(struct eval_slot) * n);
+    for (int i = 0; i < n; ++i) {
+        ev.slots[i].uses = 0;
+        ev.slots[i].state = NODE_PENDING;
+    }
+    count_uses(&ev, root);
+
+    const struct polynomial *v = get(&ev, root);
+    struct eval_slot *r = at(&ev, root);
+    int ret = 0;
+    if (v == NULL) {
+        polynomial_init(dest);
+        polynomial_release(dest);
+        ret = -1;
+    } else if (r->state == NODE_OWNED) {
+        polynomial_move(dest, &r->owned);
+    } else {
+        polynomial_init(dest);
+        polynomial_add_inplace(dest, v);
+    }
+    // a failed evaluation can leave values behind
+    for (int i = 0; i < n; ++i) {
+        if (ev.slots[i].state == NODE_OWNED && (&ev.slots[i] != r || ret != 0))
+            polynomial_release(&ev.slots[i].owned);
+        e->slot[cone[i]] = saved[i];
+    }
+    if (missing != NULL)
+        *missing = ev.missing;
+    arena_rewind(scratch, mark);
+    return ret;
+}
+
+// ---- collection ----
+
+bool expr_collect_due(const struct expr *e) {
+    return e->size >= 2 * e->live + EXPR_COLLECT_MIN;
+}
+
+static void mark_live(struct expr *e, int id) {
+    if (!visit(e, id))
+        return;
+    if (e->nodes[id].l >= 0)
+        mark_live(e, e->nodes[id].l);
+    if (e->nodes[id].r >= 0)
+        mark_live(e, e->nodes[id].r);
+}
+
+void expr_collect(struct expr *e, int *const *roots, int n) {
+    e->pass++;
+    for (int i = 0; i < n; ++i)
+        mark_live(e, *roots[i]);
+    // The live nodes are interned again in order. Children always have
+    // smaller ids than their parents, so slot holds the new ids of the
+    // operands by the time a node is reached, and the operands of commutative
+    // nodes keep their order.
+    struct expr fresh = {.intern = table_create(NULL)};
+    for (int id = 0; id < e->size; ++id) {
+        const struct expr_node *node = &e->nodes[id];
+        if (e->seen[id] != e->pass)
+            continue;
+        if (node->op == EXPR_NAME)
+            e->slot[id] = node_name(&fresh, node->name, strlen(node->name));
+        else if (node->op == EXPR_CONST)
+            e->slot[id] = node_const(&fresh, node->value);
+        else
+            e->slot[id] = node_op(&fresh, node->op, e->slot[node->l],
+                                  node->r >= 0 ? e->slot[node->r] : -1);
+    }
+    for (int i = 0; i < n; ++i)
+        *roots[i] = e->slot[*roots[i]];
+    table_free(&e->intern);
+    free(e->nodes);
+    free(e->slot);
+    free(e->seen);
+    *e = fresh;
+    e->live = e->size;
+}
@@ -0,0 +1,47 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Formulas over named polynomials, kept as one DAG per struct expr. Parsing
+// hash-conses every subexpression, so a subexpression written twice (in one
+// formula or in several) is a single node and is computed once per
+// evaluation. Evaluation folds whole sums into a single accumulator and turns
+// the products inside them into fused multiply-adds, so a - b * c + d * e
+// allocates one result and two products rather than every partial sum.
+//
+//   expr    := term (('+' | '-') term)*
+//   term    := unary ('*' unary)*
+//   unary   := '-' unary | primary
+//   primary := NUMBER | NAME | '(' expr ')'
+//
+// NAME is a letter or '_' followed by letters, digits and '_'.
+struct polynomial;
+struct expr;
+
+// returns the polynomial called name, NULL if there is none
+typedef struct polynomial *(*expr_resolve)(void *ctx, const char *name);
+
+struct expr *expr_create(void);
+void expr_free(struct expr *);
+
+// Parse str into the DAG and return the id of its root, or -1 with the offset
+// of the offending character stored in err_pos (if not NULL).
+int expr_parse(struct expr *, const char *str, size_t *err_pos);
+
+// Evaluate root into dest, which gets initialized. Names are resolved when
+// they are reached, and only the nodes under root are visited. Returns 0, or
+// -1 with the first name that could not be resolved stored in missing (if not
+// NULL) and dest left released.
+int expr_eval(struct expr *, int root, struct polynomial *dest,
+              expr_resolve resolve, void *ctx, const char **missing);
+
+// Parsing only ever adds nodes. expr_collect drops every node none of the n
+// roots reaches and renumbers the others, updating *roots[i]; it costs the
+// size of the DAG, so it is left until expr_collect_due says the DAG has
+// grown to well past what the last collection kept.
+bool expr_collect_due(const struct expr *);
+void expr_collect(struct expr *, int *const *roots, int n);
+
+#endif
@@ -0,0 +1,377 @@
+#include "extmul.h"
+#include "alloc.h"
+#include "merge_heap.h"
+#include "polynomial.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// buffer of every run being written or merged
+#define RUN_BUFFER (64 << 10)
+// runs merged at once at most, each holds a file descriptor
+#define MAX_FAN_IN 64
+// the longest encoding of a term: a 5 byte varint and the coefficient
+#define TERM_BYTES_MAX 13
+
+// exponents are stored biased, so that their order is the unsigned order
+static inline uint32_t bias(int exp) { return (uint32_t)exp ^ 0x80000000u; }
+
+// An anonymous temporary file in dir: it is unlinked at once, its space is
+// given back when it is closed. Unbuffered, the runs bring their own buffer.
+static FILE *temp_file(const char *dir) {
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+    if (dir == NULL || *dir == '\0')
+        dir = "/tmp";
+    static const char name[] = "/polyrunXXXXXX";
+    size_t len = strlen(dir);
+    char *path = malloc(len + sizeof(name));
+    if (path == NULL)
+        return NULL;
+    memcpy(path, dir, len);
+    memcpy(path + len, name, sizeof(name));
+    FILE *fp = NULL;
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        fp = fdopen(fd, "w+b");
+        if (fp == NULL) {
+            int err = errno;
+            close(fd);
+            errno = err;
+        } else {
+            setvbuf(fp, NULL, _IONBF, 0);
+        }
+    }
+    free(path);
+    return fp;
+}
+
+// close files without losing the errno of whatever failed before
+static void close_files(FILE **fps, int n) {
+    int err = errno;
+    for (int i = 0; i < n; ++i)
+        fclose(fps[i]);
+    errno = err;
+}
+
+// ---- runs ----
+
+struct run_writer {
+    FILE *fp;
+    unsigned char *buf;
+    size_t len;
+    uint32_t prev; // biased exponent of the last term
+};
+
+static void writer_init(struct run_writer *w, FILE *fp, unsigned char *buf) {
+    *w = (struct run_writer){.fp = fp, .buf = buf};
+}
+
+static int writer_flush(struct run_writer *w) {
+    STATS_COUNT(STATS_SPILL_BYTES, w->len);
+    errno = 0;
+    if (fwrite(w->buf, 1, w->len, w->fp) != w->len) {
+        if (errno == 0)
+            errno = EIO;
+        return -1;
+    }
+    w->len = 0;
+    return 0;
+}
+
+// terms must come in ascending order of exponent
+static int writer_put(struct run_writer *w, int exp, double coeff) {
+    if (RUN_BUFFER - w->len < TERM_BYTES_MAX && writer_flush(w) != 0)
+        return -1;
+    uint32_t delta = bias(exp) - w->prev;
+    w->prev = bias(exp);
+    for (; delta >= 0x80; delta >>= 7)
+        w->buf[w->len++] = (unsigned char)(delta | 0x80);
+    w->buf[w->len++] = (unsigned char)delta;
+    memcpy(w->buf + w->len, &coeff, sizeof(double));
+    w->len += sizeof(double);
+    return 0;
+}
+
+// write what is buffered and go back to the start of the run for reading
+static int writer_finish(struct run_writer *w) {
+    if (writer_flush(w) != 0)
+        return -1;
+    return fseek(w->fp, 0, SEEK_SET);
+}
+
+struct run_reader {
+    FILE *fp;
+    unsigned char *buf;
+    size_t pos, len;
+    bool eof;
+    uint32_t prev;
+    struct term t; // the current term
+};
+
+static void reader_init(struct run_reader *r, FILE *fp, unsigned char *buf) {
+    *r = (struct run_reader){.fp = fp, .buf = buf};
+}
+
+// Read the next term into r->t. Returns 1, 0 at the end of the run or -1
+// with errno set.
+static int reader_next(struct run_reader *r) {
+    if (r->len - r->pos < TERM_BYTES_MAX && !r->eof) {
+        // keep the partial term that is left and fill up behind it
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+        size_t want = RUN_BUFFER - r->len;
+        size_t got = fread(r->buf + r->len, 1, want, r->fp);
+        if (ferror(r->fp))
+            return -1;
+        r->len += got;
+        r->eof = got < want;
+    }
+    if (r->pos == r->len)
+        return 0;
+    uint32_t delta = 0;
+    for (int shift = 0;; shift += 7) {
+        if (r->pos == r->len || shift > 28) {
+            errno = EIO;
+            return -1;
+        }
+        unsigned char c = r->buf[r->pos++];
+        delta |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+    if (r->len - r->pos < sizeof(double)) {
+        errno = EIO;
+        return -1;
+    }
+    r->prev += delta;
+    r->t.exp = (int)(r->prev ^ 0x80000000u);
+    memcpy(&r->t.coeff, r->buf + r->pos, sizeof(double));
+    r->pos += sizeof(double);
+    return 1;
+}
+
+// ---- merge ----
+
+// hands the product to the sink in chunks of RUN_BUFFER bytes
+struct sink_buffer {
+    const struct extmul_sink *sink;
+    struct term *terms;
+    size_t size;
+};
+
+#define SINK_TERMS (RUN_BUFFER / sizeof(struct term))
+
+static int sink_flush(struct sink_buffer *s) {
+    if (s->size > 0 && s->sink->put(s->sink->ctx, s->terms, s->size) != 0)
+        return -1;
+    s->size = 0;
+    return 0;
+}
+
+static int emit(struct run_writer *out, struct sink_buffer *sink, int exp,
+                double coeff) {
+    if (sink == NULL)
+        return writer_put(out, exp, coeff);
+    if (sink->size == SINK_TERMS && sink_flush(sink) != 0)
+        return -1;
+    sink->terms[sink->size++] = (struct term){.coeff = coeff, .exp = exp};
+    return 0;
+}
+
+// Merge the runs in into out (when the sink is NULL) or into the sink,
+// summing like terms. Returns the number of terms written or -1.
+static long long merge(FILE **in, int n, struct run_writer *out,
+                       struct sink_buffer *sink) {
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct run_reader *runs =
+        arena_alloc(scratch, sizeof(struct run_reader) * n);
+    struct mul_node *heap =
+        arena_alloc(scratch, sizeof(struct mul_node) * (n + 1));
+    int size = 0;
+    heap[0].key = UINT64_MAX;
+    for (int i = 0; i < n; ++i) {
+        reader_init(&runs[i], in[i], arena_alloc(scratch, RUN_BUFFER));
+        int got = reader_next(&runs[i]);
+        if (got < 0)
+            goto fail;
+        if (got > 0)
+            heap_push(heap, &size, mul_key(runs[i].t.exp, i));
+    }
+    long long count = 0;
+    while (size > 0) {
+        int exp = mul_key_exp(heap[0].key);
+        double coeff = 0;
+        // runs come off the heap in index order for each exponent
+        while (size > 0 && mul_key_exp(heap[0].key) == exp) {
+            int i = (int)(uint32_t)heap[0].key;
+            coeff += runs[i].t.coeff;
+            int got = reader_next(&runs[i]);
+            if (got < 0)
+                goto fail;
+            if (got > 0)
+                heap_replace_top(heap, size, mul_key(runs[i].t.exp, i));
+            else
+                heap_pop(heap, &size);
+        }
+        if (coeff == 0)
+            continue;
+        if (emit(out, sink, exp, coeff) != 0)
+            goto fail;
+        ++count;
+    }
+    arena_rewind(scratch, mark);
+    return count;
+fail:
+    arena_rewind(scratch, mark);
+    return -1;
+}
+
+// ---- runs waiting to be merged ----
+
+// Runs are merged fan_in at a time as soon as that many of the same level
+// (merged that many times) are waiting, so every term is rewritten once per
+// level and the open files stay few: fan_in - 1 for each level at most.
+struct run_stack {
+    FILE **fps;
+    int *level;
+    int n, fan_in;
+    const char *dir;
+    unsigned char *buf; // for the writer of a merged run
+};
+
+// merge the top count runs into one
+static int stack_merge(struct run_stack *s, int count) {
+    FILE *fp = temp_file(s->dir);
+    if (fp == NULL)
+        return -1;
+    struct run_writer w;
+    writer_init(&w, fp, s->buf);
+    FILE **in = s->fps + s->n - count;
+    if (merge(in, count, &w, NULL) < 0 || writer_finish(&w) != 0) {
+        close_files(&fp, 1);
+        return -1;
+    }
+    close_files(in, count);
+    int level = s->level[s->n - 1] + 1;
+    s->n -= count;
+    s->fps[s->n] = fp;
+    s->level[s->n++] = level;
+    return 0;
+}
+
+static int stack_push(struct run_stack *s, FILE *fp) {
+    s->fps[s->n] = fp;
+    s->level[s->n++] = 0;
+    // levels never grow towards the top, so the bottom one of the top fan_in
+    // runs tells whether they are all of a level
+    while (s->n >= s->fan_in &&
+           s->level[s->n - s->fan_in] == s->level[s->n - 1])
+        if (stack_merge(s, s->fan_in) != 0)
+            return -1;
+    return 0;
+}
+
+// ---- product ----
+
+// the terms [from, from + n) of p, as a polynomial that must not be changed
+static struct polynomial slice(const struct polynomial *p, int from, int n) {
+    return (struct polynomial){
+        .size = n, .cap = n, .terms = p->terms + from, .alloc = p->alloc};
+}
+
+// multiply two slices into a new sorted run
+static FILE *tile_run(const struct polynomial *a, const struct polynomial *b,
+                      const char *dir, unsigned char *buf) {
+    struct polynomial prod;
+    polynomial_mul_with(&prod, a, b, POLY_MUL_HEAP);
+    FILE *fp = temp_file(dir);
+    if (fp != NULL) {
+        struct run_writer w;
+        writer_init(&w, fp, buf);
+        int ret = 0;
+        for (int i = 0; i < prod.size && ret == 0; ++i)
+            ret = writer_put(&w, prod.terms[i].exp, prod.terms[i].coeff);
+        if (ret != 0 || writer_finish(&w) != 0) {
+            close_files(&fp, 1);
+            fp = NULL;
+        }
+    }
+    polynomial_release(&prod);
+    return fp;
+}
+
+long long extmul(const struct polynomial *a, const struct polynomial *b,
+                 const struct extmul_config *cfg,
+                 const struct extmul_sink *sink) {
+    // rows come from the shorter operand, as in the sparse engine
+    if (a->size > b->size) {
+        const struct polynomial *t = a;
+        a = b;
+        b = t;
+    }
+    if (a->size == 0)
+        return 0;
+    size_t memory = cfg->memory;
+    if (memory < EXTMUL_MIN_MEMORY)
+        memory = EXTMUL_MIN_MEMORY;
+    // a tile product takes up to twice its size while its array grows
+    size_t tile = memory / 4 / sizeof(struct term);
+    int cols = (size_t)b->size < tile ? b->size : (int)tile;
+    size_t rows = tile / cols;
+    if (rows >= (size_t)a->size) {
+        // the whole product fits, nothing to spill
+        struct polynomial prod;
+        polynomial_mul_with(&prod, a, b, POLY_MUL_HEAP);
+        long long count = prod.size;
+        if (prod.size > 0 && sink->put(sink->ctx, prod.terms, prod.size) != 0)
+            count = -1;
+        polynomial_release(&prod);
+        return count;
+    }
+
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct run_stack s = {.dir = cfg->dir};
+    s.fan_in = (int)(memory / RUN_BUFFER) - 1;
+    if (s.fan_in > MAX_FAN_IN)
+        s.fan_in = MAX_FAN_IN;
+    // fan_in - 1 runs on each of at most 64 levels, and the one pushed
+    int cap = (s.fan_in - 1) * 64 + 1;
+    s.fps = arena_alloc(scratch, sizeof(FILE *) * cap);
+    s.level = arena_alloc(scratch, sizeof(int) * cap);
+    s.buf = arena_alloc(scratch, RUN_BUFFER);
+    long long count = -1;
+    for (int j = 0; j < b->size; j += cols) {
+        int nb = b->size - j < cols ? b->size - j : cols;
+        struct polynomial vb = slice(b, j, nb);
+        for (int i = 0; i < a->size; i += (int)rows) {
+            int na = (size_t)(a->size - i) < rows ? a->size - i : (int)rows;
+            struct polynomial va = slice(a, i, na);
+            FILE *fp = tile_run(&va, &vb, s.dir, s.buf);
+            if (fp == NULL || stack_push(&s, fp) != 0)
+                goto done;
+        }
+    }
+    while (s.n > s.fan_in)
+        if (stack_merge(&s, s.fan_in) != 0)
+            goto done;
+    struct sink_buffer buffer = {
+        .sink = sink,
+        .terms = arena_alloc(scratch, sizeof(struct term) * SINK_TERMS)};
+    count = merge(s.fps, s.n, NULL, &buffer);
+    if (count >= 0 && sink_flush(&buffer) != 0)
+        count = -1;
+done:
+    close_files(s.fps, s.n);
+    arena_rewind(scratch, mark);
+    return count;
+}
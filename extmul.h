@@ -0,0 +1,44 @@
+#ifndef EXTMUL_H
+#define EXTMUL_H
+
+#include <stddef.h>
+
+// External-memory multiplication, for products too large to be held in
+// memory. The term pairs are cut into tiles whose product fits in the memory
+// budget; every tile is multiplied by the sparse engine and spilled to a
+// temporary file as a sorted run, and the runs are merged (in several passes
+// if there are more than the buffers fit) while like terms are combined. The
+// product is streamed to a sink in ascending order of exponent and never
+// exists in memory as a whole.
+//
+// A run holds, for every term, the distance of its exponent to the previous
+// one as a LEB128 varint followed by the coefficient as a raw double, so a
+// dense run costs 9 bytes a term.
+//
+// Coefficients that are spread over several runs are summed in run order,
+// which may round differently than polynomial_mul.
+struct polynomial;
+struct term;
+
+// default and smallest memory budget
+#define EXTMUL_MEMORY ((size_t)64 << 20)
+#define EXTMUL_MIN_MEMORY ((size_t)1 << 20)
+
+struct extmul_config {
+    size_t memory;   // bytes for tile products and run buffers
+    const char *dir; // temporary files, NULL for $TMPDIR or /tmp
+};
+
+// Receives the product in order, a chunk at a time. Returns 0, or -1 with
+// errno set to stop the multiplication.
+struct extmul_sink {
+    int (*put)(void *ctx, const struct term *terms, size_t n);
+    void *ctx;
+};
+
+// Stream a * b to sink. Returns the number of terms of the product, or -1
+// with errno set if a temporary file or the sink fails.
+long long extmul(const struct polynomial *a, const struct polynomial *b,
+                 const struct extmul_config *, const struct extmul_sink *);
+
+#endif
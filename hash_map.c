@@ -1,164 +1,250 @@
 #include "hash_map.h"
+#include "alloc.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
-static void entry_free(Entry *e, void (*free_callback)(void *), int d) {
-    for (int i = 0; i < (1 << LAY_SIZE); ++i) {
-        if (e->t[i] != NULL) {
-            if (d < LAYER - 1) {
-                entry_free((Entry *)e->t[i], free_callback, d + 1);
-            } else {
-                Item *p = (Item *)(e->t[i]);
-                while (p != NULL) {
-                    Item *tmp = p->next;
-                    if (free_callback != NULL)
-                        free_callback(p->data);
-                    else
-                        free(p->data);
-                    free(p);
-                    p = tmp;
-                }
-            }
-        }
-    }
-    free(e);
-}
-
-// these implementation of hash is copied in following link
-// https://byvoid.com/zht/blog/string-hash-compare/
-uint32_t hash_str(const char *s) {
-    // rs hash
-    uint32_t b = 378551;
-    uint32_t a = 63689;
-    uint32_t hash = 0;
-    while (*s) {
-        hash = hash * a + (*s++);
-        a *= b;
-    }
-    return (hash & 0x7FFFFFFF);
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// control byte states, a full slot stores the low 7 bits of its hash instead
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+static inline bool ctrl_is_full(uint8_t c) { return !(c & 0x80); }
+
+// bit i is set when ctrl[i] == b
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t b) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)b)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP; ++i)
+        mask |= (uint32_t)(ctrl[i] == b) << i;
+    return mask;
+#endif
 }
 
-uint32_t backup_hash(const char *s) {
-    // js hash
-    uint32_t hash = 1315423911;
-    while (*s) {
-        hash ^= ((hash << 5) + (*s++) + (hash >> 2));
+// bit i is set when ctrl[i] is empty or deleted
+static inline uint32_t group_match_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP; ++i)
+        mask |= (uint32_t)!ctrl_is_full(ctrl[i]) << i;
+    return mask;
+#endif
+}
+
+static inline size_t max_load(size_t cap) { return cap - cap / 8; }
+
+// multiply-xorshift hash over 8 byte words, finished with murmur3's fmix64
+uint64_t hash_str(const char *s) {
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    size_t len = strlen(s);
+    uint64_t h = len * k;
+    for (; len >= 8; len -= 8, s += 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        h = (h ^ (w * k)) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
     }
-    return (hash & 0x7FFFFFFF);
+    uint64_t w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ (w * k)) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void table_alloc(HashTable *t, size_t cap) {
+    t->ctrl = allocator_alloc(t->alloc, cap);
+    assert(t->ctrl != NULL);
+    memset(t->ctrl, CTRL_EMPTY, cap);
+    t->slots = allocator_alloc(t->alloc, sizeof(Item) * cap);
+    assert(t->slots != NULL);
+    t->cap = cap;
+    t->growth_left = max_load(cap) - t->size;
+}
+
+static void table_release_arrays(HashTable *t, uint8_t *ctrl, Item *slots,
+                                 size_t cap) {
+    allocator_release(t->alloc, ctrl, cap);
+    allocator_release(t->alloc, slots, sizeof(Item) * cap);
 }
 
 HashTable *table_create(void (*free_callback)(void *)) {
     HashTable *ret = calloc(1, sizeof(HashTable));
-    ret->e = calloc(1, sizeof(Entry));
+    ret->alloc = allocator_current();
+    table_alloc(ret, TABLE_GROUP);
     ret->free_callback = free_callback;
     return ret;
 }
 
+void table_set_move_callback(HashTable *t,
+                             void (*move_callback)(void *to,
+                                                   const void *from)) {
+    t->move_callback = move_callback;
+}
+
+static void data_free(HashTable *t, Item *item) {
+    if (t->free_callback != NULL)
+        t->free_callback(item->data);
+    allocator_release(t->alloc, item->data, item->size);
+}
+
+static void item_free(HashTable *t, Item *item) {
+    data_free(t, item);
+    allocator_release(t->alloc, item->key, strlen(item->key) + 1);
+}
+
 void table_free(HashTable **t) {
     if (t == NULL || *t == NULL)
         return;
-    entry_free((*t)->e, (*t)->free_callback, 0);
+    for (size_t i = 0; i < (*t)->cap; ++i)
+        if (ctrl_is_full((*t)->ctrl[i]))
+            item_free(*t, &(*t)->slots[i]);
+    table_release_arrays(*t, (*t)->ctrl, (*t)->slots, (*t)->cap);
     free(*t);
     *t = NULL;
 }
 
-void **entry_allocate(HashTable *t, uint32_t hash) {
-    if (t == NULL)
-        return NULL;
-    Entry *e = t->e;
-    void **ret;
-    for (int i = 0; i < LAYER; ++i) {
-        if (e->t[MASK(hash, LAYER - 1 - i)] == NULL && i < LAYER - 1) {
-            e->t[MASK(hash, LAYER - 1 - i)] = calloc(1, sizeof(Entry));
+// Triangular probing over groups, visits every group once when the group
+// count is a power of two. The group is picked by the high hash bits, the
+// control byte uses the low 7.
+struct probe {
+    size_t group, step, mask;
+};
+
+static inline struct probe probe_start(const HashTable *t, uint64_t hash) {
+    size_t mask = t->cap / TABLE_GROUP - 1;
+    return (struct probe){.group = (hash >> 7) & mask, .step = 0, .mask = mask};
+}
+
+static inline void probe_next(struct probe *p) {
+    p->group = (p->group + ++p->step) & p->mask;
+}
+
+static Item *find(const HashTable *t, const char *key, uint64_t hash) {
+    uint8_t h2 = hash & 0x7f;
+    STATS_COUNT(STATS_TABLE_LOOKUPS, 1);
+    for (struct probe p = probe_start(t, hash);; probe_next(&p)) {
+        const uint8_t *ctrl = t->ctrl + p.group * TABLE_GROUP;
+        for (uint32_t m = group_match(ctrl, h2); m; m &= m - 1) {
+            Item *item = &t->slots[p.group * TABLE_GROUP + __builtin_ctz(m)];
+            if (item->hash == hash && strcmp(item->key, key) == 0) {
+                STATS_RECORD(STATS_TABLE_PROBE, p.step + 1);
+                return item;
+            }
+            STATS_COUNT(STATS_TABLE_COLLISIONS, 1);
         }
-        if (i < LAYER - 1) {
-            e = (Entry *)e->t[MASK(hash, LAYER - 1 - i)];
-        } else {
-            ret = &(e->t[MASK(hash, LAYER - 1 - i)]);
+        // an empty slot ends every probe sequence that could reach the key
+        if (group_match(ctrl, CTRL_EMPTY) || p.step >= p.mask) {
+            STATS_RECORD(STATS_TABLE_PROBE, p.step + 1);
+            return NULL;
         }
     }
-    return ret;
 }
 
-void **entry_query(HashTable *t, uint32_t hash) {
-    if (t == NULL)
-        return NULL;
-    Entry *e = t->e;
-    void **ret;
-    for (int i = 0; i < LAYER; ++i) {
-        if (e->t[MASK(hash, LAYER - 1 - i)] == NULL && i < LAYER - 1) {
-            return NULL;
-        }
-        if (i < LAYER - 1) {
-            e = (Entry *)e->t[MASK(hash, LAYER - 1 - i)];
-        } else {
-            ret = &(e->t[MASK(hash, LAYER - 1 - i)]);
-        }
+// first empty or deleted slot along the probe sequence of hash
+static size_t find_free(const HashTable *t, uint64_t hash) {
+    for (struct probe p = probe_start(t, hash);; probe_next(&p)) {
+        uint32_t m = group_match_free(t->ctrl + p.group * TABLE_GROUP);
+        if (m)
+            return p.group * TABLE_GROUP + __builtin_ctz(m);
     }
-    return ret;
+}
+
+static void rehash(HashTable *t, size_t cap) {
+    uint8_t *old_ctrl = t->ctrl;
+    Item *old_slots = t->slots;
+    size_t old_cap = t->cap;
+    STATS_COUNT(STATS_TABLE_REHASHES, 1);
+    table_alloc(t, cap);
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (!ctrl_is_full(old_ctrl[i]))
+            continue;
+        size_t pos = find_free(t, old_slots[i].hash);
+        t->ctrl[pos] = old_ctrl[i];
+        t->slots[pos] = old_slots[i];
+    }
+    table_release_arrays(t, old_ctrl, old_slots, old_cap);
 }
 
 void table_emplace(HashTable *t, const char *key, const void *data,
                    const size_t size) {
     if (t == NULL)
         return;
-    uint32_t hash = hash_str(key);
-    uint32_t backup = backup_hash(key);
-    // points to array pointer
-    void **p = entry_allocate(t, hash);
-    Item *item;
-    // special case to NULL item in hash table (No collision)
-    if (*p == NULL) {
-        *p = calloc(1, sizeof(Item));
-        item = (Item *)*p;
-    } else { // on collision
-        // copied of pointer
-        item = (Item *)(*p);
-        // Pointer reference for create new node in next
-        Item **ptr = &item;
-        while (item != NULL) {
-            if (item->backup_hash == backup) {
-                break;
-            }
-            ptr = &item->next;
-            item = item->next;
-        }
-        if (*ptr == NULL) {
-            // update prev -> next
-            item = *ptr = calloc(1, sizeof(Item));
+    uint64_t hash = hash_str(key);
+    Item *item = find(t, key, hash);
+    if (item != NULL) {
+        data_free(t, item);
+    } else {
+        size_t pos = find_free(t, hash);
+        if (t->growth_left == 0 && t->ctrl[pos] == CTRL_EMPTY) {
+            // tombstones are reclaimed in place unless the table is really
+            // full, otherwise grow
+            rehash(t, t->size * 2 <= max_load(t->cap) ? t->cap : t->cap * 2);
+            pos = find_free(t, hash);
         }
+        if (t->ctrl[pos] == CTRL_EMPTY)
+            t->growth_left--;
+        t->ctrl[pos] = hash & 0x7f;
+        t->size++;
+        item = &t->slots[pos];
+        item->hash = hash;
+        size_t len = strlen(key) + 1;
+        item->key = allocator_alloc(t->alloc, len);
+        assert(item->key != NULL);
+        memcpy(item->key, key, len);
     }
-    if (item->data != NULL) {
-        if (t->free_callback != NULL)
-            t->free_callback(item->data);
-        else
-            free(item->data);
-    }
-    item->data = calloc(1, size);
+    item->data = allocator_alloc(t->alloc, size);
     assert(item->data != NULL);
     memcpy(item->data, data, size);
-    if (item->backup_hash != backup) {
-        item->backup_hash = backup;
-    }
+    if (t->move_callback != NULL)
+        t->move_callback(item->data, data);
+    item->size = size;
 }
 
 Item *table_query(HashTable *t, const char *key) {
     if (t == NULL)
         return NULL;
-    void **p = entry_allocate(t, hash_str(key));
-    uint32_t backup = backup_hash(key);
-    if (*p == NULL)
-        return *p;
-    Item *i = (Item *)*p;
-    while (i->backup_hash != backup) {
-        if (i->next != NULL) {
-            i = i->next;
-        } else {
-            return NULL;
-        }
+    return find(t, key, hash_str(key));
+}
+
+int table_erase(HashTable *t, const char *key) {
+    if (t == NULL)
+        return 1;
+    Item *item = find(t, key, hash_str(key));
+    if (item == NULL)
+        return 1;
+    size_t pos = item - t->slots;
+    item_free(t, item);
+    // a group that still has an empty slot never let a probe pass through
+    // it, so the slot can become empty again instead of a tombstone
+    uint8_t *group = t->ctrl + pos / TABLE_GROUP * TABLE_GROUP;
+    if (group_match(group, CTRL_EMPTY)) {
+        t->ctrl[pos] = CTRL_EMPTY;
+        t->growth_left++;
+    } else {
+        t->ctrl[pos] = CTRL_DELETED;
     }
-    return i;
+    t->size--;
+    return 0;
+}
+
+Item *table_next(HashTable *t, size_t *pos) {
+    if (t == NULL)
+        return NULL;
+    for (; *pos < t->cap; ++*pos)
+        if (ctrl_is_full(t->ctrl[*pos]))
+            return &t->slots[(*pos)++];
+    return NULL;
 }
@@ -1,45 +1,60 @@
-#define LAYER 8
-#define LAY_SIZE 4
-#define MASK(x, n)                                                             \
-    (((x) & ((uint32_t)(0xf) << (LAY_SIZE * (n)))) >> (LAY_SIZE * (n)))
-
 #pragma once
 
 #include <stdint.h>
 #include <stdlib.h>
 
+// Open addressing table in the style of SwissTable: slots are split in groups
+// of TABLE_GROUP, each slot has a control byte holding 7 bits of its hash, and
+// a lookup compares a whole group of control bytes at once (SSE2 when
+// available) before touching any key.
+#define TABLE_GROUP 16
+
+struct allocator;
+
 typedef struct item {
-    uint32_t backup_hash;
+    uint64_t hash;
+    char *key;
     void *data;
-    struct item *next;
+    size_t size; // of data
 } Item;
 
 typedef struct {
-    // pointer
-    void *t[1 << LAY_SIZE];
-} Entry;
-
-typedef struct {
-    Entry *e;
+    uint8_t *ctrl;
+    Item *slots;
+    size_t cap; // number of slots, a power of two and a multiple of the group
+    size_t size;
+    size_t growth_left; // insertions left before a rehash
     void (*free_callback)(void *);
+    void (*move_callback)(void *to, const void *from);
+    // keys, data copies and the table arrays come from here
+    const struct allocator *alloc;
 } HashTable;
 
+// Create a table using the current allocator. free_callback (if any) releases
+// what a data copy owns before the table releases the copy itself.
 HashTable *table_create(void (*free_callback)(void *));
 
 void table_free(HashTable **t);
 
-uint32_t hash_str(const char *s);
-uint32_t backup_hash(const char *s);
+// Data that points into itself gets a chance to fix that up: move_callback is
+// called with every data copy and the data it was copied from.
+void table_set_move_callback(HashTable *t,
+                             void (*move_callback)(void *to,
+                                                   const void *from));
+
+uint64_t hash_str(const char *s);
 
-// Emplace a data to table
+// Emplace a data to table, the key and size bytes of data are copied
 void table_emplace(HashTable *t, const char *key, const void *data,
                    size_t size);
 
-// Access a data from table
+// Access a data from table. The item moves on the next emplace or erase, keep
+// item->data (which never moves) rather than the item itself.
 Item *table_query(HashTable *t, const char *key);
 
-// Allocate Entry
-void **entry_allocate(HashTable *t, uint32_t hash);
+// Remove a key and release its data, returns 1 if the key was not present
+int table_erase(HashTable *t, const char *key);
 
-// Query Entry
-void **entry_query(HashTable *t, uint32_t hash);
+// Iterate over the items in no particular order: start with *pos = 0 and
+// call until NULL is returned. The table must not change in the meantime.
+Item *table_next(HashTable *t, size_t *pos);
@@ -1,19 +1,77 @@
+#include "batch.h"
 #include "hash_map.h"
 #include "polynomial.h"
+#include "server.h"
 #include "setup.h"
 
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void poly_free_adapter(void *p) {
-    polynomial_free((struct polynomial *)p);
+    polynomial_release((struct polynomial *)p);
 }
 
-int main() {
+static void poly_move_adapter(void *to, const void *from) {
+    polynomial_moved(to, from);
+}
+
+// polynomial.out --batch [FILE]: run commands from FILE (or stdin) without
+// the menu, see batch.h for the command language
+static int batch_main(const char *path) {
+    FILE *in = stdin;
+    if (path != NULL && strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == NULL) {
+            perror(path);
+            return 1;
+        }
+    }
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    struct batch b;
+    batch_init(&b, stdout);
+    long errors = batch_run(&b, in);
+    batch_free(&b);
+    fflush(stdout);
+    if (in != stdin)
+        fclose(in);
+    return errors != 0;
+}
+
+// polynomial.out --serve [SOCKET] [--tcp PORT] [--threads N]: serve the
+// batch command language to local clients, see server.h
+static int serve_main(int argc, char **argv) {
+    struct server_config cfg = {0};
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc)
+            cfg.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            cfg.threads = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && cfg.path == NULL)
+            cfg.path = argv[i];
+        else
+            cfg.port = -1;
+    }
+    if (cfg.port < 0 || cfg.port > 65535 || cfg.threads < 0 ||
+        (cfg.path == NULL && cfg.port == 0)) {
+        fprintf(stderr, "usage: polynomial.out --serve [SOCKET] [--tcp PORT] "
+                        "[--threads N]\n");
+        return 2;
+    }
+    return server_run(&cfg) != 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+        return batch_main(argc > 2 ? argv[2] : NULL);
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+        return serve_main(argc - 2, argv + 2);
     bool run = true;
     HashTable *table = table_create(poly_free_adapter);
+    table_set_move_callback(table, poly_move_adapter);
     while (run) {
         int cmd;
         printf("1) Input polynomial\n"
@@ -24,6 +82,8 @@ int main() {
                "6) Add polynomials\n"
                "7) Subtract polynomials\n"
                "8) Multiply polynomials\n"
+               "9) Raise polynomial to a power\n"
+               "10) Divide polynomials\n"
                "0) Quit\n");
         printf("Input one of the option: ");
         int ret = scanf("%d", &cmd);
@@ -54,7 +114,7 @@ int main() {
             }
             // item get copied into the data structure (shallow copy)
             table_emplace(table, name, p, sizeof(struct polynomial));
-            // free local copy of polynomial (not include shallow copied array)
+            // free the local struct, its terms now belong to the table copy
             free(p);
             break;
         }
@@ -173,7 +233,7 @@ int main() {
             fprintf(stdout, "Result: ");
             polynomial_print_fp(&p, stdout);
             fputc('\n', stdout);
-            free(p.terms);
+            polynomial_release(&p);
             break;
         }
         case 7: {
@@ -192,7 +252,7 @@ int main() {
             fprintf(stdout, "Result: ");
             polynomial_print_fp(&p, stdout);
             fputc('\n', stdout);
-            free(p.terms);
+            polynomial_release(&p);
             break;
         }
         case 8: {
@@ -207,11 +267,72 @@ int main() {
                 break;
             }
             struct polynomial p;
+#ifdef DEBUG
+            fprintf(stderr, "[mul: %s]\n",
+                    polynomial_mul_algo_name(
+                        polynomial_mul_select(itm1->data, itm2->data)));
+#endif
             polynomial_mul(&p, itm1->data, itm2->data);
             fprintf(stdout, "Result: ");
             polynomial_print_fp(&p, stdout);
             fputc('\n', stdout);
-            free(p.terms);
+            polynomial_release(&p);
+            break;
+        }
+        case 9: {
+            char name[STRING_MAX_LEN] = {0};
+            printf("Input polynomial name: ");
+            fgets(name, STRING_MAX_LEN, stdin);
+            Item *itm = table_query(table, name);
+            if (itm == NULL) {
+                printf("Error: cannot find polynomial\n");
+                break;
+            }
+            unsigned k;
+            printf("Input exponent: ");
+            int ret = scanf("%u", &k);
+            if (ret < 1) {
+                // clear invalid input in input stream
+                for (char c = getchar(); c != '\n' && c > 0; c = getchar())
+                    ;
+                break;
+            }
+            getchar();
+            struct polynomial p;
+            if (polynomial_pow(&p, itm->data, k) != 0) {
+                printf("Error: an exponent of the result is out of range\n");
+                break;
+            }
+            fprintf(stdout, "Result: ");
+            polynomial_print_fp(&p, stdout);
+            fputc('\n', stdout);
+            polynomial_release(&p);
+            break;
+        }
+        case 10: {
+            char name1[STRING_MAX_LEN] = {0}, name2[STRING_MAX_LEN];
+            printf("Input dividend's and divisor's name (use enter to "
+                   "separate): ");
+            fgets(name1, STRING_MAX_LEN, stdin);
+            fgets(name2, STRING_MAX_LEN, stdin);
+            Item *itm1 = table_query(table, name1),
+                 *itm2 = table_query(table, name2);
+            if (itm1 == NULL || itm2 == NULL) {
+                printf("Error: cannot find polynomial");
+                break;
+            }
+            struct polynomial q, r;
+            if (polynomial_divmod(&q, &r, itm1->data, itm2->data) != 0) {
+                printf("Error: division by zero\n");
+                break;
+            }
+            fprintf(stdout, "Quotient: ");
+            polynomial_print_fp(&q, stdout);
+            fprintf(stdout, "\nRemainder: ");
+            polynomial_print_fp(&r, stdout);
+            fputc('\n', stdout);
+            polynomial_release(&q);
+            polynomial_release(&r);
             break;
         }
         default:
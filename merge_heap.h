@@ -0,0 +1,61 @@
+#ifndef MERGE_HEAP_H
+#define MERGE_HEAP_H
+
+#include <stdint.h>
+
+// Binary min-heap of the sparse products. The array needs room for one entry
+// more than it ever holds, that slot is kept at UINT64_MAX as a sentinel.
+
+// heap entry of the k-way merge: the current product of row `row` (a term of
+// the shorter operand) with its next term of the longer operand, keyed by
+// exponent and then by row so equal exponents are summed in row order
+struct mul_node {
+    uint64_t key;
+};
+
+static inline uint64_t mul_key(int exp, int row) {
+    return ((uint64_t)((uint32_t)exp ^ 0x80000000u) << 32) | (uint32_t)row;
+}
+
+static inline void heap_push(struct mul_node *h, int *n, uint64_t key) {
+    int i = (*n)++;
+    h[*n].key = UINT64_MAX;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (h[parent].key <= key)
+            break;
+        h[i] = h[parent];
+        i = parent;
+    }
+    h[i].key = key;
+}
+
+// replace the minimum with key and restore the heap order
+static inline void heap_replace_top(struct mul_node *h, int n, uint64_t key) {
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        // h[n] is a sentinel, so the right child can be read unconditionally
+        child += h[child + 1].key < h[child].key;
+        if (key <= h[child].key)
+            break;
+        h[i] = h[child];
+        i = child;
+    }
+    h[i].key = key;
+}
+
+static inline void heap_pop(struct mul_node *h, int *n) {
+    --(*n);
+    heap_replace_top(h, *n, h[*n].key);
+    h[*n].key = UINT64_MAX;
+}
+
+// exponent of a key made by mul_key
+static inline int mul_key_exp(uint64_t key) {
+    return (int)((uint32_t)(key >> 32) ^ 0x80000000u);
+}
+
+#endif
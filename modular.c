@@ -0,0 +1,673 @@
+#include "modular.h"
+#include "alloc.h"
+#include "merge_heap.h"
+#include "polynomial.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned __int128 u128;
+
+// ---- Montgomery arithmetic ----
+
+// t / 2^64 mod p for t < p 2^64, in [0, p)
+static inline uint64_t redc(const struct mod_field *f, u128 t) {
+    uint64_t m = (uint64_t)t * f->pinv;
+    uint64_t r = (uint64_t)((t + (u128)m * f->p) >> 64);
+    return r >= f->p ? r - f->p : r;
+}
+
+static inline uint64_t mont_mul(const struct mod_field *f, uint64_t a,
+                                uint64_t b) {
+    return redc(f, (u128)a * b);
+}
+
+// any x below 2^64 into Montgomery form
+static inline uint64_t to_mont(const struct mod_field *f, uint64_t x) {
+    return mont_mul(f, x, f->r2);
+}
+
+static inline uint64_t from_mont(const struct mod_field *f, uint64_t x) {
+    return redc(f, x);
+}
+
+// p is below 2^62, so neither sum wraps around
+static inline uint64_t mod_plus(const struct mod_field *f, uint64_t a,
+                                uint64_t b) {
+    uint64_t s = a + b;
+    return s >= f->p ? s - f->p : s;
+}
+
+// written with a mask, compilers turn the conditional into an unpredictable
+// branch inside the transforms
+static inline uint64_t mod_minus(const struct mod_field *f, uint64_t a,
+                                 uint64_t b) {
+    return a - b + (f->p & -(uint64_t)(a < b));
+}
+
+static uint64_t mont_pow(const struct mod_field *f, uint64_t x, uint64_t k) {
+    uint64_t r = to_mont(f, 1);
+    for (; k > 0; k >>= 1) {
+        if (k & 1)
+            r = mont_mul(f, r, x);
+        x = mont_mul(f, x, x);
+    }
+    return r;
+}
+
+static void field_setup(struct mod_field *f, uint64_t p) {
+    // Newton's iteration for 1 / p mod 2^64, every step doubles the bits
+    uint64_t inv = p;
+    for (int i = 0; i < 5; ++i)
+        inv *= 2 - p * inv;
+    uint64_t r = (uint64_t)(((u128)1 << 64) % p);
+    *f = (struct mod_field){
+        .p = p, .pinv = -inv, .r2 = (uint64_t)((u128)r * r % p)};
+}
+
+// Miller-Rabin with a set of bases that is deterministic below 2^64
+static bool is_prime(const struct mod_field *f) {
+    static const uint64_t bases[] = {2,      325,     9375,      28178,
+                                     450775, 9780504, 1795265022};
+    uint64_t p = f->p, d = p - 1;
+    int s = 0;
+    for (; d % 2 == 0; d /= 2)
+        ++s;
+    uint64_t one = to_mont(f, 1), minus_one = to_mont(f, p - 1);
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); ++i) {
+        uint64_t a = bases[i] % p;
+        if (a == 0)
+            continue;
+        uint64_t x = mont_pow(f, to_mont(f, a), d);
+        if (x == one || x == minus_one)
+            continue;
+        int j = 1;
+        for (; j < s && x != minus_one; ++j)
+            x = mont_mul(f, x, x);
+        if (x != minus_one)
+            return false;
+    }
+    return true;
+}
+
+int mod_field_init(struct mod_field *f, uint64_t p) {
+    // Montgomery reduction needs an odd modulus
+    if (p < 3 || p % 2 == 0 || p >= MOD_MAX_PRIME)
+        return -1;
+    field_setup(f, p);
+    return is_prime(f) ? 0 : -1;
+}
+
+// ---- storage ----
+
+static void init_cap(struct poly_mod *p, const struct mod_field *f,
+                     int cap) {
+    p->size = 0;
+    p->cap = cap;
+    p->field = *f;
+    p->alloc = allocator_current();
+    p->terms = allocator_alloc(p->alloc, sizeof(struct mod_term) * cap);
+    assert(p->terms != NULL);
+}
+
+void mod_init(struct poly_mod *p, const struct mod_field *f) {
+    init_cap(p, f, 16);
+}
+
+void mod_release(struct poly_mod *p) {
+    allocator_release(p->alloc, p->terms, sizeof(struct mod_term) * p->cap);
+    p->terms = NULL;
+    p->size = p->cap = 0;
+}
+
+void mod_copy(struct poly_mod *dest, const struct poly_mod *src) {
+    init_cap(dest, &src->field, src->size > 16 ? src->size : 16);
+    memcpy(dest->terms, src->terms, sizeof(struct mod_term) * src->size);
+    dest->size = src->size;
+}
+
+static void terms_grow(struct poly_mod *p) {
+    int cap = p->cap < 8 ? 16 : p->cap * 2;
+    p->terms = allocator_resize(p->alloc, p->terms,
+                                sizeof(struct mod_term) * p->cap,
+                                sizeof(struct mod_term) * cap);
+    assert(p->terms != NULL);
+    p->cap = cap;
+}
+
+static inline void push(struct poly_mod *p, int exp, uint64_t coeff) {
+    if (p->size >= p->cap)
+        terms_grow(p);
+    p->terms[p->size++] = (struct mod_term){.coeff = coeff, .exp = exp};
+}
+
+// ---- input and output ----
+
+static int term_comp(const void *_a, const void *_b) {
+    const struct mod_term *a = _a, *b = _b;
+    return (a->exp > b->exp) - (a->exp < b->exp);
+}
+
+static inline const char *skip_space(const char *it, const char *end) {
+    for (; it < end && isspace((unsigned char)*it); ++it)
+        ;
+    return it;
+}
+
+int mod_parse(struct poly_mod *dest, const struct mod_field *f,
+              const char *str, size_t n, size_t *err_pos) {
+    const char *it = str, *end = str + n;
+    bool ascending = true, descending = true;
+    mod_init(dest, f);
+    for (bool first = true;; first = false) {
+        it = skip_space(it, end);
+        if (it == end)
+            break;
+
+        bool negative = false;
+        if (*it == '-' || *it == '+') {
+            negative = *it == '-';
+            it = skip_space(it + 1, end);
+        } else if (!first) {
+            goto fail; // terms are separated by a sign
+        }
+
+        // the digits are folded in one at a time, so the number may have
+        // any length
+        uint64_t coeff = 1;
+        bool has_coeff = it < end && isdigit((unsigned char)*it);
+        if (has_coeff) {
+            coeff = 0;
+            for (; it < end && isdigit((unsigned char)*it); ++it)
+                coeff = (uint64_t)(((u128)coeff * 10 + (*it - '0')) % f->p);
+        }
+        it = skip_space(it, end);
+        int exp = 0;
+        if (it < end && *it == 'x') {
+            exp = 1;
+            it = skip_space(it + 1, end);
+            if (it < end && *it == '^') {
+                it = skip_space(it + 1, end);
+                int esign = 1;
+                if (it < end && *it == '-') {
+                    esign = -1;
+                    ++it;
+                }
+                if (it == end || !isdigit((unsigned char)*it))
+                    goto fail;
+                long long v = 0;
+                for (; it < end && isdigit((unsigned char)*it); ++it) {
+                    v = v * 10 + (*it - '0');
+                    if (v > INT32_MAX)
+                        goto fail;
+                }
+                exp = (int)(esign * v);
+            }
+        } else if (!has_coeff) {
+            goto fail; // neither a number nor x
+        }
+
+        coeff = to_mont(f, coeff);
+        if (negative)
+            coeff = mod_minus(f, 0, coeff);
+        if (dest->size > 0) {
+            int last = dest->terms[dest->size - 1].exp;
+            ascending &= last < exp;
+            descending &= last > exp;
+        }
+        push(dest, exp, coeff);
+    }
+
+    struct mod_term *t = dest->terms;
+    if (descending) {
+        for (int i = 0, j = dest->size - 1; i < j; ++i, --j) {
+            struct mod_term tmp = t[i];
+            t[i] = t[j];
+            t[j] = tmp;
+        }
+    } else if (!ascending) {
+        qsort(t, dest->size, sizeof(struct mod_term), term_comp);
+    }
+    // combine like terms and drop the ones that vanish modulo p
+    int w = 0;
+    for (int i = 0; i < dest->size;) {
+        struct mod_term sum = t[i];
+        for (++i; i < dest->size && t[i].exp == sum.exp; ++i)
+            sum.coeff = mod_plus(f, sum.coeff, t[i].coeff);
+        if (sum.coeff != 0)
+            t[w++] = sum;
+    }
+    dest->size = w;
+    return 0;
+
+fail:
+    if (err_pos != NULL)
+        *err_pos = it - str;
+    mod_release(dest);
+    return -1;
+}
+
+void mod_print_fp(const struct poly_mod *p, FILE *fp) {
+    for (int i = 0; i < p->size; ++i) {
+        const struct mod_term *t = &p->terms[i];
+        uint64_t c = from_mont(&p->field, t->coeff);
+        if (i > 0)
+            fputs("+ ", fp);
+        if (c != 1 || t->exp == 0)
+            fprintf(fp, "%" PRIu64, c);
+        if (t->exp != 0)
+            fputc('x', fp);
+        if (t->exp > 1 || t->exp < 0)
+            fprintf(fp, "^%d", t->exp);
+        fputc(' ', fp);
+    }
+}
+
+uint64_t mod_get_term(const struct poly_mod *p, int exp) {
+    int lo = 0, hi = p->size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (p->terms[mid].exp < exp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < p->size && p->terms[lo].exp == exp
+               ? from_mont(&p->field, p->terms[lo].coeff)
+               : 0;
+}
+
+// Residue of an integer valued double in Montgomery form. Its mantissa is
+// an integer below 2^53, what is left is a power of two.
+static uint64_t reduce_double(const struct mod_field *f, double c) {
+    int e;
+    double m = frexp(fabs(c), &e);
+    uint64_t mant = (uint64_t)ldexp(m, 53), r;
+    if (e <= 53)
+        r = to_mont(f, mant >> (53 - e));
+    else
+        r = mont_mul(f, to_mont(f, mant),
+                     mont_pow(f, to_mont(f, 2), (uint64_t)(e - 53)));
+    return c < 0 ? mod_minus(f, 0, r) : r;
+}
+
+int mod_from_terms(struct poly_mod *dest, const struct mod_field *f,
+                   const struct polynomial *src) {
+    init_cap(dest, f, src->size > 16 ? src->size : 16);
+    for (int i = 0; i < src->size; ++i) {
+        double c = src->terms[i].coeff;
+        if (c != nearbyint(c)) {
+            mod_release(dest);
+            return -1;
+        }
+        uint64_t r = reduce_double(f, c);
+        if (r != 0)
+            dest->terms[dest->size++] =
+                (struct mod_term){.coeff = r, .exp = src->terms[i].exp};
+    }
+    return 0;
+}
+
+void mod_to_terms(struct polynomial *dest, const struct poly_mod *src) {
+    polynomial_init(dest);
+    polynomial_reserve(dest, src->size);
+    for (int i = 0; i < src->size; ++i)
+        dest->terms[i] = (struct term){
+            .coeff = (double)from_mont(&src->field, src->terms[i].coeff),
+            .exp = src->terms[i].exp};
+    dest->size = src->size;
+}
+
+// ---- addition ----
+
+static void add_signed(struct poly_mod *dest, const struct poly_mod *a,
+                       const struct poly_mod *b, bool negate) {
+    assert(a->field.p == b->field.p);
+    const struct mod_field *f = &a->field;
+    init_cap(dest, f, a->size + b->size > 16 ? a->size + b->size : 16);
+    const struct mod_term *x = a->terms, *y = b->terms;
+    struct mod_term *out = dest->terms;
+    int i = 0, j = 0, k = 0;
+    while (i < a->size || j < b->size) {
+        if (j == b->size || (i < a->size && x[i].exp < y[j].exp)) {
+            out[k++] = x[i++];
+            continue;
+        }
+        uint64_t c = negate ? mod_minus(f, 0, y[j].coeff) : y[j].coeff;
+        int exp = y[j++].exp;
+        if (i < a->size && x[i].exp == exp)
+            c = mod_plus(f, x[i++].coeff, c);
+        if (c != 0)
+            out[k++] = (struct mod_term){.coeff = c, .exp = exp};
+    }
+    dest->size = k;
+}
+
+void mod_add(struct poly_mod *dest, const struct poly_mod *a,
+             const struct poly_mod *b) {
+    add_signed(dest, a, b, false);
+}
+
+void mod_sub(struct poly_mod *dest, const struct poly_mod *a,
+             const struct poly_mod *b) {
+    add_signed(dest, a, b, true);
+}
+
+// ---- sparse product ----
+
+// the k-way merge of polynomial_mul's heap engine
+static void mul_heap(struct poly_mod *dest, const struct poly_mod *a,
+                     const struct poly_mod *b) {
+    if (a->size > b->size) {
+        const struct poly_mod *t = a;
+        a = b;
+        b = t;
+    }
+    const struct mod_field *f = &a->field;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct mul_node *heap =
+        arena_alloc(scratch, sizeof(struct mul_node) * (a->size + 1));
+    int *col = arena_alloc(scratch, sizeof(int) * a->size);
+    memset(col, 0, sizeof(int) * a->size);
+    int n = 0;
+    heap_push(heap, &n, mul_key(a->terms[0].exp + b->terms[0].exp, 0));
+    while (n > 0) {
+        int exp = mul_key_exp(heap[0].key);
+        uint64_t coeff = 0;
+        while (n > 0 && mul_key_exp(heap[0].key) == exp) {
+            int row = (int)(uint32_t)heap[0].key;
+            coeff = mod_plus(f, coeff,
+                             mont_mul(f, a->terms[row].coeff,
+                                      b->terms[col[row]].coeff));
+            if (++col[row] < b->size)
+                heap_replace_top(
+                    heap, n,
+                    mul_key(a->terms[row].exp + b->terms[col[row]].exp, row));
+            else
+                heap_pop(heap, &n);
+            if (col[row] == 1 && row + 1 < a->size)
+                heap_push(heap, &n,
+                          mul_key(a->terms[row + 1].exp + b->terms[0].exp,
+                                  row + 1));
+        }
+        if (coeff != 0)
+            push(dest, exp, coeff);
+    }
+    arena_rewind(scratch, mark);
+}
+
+// ---- number-theoretic transform ----
+
+// Primes of the form c 2^26 + 1 just below 2^62. Their product exceeds 2^185,
+// more than any coefficient of a product of residues below 2^62 with at most
+// 2^25 terms each can reach.
+static const uint64_t ntt_primes[3] = {
+    4611686017554972673u, // 0x3fffffffcc000001
+    4611686015004835841u, // 0x3fffffff34000001
+    4611686009971671041u, // 0x3ffffffe08000001
+};
+
+static inline int ceil_log2(long long n) {
+    int k = 0;
+    while ((1LL << k) < n)
+        ++k;
+    return k;
+}
+
+// whether f has a root of unity of order 2^k
+static bool has_roots(const struct mod_field *f, int k) {
+    return k < 64 && (f->p - 1) % ((uint64_t)1 << k) == 0;
+}
+
+// Twiddles of every stage of a transform of length n = 2^k, stage h (a
+// power of two) owns w[h..2h) = the powers of a root of order 2h. iw holds
+// the inverses.
+static void twiddles(const struct mod_field *f, int k, uint64_t *w,
+                     uint64_t *iw) {
+    // a quadratic non-residue has the full order 2^v of the 2-part of p - 1
+    uint64_t minus_one = to_mont(f, f->p - 1);
+    uint64_t g = 3;
+    while (mont_pow(f, to_mont(f, g), (f->p - 1) / 2) != minus_one)
+        ++g;
+    uint64_t root = mont_pow(f, to_mont(f, g), (f->p - 1) >> k);
+    long long n = 1LL << k;
+    if (n < 2)
+        return;
+    // only the top stage is computed, every stage below takes every other
+    // twiddle of the one above
+    long long h = n / 2;
+    w[h] = to_mont(f, 1);
+    for (long long j = 1; j < h; ++j)
+        w[h + j] = mont_mul(f, w[h + j - 1], root);
+    for (h /= 2; h >= 1; h /= 2)
+        for (long long j = 0; j < h; ++j)
+            w[h + j] = w[2 * (h + j)];
+    // the root of order 2h to the power h is -1, so w^-j = -w^(h - j)
+    for (h = 1; h < n; h *= 2) {
+        iw[h] = w[h];
+        for (long long j = 1; j < h; ++j)
+            iw[h + j] = mod_minus(f, 0, w[2 * h - j]);
+    }
+}
+
+// Gentleman-Sande, natural order in and bit-reversed order out
+static void ntt_forward(const struct mod_field *field, uint64_t *a,
+                        long long n, const uint64_t *w) {
+    // a local copy, which the stores into a cannot alias
+    const struct mod_field local = *field, *f = &local;
+    for (long long h = n / 2; h >= 1; h /= 2)
+        for (long long i = 0; i < n; i += 2 * h)
+            for (long long j = 0; j < h; ++j) {
+                uint64_t u = a[i + j], v = a[i + j + h];
+                a[i + j] = mod_plus(f, u, v);
+                a[i + j + h] = mont_mul(f, mod_minus(f, u, v), w[h + j]);
+            }
+}
+
+// Cooley-Tukey, bit-reversed order in and natural order out, without the
+// division by n
+static void ntt_inverse(const struct mod_field *field, uint64_t *a,
+                        long long n, const uint64_t *iw) {
+    const struct mod_field local = *field, *f = &local;
+    for (long long h = 1; h < n; h *= 2)
+        for (long long i = 0; i < n; i += 2 * h)
+            for (long long j = 0; j < h; ++j) {
+                uint64_t u = a[i + j], v = mont_mul(f, a[i + j + h], iw[h + j]);
+                a[i + j] = mod_plus(f, u, v);
+                a[i + j + h] = mod_minus(f, u, v);
+            }
+}
+
+// r = a * b modulo f, all in Montgomery form of f, r has room for n = 2^k
+// values. The bit-reversed spectra are multiplied as they are.
+static void ntt_convolve(const struct mod_field *f, uint64_t *r,
+                         const uint64_t *a, int na, const uint64_t *b, int nb,
+                         int k, struct arena *scratch) {
+    long long n = 1LL << k;
+    uint64_t *w = arena_alloc(scratch, sizeof(uint64_t) * n);
+    uint64_t *iw = arena_alloc(scratch, sizeof(uint64_t) * n);
+    uint64_t *t = arena_alloc(scratch, sizeof(uint64_t) * n);
+    twiddles(f, k, w, iw);
+    memcpy(r, a, sizeof(uint64_t) * na);
+    memset(r + na, 0, sizeof(uint64_t) * (n - na));
+    memcpy(t, b, sizeof(uint64_t) * nb);
+    memset(t + nb, 0, sizeof(uint64_t) * (n - nb));
+    ntt_forward(f, r, n, w);
+    ntt_forward(f, t, n, w);
+    for (long long i = 0; i < n; ++i)
+        r[i] = mont_mul(f, r[i], t[i]);
+    ntt_inverse(f, r, n, iw);
+    uint64_t scale = mont_pow(f, to_mont(f, (f->p + 1) / 2), k);
+    for (long long i = 0; i < n; ++i)
+        r[i] = mont_mul(f, r[i], scale);
+}
+
+// Convolve canonical residues modulo the three transform primes and rebuild
+// every coefficient modulo f with Garner's algorithm. r gets the results in
+// Montgomery form of f.
+static void ntt_convolve_crt(const struct mod_field *f, uint64_t *r,
+                             const uint64_t *a, int na, const uint64_t *b,
+                             int nb, int k, struct arena *scratch) {
+    long long n = 1LL << k;
+    struct mod_field q[3];
+    uint64_t *res[3];
+    uint64_t *x = arena_alloc(scratch, sizeof(uint64_t) * na);
+    uint64_t *y = arena_alloc(scratch, sizeof(uint64_t) * nb);
+    for (int i = 0; i < 3; ++i) {
+        field_setup(&q[i], ntt_primes[i]);
+        // every residue is below 2^62, to_mont reduces it on the way
+        for (int j = 0; j < na; ++j)
+            x[j] = to_mont(&q[i], a[j]);
+        for (int j = 0; j < nb; ++j)
+            y[j] = to_mont(&q[i], b[j]);
+        res[i] = arena_alloc(scratch, sizeof(uint64_t) * n);
+        ntt_convolve(&q[i], res[i], x, na, y, nb, k, scratch);
+    }
+    // x = r0 + q0 (t1 + q1 t2) with t1 = (r1 - r0) / q0 mod q1 and
+    // t2 = (r2 - r0 - q0 t1) / (q0 q1) mod q2
+    uint64_t q0_in_1 = to_mont(&q[1], ntt_primes[0]);
+    uint64_t inv1 = mont_pow(&q[1], q0_in_1, ntt_primes[1] - 2);
+    uint64_t q0_in_2 = to_mont(&q[2], ntt_primes[0]);
+    uint64_t q01_in_2 = mont_mul(&q[2], q0_in_2, to_mont(&q[2], ntt_primes[1]));
+    uint64_t inv2 = mont_pow(&q[2], q01_in_2, ntt_primes[2] - 2);
+    // q0 and q0 q1 modulo p, times 2^128 so that a product with a plain
+    // number comes out in Montgomery form
+    uint64_t c0 = to_mont(f, to_mont(f, ntt_primes[0]));
+    uint64_t c01 = mont_mul(f, c0, to_mont(f, ntt_primes[1]));
+    for (long long i = 0; i < na + nb - 1; ++i) {
+        uint64_t r0 = from_mont(&q[0], res[0][i]);
+        uint64_t r1 = res[1][i], r2 = res[2][i];
+        uint64_t t1 = from_mont(
+            &q[1],
+            mont_mul(&q[1], mod_minus(&q[1], r1, to_mont(&q[1], r0)), inv1));
+        uint64_t s = mod_minus(&q[2], r2, to_mont(&q[2], r0));
+        s = mod_minus(&q[2], s, mont_mul(&q[2], q0_in_2, to_mont(&q[2], t1)));
+        uint64_t t2 = from_mont(&q[2], mont_mul(&q[2], s, inv2));
+        r[i] = mod_plus(f, to_mont(f, r0),
+                        mod_plus(f, mont_mul(f, c0, t1),
+                                 mont_mul(f, c01, t2)));
+    }
+}
+
+static inline long long span(const struct poly_mod *p) {
+    return (long long)p->terms[p->size - 1].exp - p->terms[0].exp + 1;
+}
+
+static void mul_ntt(struct poly_mod *dest, const struct poly_mod *a,
+                    const struct poly_mod *b) {
+    const struct mod_field *f = &a->field;
+    int na = span(a), nb = span(b), nr = na + nb - 1, k = ceil_log2(nr);
+    bool direct = has_roots(f, k);
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    uint64_t *da = arena_alloc(scratch, sizeof(uint64_t) * na);
+    uint64_t *db = arena_alloc(scratch, sizeof(uint64_t) * nb);
+    uint64_t *r = arena_alloc(scratch, sizeof(uint64_t) * (1LL << k));
+    memset(da, 0, sizeof(uint64_t) * na);
+    memset(db, 0, sizeof(uint64_t) * nb);
+    // the direct transform works on Montgomery form, the CRT one on the
+    // residues themselves
+    for (int i = 0; i < a->size; ++i)
+        da[a->terms[i].exp - a->terms[0].exp] =
+            direct ? a->terms[i].coeff : from_mont(f, a->terms[i].coeff);
+    for (int i = 0; i < b->size; ++i)
+        db[b->terms[i].exp - b->terms[0].exp] =
+            direct ? b->terms[i].coeff : from_mont(f, b->terms[i].coeff);
+    if (direct)
+        ntt_convolve(f, r, da, na, db, nb, k, scratch);
+    else
+        ntt_convolve_crt(f, r, da, na, db, nb, k, scratch);
+    int offset = a->terms[0].exp + b->terms[0].exp, count = 0;
+    for (int i = 0; i < nr; ++i)
+        count += r[i] != 0;
+    mod_release(dest);
+    init_cap(dest, f, count > 16 ? count : 16);
+    for (int i = 0; i < nr; ++i)
+        if (r[i] != 0)
+            dest->terms[dest->size++] =
+                (struct mod_term){.coeff = r[i], .exp = offset + i};
+    arena_rewind(scratch, mark);
+}
+
+// ---- product ----
+
+static inline double log2_at_least_1(double x) {
+    return x > 2 ? log2(x) : 1;
+}
+
+// Estimated costs in ns, as for polynomial_mul_select; na and nb are term
+// counts for the heap and spans for the transforms.
+static double cost_heap(double na, double nb) {
+    return 4.0 * na * nb * log2_at_least_1(na < nb ? na : nb);
+}
+
+static double cost_ntt(double na, double nb, bool direct) {
+    double n = exp2(ceil_log2((long long)(na + nb - 1)));
+    // three transforms of n log n / 2 butterflies per prime
+    return (direct ? 1 : 3) * 7.0 * n * log2_at_least_1(n) + 2.0 * n;
+}
+
+// whether exponents from lo to hi all fit in an int
+static inline bool exps_fit(long long lo, long long hi) {
+    return lo >= INT_MIN && hi <= INT_MAX;
+}
+
+int mod_mul(struct poly_mod *dest, const struct poly_mod *a,
+            const struct poly_mod *b) {
+    assert(a->field.p == b->field.p);
+    mod_init(dest, &a->field);
+    if (a->size == 0 || b->size == 0)
+        return 0;
+    if (!exps_fit((long long)a->terms[0].exp + b->terms[0].exp,
+                  (long long)a->terms[a->size - 1].exp +
+                      b->terms[b->size - 1].exp)) {
+        mod_release(dest);
+        return -1;
+    }
+    long long nr = span(a) + span(b) - 1;
+    if (nr <= POLY_DENSE_MAX_SPAN &&
+        cost_ntt(span(a), span(b), has_roots(&a->field, ceil_log2(nr))) <
+            cost_heap(a->size, b->size))
+        mul_ntt(dest, a, b);
+    else
+        mul_heap(dest, a, b);
+    return 0;
+}
+
+int mod_pow(struct poly_mod *dest, const struct poly_mod *p, unsigned k) {
+    if (k == 0) {
+        mod_init(dest, &p->field);
+        push(dest, 0, to_mont(&p->field, 1));
+        return 0;
+    }
+    // every exponent on the way lies between k times the lowest and k times
+    // the highest exponent of p, so no product below can fail
+    if (p->size > 0 && !exps_fit((long long)k * p->terms[0].exp,
+                                 (long long)k * p->terms[p->size - 1].exp)) {
+        mod_init(dest, &p->field);
+        mod_release(dest);
+        return -1;
+    }
+    // left to right from below the top bit, p is only ever multiplied in
+    mod_copy(dest, p);
+    struct poly_mod t;
+    for (unsigned bit = (1u << (31 - __builtin_clz(k))) >> 1; bit > 0;
+         bit >>= 1) {
+        mod_mul(&t, dest, dest);
+        mod_release(dest);
+        *dest = t;
+        if (k & bit) {
+            mod_mul(&t, dest, p);
+            mod_release(dest);
+            *dest = t;
+        }
+    }
+    return 0;
+}
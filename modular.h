@@ -0,0 +1,78 @@
+#ifndef MODULAR_H
+#define MODULAR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Polynomials over the integers modulo a prime p < 2^62, for exact integer
+// work where double coefficients would round. Coefficients are kept in
+// Montgomery form (x 2^64 mod p), so a product of two of them takes a single
+// reduction without any division; they are converted back on output.
+//
+// Dense products go through number-theoretic transforms: directly modulo p
+// when p - 1 has enough factors of two for the length, otherwise modulo three
+// fixed transform primes whose results are joined by the Chinese remainder
+// theorem. Either way the result is exact.
+#define MOD_MAX_PRIME ((uint64_t)1 << 62)
+
+struct allocator;
+struct polynomial;
+
+struct mod_field {
+    uint64_t p;
+    uint64_t pinv; // -1 / p mod 2^64
+    uint64_t r2;   // 2^128 mod p, turns residues into Montgomery form
+};
+
+struct mod_term {
+    uint64_t coeff; // in Montgomery form, never 0
+    int exp;
+};
+
+struct poly_mod {
+    int size, cap;
+    struct mod_term *terms;
+    struct mod_field field;
+    // owner of terms, the allocator current at mod_init
+    const struct allocator *alloc;
+};
+
+// returns 0, or -1 if p is not an odd prime below MOD_MAX_PRIME
+int mod_field_init(struct mod_field *, uint64_t p);
+
+void mod_init(struct poly_mod *, const struct mod_field *);
+void mod_release(struct poly_mod *);
+void mod_copy(struct poly_mod *dest, const struct poly_mod *src);
+
+// Parse like polynomial_parse, coefficients are integers of any length and
+// get reduced modulo p. dest gets initialized. Returns 0, or -1 with the
+// offset of the offending character stored in err_pos (if not NULL) and dest
+// left released.
+int mod_parse(struct poly_mod *dest, const struct mod_field *,
+              const char *str, size_t n, size_t *err_pos);
+// coefficients are printed as their residues in [0, p)
+void mod_print_fp(const struct poly_mod *, FILE *fp);
+
+// residue of the coefficient of x^exp in [0, p)
+uint64_t mod_get_term(const struct poly_mod *, int exp);
+
+// Reduce a polynomial with integer coefficients, dest gets initialized.
+// Returns 0, or -1 if a coefficient is not an integer, leaving dest released.
+int mod_from_terms(struct poly_mod *dest, const struct mod_field *,
+                   const struct polynomial *src);
+// residues as doubles, exact as long as p is below 2^53
+void mod_to_terms(struct polynomial *dest, const struct poly_mod *src);
+
+// dest = a + b, a - b, a * b and p^k, dest gets initialized. The operands
+// must share their modulus. mod_mul and mod_pow return -1, leaving dest
+// released, if an exponent of the result does not fit in an int.
+void mod_add(struct poly_mod *dest, const struct poly_mod *a,
+             const struct poly_mod *b);
+void mod_sub(struct poly_mod *dest, const struct poly_mod *a,
+             const struct poly_mod *b);
+int mod_mul(struct poly_mod *dest, const struct poly_mod *a,
+            const struct poly_mod *b);
+int mod_pow(struct poly_mod *dest, const struct poly_mod *p, unsigned k);
+
+#endif
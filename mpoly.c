@@ -0,0 +1,385 @@
+#include "mpoly.h"
+#include "alloc.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+int mpoly_ring_init(struct mpoly_ring *r, const char *vars) {
+    int n = (int)strlen(vars);
+    if (n < 1 || n > MPOLY_MAX_VARS)
+        return -1;
+    for (int i = 0; i < n; ++i)
+        if (!islower((unsigned char)vars[i]) || strchr(vars + i + 1, vars[i]))
+            return -1;
+    memset(r, 0, sizeof(*r));
+    r->nvars = n;
+    // wider fields would hold exponents beyond int
+    r->bits = n > 1 ? 64 / n : 32;
+    memcpy(r->vars, vars, n);
+    for (int i = 0; i < n; ++i)
+        r->guard |= (uint64_t)1 << ((n - 1 - i) * r->bits + r->bits - 1);
+    return 0;
+}
+
+static inline int shift_of(const struct mpoly_ring *r, int var) {
+    return (r->nvars - 1 - var) * r->bits;
+}
+
+int mpoly_pack(const struct mpoly_ring *r, const int *exps, uint64_t *mono) {
+    uint64_t m = 0;
+    for (int i = 0; i < r->nvars; ++i) {
+        if (exps[i] < 0 || exps[i] > mpoly_max_exp(r))
+            return -1;
+        m |= (uint64_t)exps[i] << shift_of(r, i);
+    }
+    *mono = m;
+    return 0;
+}
+
+void mpoly_unpack(const struct mpoly_ring *r, uint64_t mono, int *exps) {
+    uint64_t mask = ((uint64_t)1 << r->bits) - 1;
+    for (int i = 0; i < r->nvars; ++i)
+        exps[i] = (int)((mono >> shift_of(r, i)) & mask);
+}
+
+// ---- storage ----
+
+static void init_cap(struct mpoly *p, const struct mpoly_ring *r, int cap) {
+    p->size = 0;
+    p->cap = cap;
+    p->ring = *r;
+    p->alloc = allocator_current();
+    p->terms = allocator_alloc(p->alloc, sizeof(struct mpoly_term) * cap);
+    assert(p->terms != NULL);
+}
+
+void mpoly_init(struct mpoly *p, const struct mpoly_ring *r) {
+    init_cap(p, r, 16);
+}
+
+void mpoly_release(struct mpoly *p) {
+    allocator_release(p->alloc, p->terms,
+                      sizeof(struct mpoly_term) * p->cap);
+    p->terms = NULL;
+    p->size = p->cap = 0;
+}
+
+void mpoly_copy(struct mpoly *dest, const struct mpoly *src) {
+    init_cap(dest, &src->ring, src->size > 16 ? src->size : 16);
+    memcpy(dest->terms, src->terms, sizeof(struct mpoly_term) * src->size);
+    dest->size = src->size;
+}
+
+static inline void push(struct mpoly *p, uint64_t mono, double coeff) {
+    if (p->size >= p->cap) {
+        int cap = p->cap < 8 ? 16 : p->cap * 2;
+        p->terms = allocator_resize(p->alloc, p->terms,
+                                    sizeof(struct mpoly_term) * p->cap,
+                                    sizeof(struct mpoly_term) * cap);
+        assert(p->terms != NULL);
+        p->cap = cap;
+    }
+    p->terms[p->size++] = (struct mpoly_term){.coeff = coeff, .mono = mono};
+}
+
+// ---- input and output ----
+
+static int term_comp(const void *_a, const void *_b) {
+    const struct mpoly_term *a = _a, *b = _b;
+    return (a->mono > b->mono) - (a->mono < b->mono);
+}
+
+static inline const char *skip_space(const char *it, const char *end) {
+    for (; it < end && isspace((unsigned char)*it); ++it)
+        ;
+    return it;
+}
+
+// Scan an unsigned decimal number ("12", "1.5", "2e-3") from [*it, end)
+// through strtod on a stack copy. Returns false if there is none.
+static bool scan_number(const char **it, const char *end, double *out) {
+    const char *s = *it;
+    bool any = false;
+    for (; s < end && isdigit((unsigned char)*s); ++s)
+        any = true;
+    if (s < end && *s == '.')
+        for (++s; s < end && isdigit((unsigned char)*s); ++s)
+            any = true;
+    if (!any)
+        return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        if (e < end && (*e == '+' || *e == '-'))
+            ++e;
+        if (e < end && isdigit((unsigned char)*e)) {
+            for (; e < end && isdigit((unsigned char)*e); ++e)
+                ;
+            s = e;
+        }
+    }
+    char buf[128];
+    size_t len = s - *it;
+    if (len >= sizeof(buf))
+        return false;
+    memcpy(buf, *it, len);
+    buf[len] = 0;
+    *out = strtod(buf, NULL);
+    *it = s;
+    return true;
+}
+
+int mpoly_parse(struct mpoly *dest, const struct mpoly_ring *r,
+                const char *str, size_t n, size_t *err_pos) {
+    const char *it = str, *end = str + n;
+    mpoly_init(dest, r);
+    for (bool first = true;; first = false) {
+        it = skip_space(it, end);
+        if (it == end)
+            break;
+
+        double sign = 1;
+        if (*it == '-' || *it == '+') {
+            sign = *it == '-' ? -1 : 1;
+            it = skip_space(it + 1, end);
+        } else if (!first) {
+            goto fail; // terms are separated by a sign
+        }
+
+        double coeff = 1;
+        bool has_coeff = scan_number(&it, end, &coeff);
+        int exps[MPOLY_MAX_VARS] = {0}, factors = 0;
+        for (;; ++factors) {
+            it = skip_space(it, end);
+            const char *at = it;
+            if ((has_coeff || factors > 0) && it < end && *it == '*')
+                it = skip_space(it + 1, end);
+            const char *var = it < end && islower((unsigned char)*it)
+                                  ? memchr(r->vars, *it, r->nvars)
+                                  : NULL;
+            if (var == NULL) {
+                if (it != at)
+                    goto fail; // a '*' needs a factor after it
+                break;
+            }
+            long long e = 1;
+            it = skip_space(it + 1, end);
+            if (it < end && *it == '^') {
+                it = skip_space(it + 1, end);
+                if (it == end || !isdigit((unsigned char)*it))
+                    goto fail;
+                for (e = 0; it < end && isdigit((unsigned char)*it); ++it) {
+                    e = e * 10 + (*it - '0');
+                    if (e > INT32_MAX)
+                        goto fail;
+                }
+            }
+            e += exps[var - r->vars];
+            if (e > mpoly_max_exp(r))
+                goto fail;
+            exps[var - r->vars] = (int)e;
+        }
+        if (!has_coeff && factors == 0)
+            goto fail; // neither a number nor a variable
+        uint64_t mono = 0;
+        mpoly_pack(r, exps, &mono); // the exponents are in range
+        push(dest, mono, sign * coeff);
+    }
+
+    qsort(dest->terms, dest->size, sizeof(struct mpoly_term), term_comp);
+    // combine like terms in place and drop the ones that cancel
+    struct mpoly_term *t = dest->terms;
+    int w = 0;
+    for (int i = 0; i < dest->size;) {
+        struct mpoly_term sum = t[i];
+        for (++i; i < dest->size && t[i].mono == sum.mono; ++i)
+            sum.coeff += t[i].coeff;
+        if (sum.coeff != 0)
+            t[w++] = sum;
+    }
+    dest->size = w;
+    return 0;
+
+fail:
+    if (err_pos != NULL)
+        *err_pos = it - str;
+    mpoly_release(dest);
+    return -1;
+}
+
+void mpoly_print_fp(const struct mpoly *p, FILE *fp) {
+    const struct mpoly_ring *r = &p->ring;
+    for (int i = 0; i < p->size; ++i) {
+        const struct mpoly_term *t = &p->terms[i];
+        if (i > 0)
+            fprintf(fp, "%c ", "-+"[t->coeff > 0]);
+        double c = i > 0 ? fabs(t->coeff) : t->coeff;
+        if (fabs(c) != 1 || t->mono == 0)
+            fprintf(fp, "%lg", c);
+        else if (c == -1)
+            fputc('-', fp);
+        int exps[MPOLY_MAX_VARS];
+        mpoly_unpack(r, t->mono, exps);
+        for (int v = 0; v < r->nvars; ++v) {
+            if (exps[v] > 0)
+                fputc(r->vars[v], fp);
+            if (exps[v] > 1)
+                fprintf(fp, "^%d", exps[v]);
+        }
+        fputc(' ', fp);
+    }
+}
+
+double mpoly_get_term(const struct mpoly *p, uint64_t mono) {
+    int lo = 0, hi = p->size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (p->terms[mid].mono < mono)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < p->size && p->terms[lo].mono == mono ? p->terms[lo].coeff : 0;
+}
+
+// ---- arithmetic ----
+
+static void add_signed(struct mpoly *dest, const struct mpoly *a,
+                       const struct mpoly *b, double sign) {
+    assert(a->ring.nvars == b->ring.nvars &&
+           !memcmp(a->ring.vars, b->ring.vars, a->ring.nvars));
+    init_cap(dest, &a->ring, a->size + b->size > 16 ? a->size + b->size : 16);
+    const struct mpoly_term *x = a->terms, *y = b->terms;
+    struct mpoly_term *out = dest->terms;
+    int i = 0, j = 0, k = 0;
+    while (i < a->size && j < b->size) {
+        if (x[i].mono == y[j].mono) {
+            double coeff = x[i].coeff + sign * y[j].coeff;
+            if (coeff != 0)
+                out[k++] = (struct mpoly_term){.coeff = coeff,
+                                               .mono = x[i].mono};
+            ++i;
+            ++j;
+        } else if (x[i].mono < y[j].mono) {
+            out[k++] = x[i++];
+        } else {
+            out[k++] = (struct mpoly_term){.coeff = sign * y[j].coeff,
+                                           .mono = y[j].mono};
+            ++j;
+        }
+    }
+    for (; i < a->size; ++i)
+        out[k++] = x[i];
+    for (; j < b->size; ++j)
+        out[k++] = (struct mpoly_term){.coeff = sign * y[j].coeff,
+                                       .mono = y[j].mono};
+    dest->size = k;
+}
+
+void mpoly_add(struct mpoly *dest, const struct mpoly *a,
+               const struct mpoly *b) {
+    add_signed(dest, a, b, 1);
+}
+
+void mpoly_sub(struct mpoly *dest, const struct mpoly *a,
+               const struct mpoly *b) {
+    add_signed(dest, a, b, -1);
+}
+
+// A monomial takes the whole key, so the heap entries carry the row next to
+// it; ties go to the lower row, for the summation order of polynomial_mul.
+struct mono_node {
+    uint64_t mono;
+    int row;
+};
+
+static inline bool node_less(struct mono_node x, struct mono_node y) {
+    return x.mono < y.mono || (x.mono == y.mono && x.row < y.row);
+}
+
+static void node_push(struct mono_node *h, int *n, struct mono_node x) {
+    int i = (*n)++;
+    while (i > 0 && node_less(x, h[(i - 1) / 2])) {
+        h[i] = h[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h[i] = x;
+}
+
+static void node_replace_top(struct mono_node *h, int n, struct mono_node x) {
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && node_less(h[child + 1], h[child]))
+            ++child;
+        if (!node_less(h[child], x))
+            break;
+        h[i] = h[child];
+        i = child;
+    }
+    h[i] = x;
+}
+
+static inline void node_pop(struct mono_node *h, int *n) {
+    --(*n);
+    node_replace_top(h, *n, h[*n]);
+}
+
+// The k-way merge of polynomial_mul's heap engine. Every product goes into
+// seen, a guard bit set there means some exponent overflowed its field.
+int mpoly_mul(struct mpoly *dest, const struct mpoly *a,
+              const struct mpoly *b) {
+    assert(a->ring.nvars == b->ring.nvars &&
+           !memcmp(a->ring.vars, b->ring.vars, a->ring.nvars));
+    mpoly_init(dest, &a->ring);
+    if (a->size == 0 || b->size == 0)
+        return 0;
+    if (a->size > b->size) {
+        const struct mpoly *t = a;
+        a = b;
+        b = t;
+    }
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct mono_node *heap =
+        arena_alloc(scratch, sizeof(struct mono_node) * a->size);
+    int *col = arena_alloc(scratch, sizeof(int) * a->size);
+    memset(col, 0, sizeof(int) * a->size);
+    const struct mpoly_term *x = a->terms, *y = b->terms;
+    uint64_t seen = 0;
+    int n = 0;
+    node_push(heap, &n, (struct mono_node){x[0].mono + y[0].mono, 0});
+    while (n > 0) {
+        uint64_t mono = heap[0].mono;
+        double coeff = 0;
+        seen |= mono;
+        while (n > 0 && heap[0].mono == mono) {
+            int row = heap[0].row;
+            coeff += x[row].coeff * y[col[row]].coeff;
+            if (++col[row] < b->size)
+                node_replace_top(heap, n,
+                                 (struct mono_node){
+                                     x[row].mono + y[col[row]].mono, row});
+            else
+                node_pop(heap, &n);
+            // Johnson's lazy insertion, as in mul_heap
+            if (col[row] == 1 && row + 1 < a->size)
+                node_push(heap, &n,
+                          (struct mono_node){x[row + 1].mono + y[0].mono,
+                                             row + 1});
+        }
+        if (coeff != 0)
+            push(dest, mono, coeff);
+    }
+    arena_rewind(scratch, mark);
+    if (seen & a->ring.guard) {
+        mpoly_release(dest);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef MPOLY_H
+#define MPOLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Sparse multivariate polynomials in up to MPOLY_MAX_VARS variables, named by
+// single lowercase letters. A monomial packs the exponent vector into one
+// 64-bit word: every variable owns a field of 64 / nvars bits (32 for a
+// single one), the first variable the most significant one. So monomials
+// compare as integers (in lexicographic order) and multiply by integer
+// addition.
+//
+// The top bit of every field is a guard that no exponent may use. A sum of
+// two valid monomials never carries into the next field, an exponent that
+// overflows shows up in its guard bit instead, which multiplication checks
+// once for all products.
+#define MPOLY_MAX_VARS 8
+
+struct allocator;
+
+struct mpoly_ring {
+    int nvars;
+    int bits; // per variable, guard bit included
+    char vars[MPOLY_MAX_VARS + 1];
+    uint64_t guard; // the guard bits of all fields
+};
+
+struct mpoly_term {
+    double coeff;
+    uint64_t mono;
+};
+
+// terms sorted by ascending monomial, as in struct polynomial
+struct mpoly {
+    int size, cap;
+    struct mpoly_term *terms;
+    struct mpoly_ring ring;
+    // owner of terms, the allocator current at mpoly_init
+    const struct allocator *alloc;
+};
+
+// vars lists the variables, most significant first ("xyz"). Returns 0, or
+// -1 unless they are 1 to MPOLY_MAX_VARS distinct lowercase letters.
+int mpoly_ring_init(struct mpoly_ring *, const char *vars);
+// largest exponent a variable may have
+static inline int mpoly_max_exp(const struct mpoly_ring *r) {
+    return (int)((1u << (r->bits - 1)) - 1);
+}
+// Pack exps[0..nvars) into *mono, returns -1 if one is out of range
+int mpoly_pack(const struct mpoly_ring *, const int *exps, uint64_t *mono);
+void mpoly_unpack(const struct mpoly_ring *, uint64_t mono, int *exps);
+
+void mpoly_init(struct mpoly *, const struct mpoly_ring *);
+void mpoly_release(struct mpoly *);
+void mpoly_copy(struct mpoly *dest, const struct mpoly *src);
+
+// Parse terms like "3x^2y - z + 0.5", factors may be separated by '*' and a
+// variable may repeat. dest gets initialized. Returns 0, or -1 with the
+// offset of the offending character stored in err_pos (if not NULL) and dest
+// left released.
+int mpoly_parse(struct mpoly *dest, const struct mpoly_ring *,
+                const char *str, size_t n, size_t *err_pos);
+void mpoly_print_fp(const struct mpoly *, FILE *fp);
+
+double mpoly_get_term(const struct mpoly *, uint64_t mono);
+
+// dest = a + b, a - b and a * b, dest gets initialized. The operands must
+// share their ring. mpoly_mul returns -1, leaving dest released, if an
+// exponent of the product does not fit its field.
+void mpoly_add(struct mpoly *dest, const struct mpoly *a,
+               const struct mpoly *b);
+void mpoly_sub(struct mpoly *dest, const struct mpoly *a,
+               const struct mpoly *b);
+int mpoly_mul(struct mpoly *dest, const struct mpoly *a,
+              const struct mpoly *b);
+
+#endif
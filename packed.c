@@ -0,0 +1,272 @@
+#include "packed.h"
+#include "alloc.h"
+#include "merge_heap.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+// a gap of up to 32 bits takes at most 5 bytes
+#define PACKED_MAX_VARINT 5
+
+static inline size_t skip_cap(int cap) { return cap / PACKED_BLOCK + 1; }
+
+static void init_cap(struct poly_packed *p, int cap, size_t bytes_cap) {
+    p->size = 0;
+    p->cap = cap;
+    p->last_exp = 0;
+    p->nbytes = 0;
+    p->bytes_cap = bytes_cap;
+    p->alloc = allocator_current();
+    p->coeff = allocator_alloc(p->alloc, sizeof(double) * cap);
+    p->bytes = allocator_alloc(p->alloc, bytes_cap);
+    p->skip =
+        allocator_alloc(p->alloc, sizeof(struct packed_skip) * skip_cap(cap));
+    assert(p->coeff != NULL && p->bytes != NULL && p->skip != NULL);
+}
+
+void packed_init(struct poly_packed *p) { init_cap(p, 16, 64); }
+
+void packed_release(struct poly_packed *p) {
+    allocator_release(p->alloc, p->coeff, sizeof(double) * p->cap);
+    allocator_release(p->alloc, p->bytes, p->bytes_cap);
+    allocator_release(p->alloc, p->skip,
+                      sizeof(struct packed_skip) * skip_cap(p->cap));
+    p->coeff = NULL;
+    p->bytes = NULL;
+    p->skip = NULL;
+    p->size = p->cap = 0;
+    p->nbytes = p->bytes_cap = 0;
+}
+
+static void resize_terms(struct poly_packed *p, int cap) {
+    p->coeff = allocator_resize(p->alloc, p->coeff, sizeof(double) * p->cap,
+                                sizeof(double) * cap);
+    p->skip = allocator_resize(p->alloc, p->skip,
+                               sizeof(struct packed_skip) * skip_cap(p->cap),
+                               sizeof(struct packed_skip) * skip_cap(cap));
+    assert(p->coeff != NULL && p->skip != NULL);
+    p->cap = cap;
+}
+
+static void resize_bytes(struct poly_packed *p, size_t cap) {
+    p->bytes = allocator_resize(p->alloc, p->bytes, p->bytes_cap, cap);
+    assert(p->bytes != NULL);
+    p->bytes_cap = cap;
+}
+
+void packed_push(struct poly_packed *p, int exp, double coeff) {
+    if (p->size == p->cap)
+        resize_terms(p, p->cap * 2);
+    if (p->size % PACKED_BLOCK == 0) {
+        p->skip[p->size / PACKED_BLOCK] =
+            (struct packed_skip){.first_exp = exp, .offset = p->nbytes};
+    } else {
+        if (p->bytes_cap - p->nbytes < PACKED_MAX_VARINT) {
+            // after packed_shrink doubling may not make room for a varint
+            size_t cap = p->bytes_cap * 2;
+            if (cap < p->nbytes + PACKED_MAX_VARINT)
+                cap = p->nbytes + PACKED_MAX_VARINT;
+            resize_bytes(p, cap);
+        }
+        unsigned gap = (unsigned)exp - (unsigned)p->last_exp;
+        for (; gap >= 0x80; gap >>= 7)
+            p->bytes[p->nbytes++] = (unsigned char)(gap | 0x80);
+        p->bytes[p->nbytes++] = (unsigned char)gap;
+    }
+    p->coeff[p->size++] = coeff;
+    p->last_exp = exp;
+}
+
+void packed_shrink(struct poly_packed *p) {
+    int cap = p->size > 0 ? p->size : 1;
+    if (cap < p->cap)
+        resize_terms(p, cap);
+    size_t bytes_cap = p->nbytes > 0 ? p->nbytes : 1;
+    if (bytes_cap < p->bytes_cap)
+        resize_bytes(p, bytes_cap);
+}
+
+size_t packed_bytes(const struct poly_packed *p) {
+    return sizeof(double) * p->cap + p->bytes_cap +
+           sizeof(struct packed_skip) * skip_cap(p->cap);
+}
+
+static inline size_t varint_len(unsigned v) {
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7)
+        ++n;
+    return n;
+}
+
+void packed_from_terms(struct poly_packed *dest,
+                       const struct polynomial *src) {
+    // size the arrays exactly, a packed polynomial is usually kept for long
+    int n = 0, prev = 0;
+    size_t bytes = 0;
+    for (int i = 0; i < src->size; ++i) {
+        if (src->terms[i].coeff == 0)
+            continue;
+        if (n++ % PACKED_BLOCK != 0)
+            bytes += varint_len((unsigned)src->terms[i].exp - (unsigned)prev);
+        prev = src->terms[i].exp;
+    }
+    init_cap(dest, n > 0 ? n : 1, bytes + PACKED_MAX_VARINT);
+    for (int i = 0; i < src->size; ++i)
+        if (src->terms[i].coeff != 0)
+            packed_push(dest, src->terms[i].exp, src->terms[i].coeff);
+}
+
+void packed_to_terms(struct polynomial *dest, const struct poly_packed *src) {
+    polynomial_init(dest);
+    polynomial_reserve(dest, src->size);
+    struct packed_cursor c;
+    packed_begin(&c, src);
+    while (packed_next(&c, &dest->terms[dest->size]))
+        dest->size++;
+}
+
+static inline int blocks(const struct poly_packed *p) {
+    return (p->size + PACKED_BLOCK - 1) / PACKED_BLOCK;
+}
+
+void packed_seek(struct packed_cursor *c, int exp) {
+    const struct poly_packed *p = c->p;
+    // last block starting at or below exp, the term may still be in it
+    int lo = 0, hi = blocks(p);
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        if (p->skip[mid].first_exp <= exp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    packed_begin(c, p);
+    if (hi == 0)
+        return;
+    c->i = lo * PACKED_BLOCK;
+    c->pos = p->skip[lo].offset;
+    struct packed_cursor at = *c;
+    struct term t;
+    while (packed_next(c, &t) && t.exp < exp)
+        at = *c;
+    *c = at;
+}
+
+double packed_get_term(const struct poly_packed *p, int exp) {
+    struct packed_cursor c;
+    struct term t;
+    packed_begin(&c, p);
+    packed_seek(&c, exp);
+    return packed_next(&c, &t) && t.exp == exp ? t.coeff : 0;
+}
+
+static void add_signed(struct poly_packed *dest, const struct poly_packed *a,
+                       const struct poly_packed *b, double sign) {
+    // A gap of the sum is never wider than the gap the term had in its
+    // operand, only the first terms of blocks need room of their own
+    init_cap(dest, a->size + b->size > 0 ? a->size + b->size : 1,
+             a->nbytes + b->nbytes +
+                 PACKED_MAX_VARINT * (blocks(a) + blocks(b) + 1));
+    struct packed_cursor ca, cb;
+    struct term x = {0}, y = {0};
+    packed_begin(&ca, a);
+    packed_begin(&cb, b);
+    bool has_x = packed_next(&ca, &x), has_y = packed_next(&cb, &y);
+    while (has_x || has_y) {
+        if (!has_y || (has_x && x.exp < y.exp)) {
+            packed_push(dest, x.exp, x.coeff);
+            has_x = packed_next(&ca, &x);
+        } else if (!has_x || y.exp < x.exp) {
+            packed_push(dest, y.exp, sign * y.coeff);
+            has_y = packed_next(&cb, &y);
+        } else {
+            double coeff = x.coeff + sign * y.coeff;
+            if (coeff != 0)
+                packed_push(dest, x.exp, coeff);
+            has_x = packed_next(&ca, &x);
+            has_y = packed_next(&cb, &y);
+        }
+    }
+    packed_shrink(dest);
+}
+
+void packed_add(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b) {
+    add_signed(dest, a, b, 1);
+}
+
+void packed_sub(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b) {
+    add_signed(dest, a, b, -1);
+}
+
+// The k-way merge of polynomial_mul's sparse engine. Rows are the terms of
+// the shorter operand, decoded into scratch; each row walks the longer one
+// with its own cursor, so that one is never unpacked.
+void packed_mul(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b) {
+    packed_init(dest);
+    if (a->size == 0 || b->size == 0)
+        return;
+    if (a->size > b->size) {
+        const struct poly_packed *t = a;
+        a = b;
+        b = t;
+    }
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct mul_node *heap =
+        arena_alloc(scratch, sizeof(struct mul_node) * (a->size + 1));
+    struct term *rows = arena_alloc(scratch, sizeof(struct term) * a->size);
+    // cursor of each row into b and the term of b it is at
+    struct packed_cursor *col =
+        arena_alloc(scratch, sizeof(struct packed_cursor) * a->size);
+    struct term *cur = arena_alloc(scratch, sizeof(struct term) * a->size);
+    struct packed_cursor c;
+    packed_begin(&c, a);
+    for (int i = 0; packed_next(&c, &rows[i]); ++i)
+        ;
+    int n = 0;
+    packed_begin(&col[0], b);
+    packed_next(&col[0], &cur[0]);
+    heap_push(heap, &n, mul_key(rows[0].exp + cur[0].exp, 0));
+    while (n > 0) {
+        int exp = mul_key_exp(heap[0].key);
+        double coeff = 0;
+        while (n > 0 && mul_key_exp(heap[0].key) == exp) {
+            int row = (int)(uint32_t)heap[0].key;
+            coeff += rows[row].coeff * cur[row].coeff;
+            bool first = col[row].i == 1;
+            if (packed_next(&col[row], &cur[row]))
+                heap_replace_top(heap, n,
+                                 mul_key(rows[row].exp + cur[row].exp, row));
+            else
+                heap_pop(heap, &n);
+            // Johnson's lazy insertion, as in mul_heap
+            if (first && row + 1 < a->size) {
+                packed_begin(&col[row + 1], b);
+                packed_next(&col[row + 1], &cur[row + 1]);
+                heap_push(heap, &n,
+                          mul_key(rows[row + 1].exp + cur[row + 1].exp,
+                                  row + 1));
+            }
+        }
+        if (coeff != 0)
+            packed_push(dest, exp, coeff);
+    }
+    arena_rewind(scratch, mark);
+    packed_shrink(dest);
+}
+
+void packed_print_fp(const struct poly_packed *p, FILE *fp) {
+    struct term block[PACKED_BLOCK];
+    struct packed_cursor c;
+    int lead = 0, n;
+    packed_begin(&c, p);
+    do {
+        for (n = 0; n < PACKED_BLOCK && packed_next(&c, &block[n]); ++n)
+            ;
+        polynomial_print_terms(block, n, &lead, fp);
+    } while (n == PACKED_BLOCK);
+}
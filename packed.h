@@ -0,0 +1,102 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "polynomial.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Compressed polynomial for very sparse, high-degree polynomials, where the
+// 16 bytes of a struct term are mostly padding and exponent. Terms are kept in
+// blocks of PACKED_BLOCK: the exponents of a block after its first are stored
+// as LEB128 varints of the gap to the previous exponent, the coefficients of
+// all terms sit contiguously in their own array. Every block has a skip entry
+// with its first exponent and where its varints start, so seeking binary
+// searches the skip entries and decodes at most one block.
+//
+// Packed polynomials are read through cursors that decode one term at a time,
+// so the operations below stream their operands and never unpack them.
+#define PACKED_BLOCK 64
+
+struct allocator;
+
+struct packed_skip {
+    int first_exp;
+    size_t offset; // of the first gap of the block in bytes
+};
+
+struct poly_packed {
+    int size, cap; // terms, and room for them in coeff and skip
+    int last_exp;
+    double *coeff;
+    unsigned char *bytes; // exponent gaps
+    size_t nbytes, bytes_cap;
+    struct packed_skip *skip; // one per started block
+    // owner of the arrays, the allocator current at packed_init
+    const struct allocator *alloc;
+};
+
+void packed_init(struct poly_packed *);
+void packed_release(struct poly_packed *);
+// Append x^exp, exp must be larger than every exponent already held
+void packed_push(struct poly_packed *, int exp, double coeff);
+// give the slack of the arrays back, for polynomials that are done growing
+void packed_shrink(struct poly_packed *);
+// bytes held by the arrays
+size_t packed_bytes(const struct poly_packed *);
+
+// dest gets initialized, terms with a zero coefficient are dropped
+void packed_from_terms(struct poly_packed *dest, const struct polynomial *src);
+void packed_to_terms(struct polynomial *dest, const struct poly_packed *src);
+
+struct packed_cursor {
+    const struct poly_packed *p;
+    int i;      // next term
+    int exp;    // exponent of the last term read
+    size_t pos; // next gap
+};
+
+static inline void packed_begin(struct packed_cursor *c,
+                                const struct poly_packed *p) {
+    *c = (struct packed_cursor){.p = p};
+}
+
+// read the next term into t, returns 0 at the end
+static inline int packed_next(struct packed_cursor *c, struct term *t) {
+    const struct poly_packed *p = c->p;
+    if (c->i == p->size)
+        return 0;
+    if (c->i % PACKED_BLOCK == 0) {
+        c->exp = p->skip[c->i / PACKED_BLOCK].first_exp;
+    } else {
+        unsigned gap = 0;
+        int shift = 0;
+        unsigned char byte;
+        do {
+            byte = p->bytes[c->pos++];
+            gap |= (unsigned)(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        c->exp = (int)((unsigned)c->exp + gap);
+    }
+    *t = (struct term){.coeff = p->coeff[c->i++], .exp = c->exp};
+    return 1;
+}
+
+// move to the first term with an exponent of at least exp
+void packed_seek(struct packed_cursor *, int exp);
+
+double packed_get_term(const struct poly_packed *, int exp);
+
+// dest = a + b, a - b and a * b, dest gets initialized
+void packed_add(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b);
+void packed_sub(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b);
+void packed_mul(struct poly_packed *dest, const struct poly_packed *a,
+                const struct poly_packed *b);
+
+// same output as polynomial_print_fp
+void packed_print_fp(const struct poly_packed *, FILE *fp);
+
+#endif
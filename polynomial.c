@@ -1,167 +1,272 @@
 #include "polynomial.h"
+#include "alloc.h"
+#include "dense.h"
+#include "merge_heap.h"
 
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-void polynomial_init(struct polynomial *p) {
+static atomic_uint_fast64_t version_clock;
+
+uint64_t polynomial_stamp(void) {
+    return atomic_fetch_add_explicit(&version_clock, 1,
+                                     memory_order_relaxed) +
+           1;
+}
+
+// every change of the terms gets a version no other state ever had
+static inline void touch(struct polynomial *p) {
+    p->version = polynomial_stamp();
+}
+
+// initialize with room for exactly cap terms, or the inline ones if they do
+static void init_cap(struct polynomial *p, int cap) {
     p->size = 0;
-    p->cap = 16;
-    p->terms = calloc(sizeof(struct term), p->cap);
+    p->alloc = allocator_current();
+    if (cap <= POLY_INLINE_TERMS) {
+        p->cap = POLY_INLINE_TERMS;
+        p->terms = p->small;
+    } else {
+        p->cap = cap;
+        p->terms = allocator_alloc(p->alloc, sizeof(struct term) * p->cap);
+    }
+    touch(p);
+}
+
+void polynomial_init(struct polynomial *p) { init_cap(p, 0); }
+
+void polynomial_release(struct polynomial *p) {
+    if (p->terms != p->small)
+        allocator_release(p->alloc, p->terms, sizeof(struct term) * p->cap);
+    p->terms = NULL;
+    p->size = p->cap = 0;
+}
+
+void polynomial_copy(struct polynomial *dest, const struct polynomial *src) {
+    init_cap(dest, src->size);
+    STATS_COUNT(STATS_TERM_COPIES, src->size);
+    memcpy(dest->terms, src->terms, sizeof(struct term) * src->size);
+    dest->size = src->size;
+    dest->version = src->version;
 }
 
 void polynomial_free(struct polynomial *p) {
-    free(p->terms);
+    polynomial_release(p);
     free(p);
 }
 
-static int term_comp(const void *_a, const void *_b) {
-    const struct term *a = (struct term *)_a, *b = (struct term *)_b;
-    if (a->exp == b->exp) {
-        if (a->coeff == b->coeff)
-            return 0;
-        return (a->coeff < b->coeff) ? -1 : 1;
+// change the capacity of the term array through the polynomial's allocator
+static void terms_resize(struct polynomial *p, int cap) {
+    STATS_COUNT(STATS_TERM_COPIES, p->size);
+    if (p->terms != p->small) {
+        p->terms = allocator_resize(p->alloc, p->terms,
+                                    sizeof(struct term) * p->cap,
+                                    sizeof(struct term) * cap);
+    } else if (cap > POLY_INLINE_TERMS) {
+        // leaving the inline terms
+        p->terms = allocator_alloc(p->alloc, sizeof(struct term) * cap);
+        memcpy(p->terms, p->small, sizeof(struct term) * p->size);
+    } else {
+        return;
     }
-    return (a->exp < b->exp) ? -1 : 1;
+    p->cap = cap;
 }
 
-struct polynomial *polynomial_parser(const char *str) {
-    struct polynomial *p = calloc(sizeof(struct polynomial), 1);
-    polynomial_init(p);
-    for (const char *it = str; *it;) {
-        int sign = 1;
+// double the capacity, results sized exactly may start out empty
+static void terms_grow(struct polynomial *p) {
+    terms_resize(p, p->cap < 8 ? 16 : p->cap * 2);
+}
 
-        // space eater
-        for (; isspace(*it) && *it; ++it)
-            ;
-        if (!*it) // return if end of string
-            break;
+void polynomial_reserve(struct polynomial *p, int cap) {
+    if (p->cap < cap)
+        terms_resize(p, cap);
+}
 
-        // process sign
-        if (*it == '-') {
-            sign = -1;
-            ++it;
-        } else if (*it == '+') {
-            ++it;
-        }
+static int term_comp(const void *_a, const void *_b) {
+    const struct term *a = (struct term *)_a, *b = (struct term *)_b;
+    return (a->exp > b->exp) - (a->exp < b->exp);
+}
 
-        // space eater
-        for (; isspace(*it) && *it; ++it)
-            ;
-        if (!*it) // return if end of string
-            break;
+// exact powers of ten, for the fast path of scan_number
+static const double pow10_exact[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-        const char *ed_it = it;
-        for (; (isdigit(*ed_it) || *ed_it == '.') && *ed_it; ++ed_it)
-            ; // find number end
-
-        // process coefficient
-        double coeff = 1.0;
-        char *buf = calloc(ed_it - it + 1, sizeof(char));
-        strncpy(buf, it, ed_it - it);
-        sscanf(buf, "%lf", &coeff);
-        free(buf);
-        buf = NULL;
-        coeff *= sign;
-        it = ed_it;
-
-        for (; isspace(*it) && *it; ++it)
-            ; // eat all space
-        if (!*it) {
-            // tmp.emplace_back(coeff, 0);
-            if (p->size >= p->cap) {
-                p->cap *= 2;
-                p->terms = realloc(p->terms, sizeof(struct term) * p->cap);
+// Scan an unsigned decimal number ("12", "1.5", ".5", "2e-3") from [*it, end)
+// without copying it. Mantissas below 2^53 scaled by an exact power of ten
+// are computed directly (Clinger's fast path, correctly rounded); anything
+// else is handed to strtod through a small stack buffer. Returns false if no
+// digit was found.
+static bool scan_number(const char **it, const char *end, double *out) {
+    const char *s = *it;
+    uint64_t mant = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false;
+    for (; s < end && isdigit((unsigned char)*s); ++s, any = true) {
+        if (digits < 19) {
+            mant = mant * 10 + (*s - '0');
+            digits += mant != 0;
+        } else {
+            ++exp10;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && isdigit((unsigned char)*s); ++s, any = true) {
+            if (digits < 19) {
+                mant = mant * 10 + (*s - '0');
+                digits += mant != 0;
+                --exp10;
             }
-            p->terms[p->size++] = (struct term){coeff, 0};
-            break;
         }
+    }
+    if (!any)
+        return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        int esign = 1, ev = 0;
+        if (e < end && (*e == '+' || *e == '-'))
+            esign = *e++ == '-' ? -1 : 1;
+        if (e < end && isdigit((unsigned char)*e)) {
+            for (; e < end && isdigit((unsigned char)*e); ++e)
+                if (ev < 10000)
+                    ev = ev * 10 + (*e - '0');
+            exp10 += esign * ev;
+            s = e;
+        }
+    }
+    if (mant < (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        *out = exp10 < 0 ? mant / pow10_exact[-exp10]
+                         : mant * pow10_exact[exp10];
+    } else {
+        char buf[128];
+        size_t len = s - *it;
+        if (len >= sizeof(buf))
+            return false;
+        memcpy(buf, *it, len);
+        buf[len] = 0;
+        *out = strtod(buf, NULL);
+    }
+    *it = s;
+    return true;
+}
 
-        if (*it == 'x') {
-            ++it;
-            int exp;
-            for (; isspace(*it) && *it; ++it)
-                ;
-            if (*it == '^') { // exponential not 1
-                it++;
-                for (; isspace(*it) && *it; ++it)
-                    ; // eat all space
-                if (!*it) {
-                    free(p);
-                    return NULL;
-                }
+static inline const char *skip_space(const char *it, const char *end) {
+    for (; it < end && isspace((unsigned char)*it); ++it)
+        ;
+    return it;
+}
 
-                ed_it = it;
-                for (; isdigit(*ed_it) && *ed_it; ++ed_it)
-                    ;
-                buf = calloc(ed_it - it + 1, sizeof(char));
-                strncpy(buf, it, ed_it - it);
-                // asserted no error will exist
-                sscanf(buf, "%d", &exp);
-                free(buf);
-                buf = NULL;
-                it = ed_it; // increment
-            } else {
-                exp = 1;
-            }
-            if (p->size >= p->cap) {
-                p->cap *= 2;
-                p->terms = realloc(p->terms, sizeof(struct term) * p->cap);
-            }
-            p->terms[p->size++] = (struct term){coeff, exp};
-        } else {
-            for (; isspace(*it) && *it; ++it)
-                ;       // eat all space
-            if (!*it) { // there might exist remaining constant term
-                if (p->size >= p->cap) {
-                    p->cap *= 2;
-                    p->terms = realloc(p->terms, sizeof(struct term) * p->cap);
+int polynomial_parse(struct polynomial *dest, const char *str, size_t n,
+                     size_t *err_pos) {
+    const char *it = str, *end = str + n;
+    // input usually comes in descending or ascending order, then sorting
+    // degenerates into a reversal or nothing
+    bool ascending = true, descending = true;
+    polynomial_init(dest);
+    for (bool first = true;; first = false) {
+        it = skip_space(it, end);
+        if (it == end)
+            break;
+
+        double sign = 1;
+        if (*it == '-' || *it == '+') {
+            sign = *it == '-' ? -1 : 1;
+            it = skip_space(it + 1, end);
+        } else if (!first) {
+            goto fail; // terms are separated by a sign
+        }
+
+        double coeff = 1;
+        bool has_coeff = scan_number(&it, end, &coeff);
+        it = skip_space(it, end);
+        int exp = 0;
+        if (it < end && *it == 'x') {
+            exp = 1;
+            it = skip_space(it + 1, end);
+            if (it < end && *it == '^') {
+                it = skip_space(it + 1, end);
+                int esign = 1;
+                if (it < end && *it == '-') {
+                    esign = -1;
+                    ++it;
                 }
-                p->terms[p->size++] = (struct term){coeff, 0};
-                break;
-            }
-            if (*it == '+' || *it == '-' || isspace(*it)) {
-                if (p->size >= p->cap) {
-                    p->cap *= 2;
-                    p->terms = realloc(p->terms, sizeof(struct term) * p->cap);
+                if (it == end || !isdigit((unsigned char)*it))
+                    goto fail;
+                long long v = 0;
+                for (; it < end && isdigit((unsigned char)*it); ++it) {
+                    v = v * 10 + (*it - '0');
+                    if (v > INT32_MAX)
+                        goto fail;
                 }
-                p->terms[p->size++] = (struct term){coeff, 0};
-                continue;
+                exp = (int)(esign * v);
             }
+        } else if (!has_coeff) {
+            goto fail; // neither a number nor x
         }
-    }
-    qsort(p->terms, p->size, sizeof(struct term), term_comp);
-    /*struct polynomial *tmp = (struct polynomial){.size = 0,
-                              .cap = p->size,
-                              .terms = calloc(p->size, sizeof(struct term))};*/
-    struct polynomial *tmp = calloc(1, sizeof(struct polynomial));
-    *tmp = (struct polynomial){.size = 0,
-                               .cap = p->size,
-                               .terms = calloc(p->size, sizeof(struct term))};
-    int term = 0;
-    bool first = false;
-    for (int i = 0; i < p->size; ++i) {
-        if (first && tmp->terms[term].exp < p->terms[i].exp) {
-            tmp->terms[++term].exp = p->terms[i].exp;
+
+        if (dest->size >= dest->cap)
+            terms_grow(dest);
+        if (dest->size > 0) {
+            int last = dest->terms[dest->size - 1].exp;
+            ascending &= last < exp;
+            descending &= last > exp;
         }
-        if (!first) {
-            tmp->terms[term].exp = p->terms[i].exp;
-            first = true;
+        dest->terms[dest->size++] =
+            (struct term){.coeff = sign * coeff, .exp = exp};
+    }
+
+    struct term *t = dest->terms;
+    if (descending) {
+        for (int i = 0, j = dest->size - 1; i < j; ++i, --j) {
+            struct term tmp = t[i];
+            t[i] = t[j];
+            t[j] = tmp;
         }
-        tmp->terms[term].coeff += p->terms[i].coeff;
+    } else if (!ascending) {
+        qsort(t, dest->size, sizeof(struct term), term_comp);
+    }
+    // combine like terms in place and drop the ones that cancel
+    int w = 0;
+    for (int i = 0; i < dest->size;) {
+        struct term sum = t[i];
+        for (++i; i < dest->size && t[i].exp == sum.exp; ++i)
+            sum.coeff += t[i].coeff;
+        if (sum.coeff != 0)
+            t[w++] = sum;
     }
-    tmp->size = term + 1;
-    polynomial_free(p);
-    return tmp;
+    dest->size = w;
+    return 0;
+
+fail:
+    if (err_pos != NULL)
+        *err_pos = it - str;
+    polynomial_release(dest);
+    return -1;
 }
 
-void polynomial_print_fp(const struct polynomial *p, FILE *fp) {
-    bool lp = false;
-    for (int i = 0; i < p->size; ++i) {
-        if (p->terms[i].coeff != 0) {
-            struct term *t = &(p->terms[i]);
+struct polynomial *polynomial_parser(const char *str) {
+    struct polynomial *p = calloc(1, sizeof(struct polynomial));
+    if (polynomial_parse(p, str, strlen(str), NULL) != 0) {
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+void polynomial_print_terms(const struct term *t, int n, int *lead,
+                            FILE *fp) {
+    bool lp = *lead;
+    for (int i = 0; i < n; ++i, ++t) {
+        if (t->coeff != 0) {
             if (lp)
                 fprintf(fp, "%c ", "-+"[t->coeff > 0]);
             if (fabs(t->coeff) != 1 || t->exp == 0)
@@ -172,181 +277,1050 @@ void polynomial_print_fp(const struct polynomial *p, FILE *fp) {
             if (t->exp != 0) {
                 fputc('x', fp);
             }
-            if (t->exp > 1) {
+            if (t->exp > 1 || t->exp < 0) {
                 fprintf(fp, "^%d", t->exp);
             }
             fputc(' ', fp);
             lp = true;
         }
     }
+    *lead = lp;
 }
+
+void polynomial_print_fp(const struct polynomial *p, FILE *fp) {
+    int lead = 0;
+    polynomial_print_terms(p->terms, p->size, &lead, fp);
+}
+
+// first index of t[0..n) with an exponent of at least exp
+static int lower_bound_exp(const struct term *t, int n, long long exp) {
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (t[mid].exp < exp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 double polynomial_get_term(const struct polynomial *p, int exp) {
-    for (int i = 0; i < p->size; ++i) {
-        if (p->terms[i].exp == exp)
-            return p->terms[i].coeff;
+    int i = lower_bound_exp(p->terms, p->size, exp);
+    return i < p->size && p->terms[i].exp == exp ? p->terms[i].coeff : 0;
+}
+
+int polynomial_has_term(const struct polynomial *p, int exp) {
+    int i = lower_bound_exp(p->terms, p->size, exp);
+    return i < p->size && p->terms[i].exp == exp;
+}
+
+void polynomial_add_term(struct polynomial *p, int exp, double coeff) {
+    touch(p);
+    int i = lower_bound_exp(p->terms, p->size, exp);
+    if (i < p->size && p->terms[i].exp == exp) {
+        p->terms[i].coeff = coeff;
+        return;
     }
+    if (p->size >= p->cap)
+        terms_grow(p);
+    memmove(p->terms + i + 1, p->terms + i,
+            sizeof(struct term) * (p->size - i));
+    p->terms[i] = (struct term){.coeff = coeff, .exp = exp};
+    p->size++;
+}
+
+int polynomial_remove_term(struct polynomial *p, int exp) {
+    int i = lower_bound_exp(p->terms, p->size, exp);
+    if (i == p->size || p->terms[i].exp != exp)
+        return 1;
+    touch(p);
+    memmove(p->terms + i, p->terms + i + 1,
+            sizeof(struct term) * (p->size - i - 1));
+    p->size--;
     return 0;
 }
-void polynomial_add_term(struct polynomial *p, int exp, double coeff) {
-    if (p->size + 1 >= p->cap) {
-        p->cap *= 2;
-        p->terms = realloc(p->terms, sizeof(struct term) * p->cap);
-    }
-    for (int i = 0; i < p->size; ++i) {
-        if (p->terms[i].exp > exp) {
-            // move every item one step further from here to end
-            for (int j = p->size - 1; j >= i; --j) {
-                p->terms[j + 1] = p->terms[j];
-            }
-            p->terms[i] = (struct term){.exp = exp, .coeff = coeff};
-            p->size++;
-            return;
-        }
-        if (p->terms[i].exp == exp) {
-            p->terms[i] = (struct term){.exp = exp, .coeff = coeff};
-            return;
+
+// a batch term and its position in the batch, so that sorting keeps the
+// last of several updates to one exponent recognizable
+struct update {
+    struct term term;
+    int index;
+};
+
+static int update_comp(const void *_a, const void *_b) {
+    const struct update *a = _a, *b = _b;
+    if (a->term.exp != b->term.exp)
+        return a->term.exp < b->term.exp ? -1 : 1;
+    return a->index - b->index;
+}
+
+static int int_comp(const void *_a, const void *_b) {
+    int a = *(const int *)_a, b = *(const int *)_b;
+    return (a > b) - (a < b);
+}
+
+void polynomial_set_terms(struct polynomial *p, const struct term *terms,
+                          int n) {
+    if (n <= 0)
+        return;
+    touch(p);
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct update *u = arena_alloc(scratch, sizeof(struct update) * n);
+    for (int i = 0; i < n; ++i)
+        u[i] = (struct update){terms[i], i};
+    qsort(u, n, sizeof(struct update), update_comp);
+    // keep the last update of every exponent
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        if (k > 0 && u[k - 1].term.exp == u[i].term.exp)
+            --k;
+        u[k++] = u[i];
+    }
+
+    // merge from the top end of the reserved array downwards, as in
+    // merge_inplace, then close the gap left by replaced and dropped terms
+    int total = p->size + k;
+    polynomial_reserve(p, total);
+    struct term *t = p->terms;
+    int i = p->size - 1, j = k - 1, w = total;
+    while (j >= 0) {
+        if (i >= 0 && t[i].exp > u[j].term.exp) {
+            t[--w] = t[i--];
+            continue;
         }
+        if (i >= 0 && t[i].exp == u[j].term.exp)
+            --i;
+        if (u[j].term.coeff != 0)
+            t[--w] = u[j].term;
+        --j;
     }
-    p->terms[p->size++] = (struct term){coeff, exp};
+    if (w > i + 1)
+        memmove(t + i + 1, t + w, sizeof(struct term) * (total - w));
+    p->size = i + 1 + total - w;
+    arena_rewind(scratch, mark);
 }
-int polynomial_remove_term(struct polynomial *p, int exp) {
-    for (int i = 0; i < p->size; ++i) {
-        if (p->terms[i].exp == exp) {
-            for (int j = i + 1; j < p->size; ++j) {
-                p->terms[j - 1] = p->terms[j];
-            }
-            p->size--;
-            return 0;
+
+int polynomial_remove_terms(struct polynomial *p, const int *exps, int n) {
+    if (n <= 0)
+        return 0;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    int *e = arena_alloc(scratch, sizeof(int) * n);
+    memcpy(e, exps, sizeof(int) * n);
+    qsort(e, n, sizeof(int), int_comp);
+    // everything below the smallest exponent stays where it is
+    int r = lower_bound_exp(p->terms, p->size, e[0]), w = r, j = 0;
+    for (; r < p->size; ++r) {
+        while (j < n && e[j] < p->terms[r].exp)
+            ++j;
+        if (j < n && e[j] == p->terms[r].exp)
+            continue;
+        p->terms[w++] = p->terms[r];
+    }
+    int removed = p->size - w;
+    p->size = w;
+    if (removed > 0)
+        touch(p);
+    arena_rewind(scratch, mark);
+    return removed;
+}
+
+// Merge two sorted term arrays into out as a + sign * b, dropping terms that
+// cancel, and return the number of terms written. out has room for na + nb.
+static int merge(struct term *out, const struct term *a, int na,
+                 const struct term *b, int nb, double sign) {
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i].exp == b[j].exp) {
+            double coeff = a[i].coeff + sign * b[j].coeff;
+            if (coeff != 0)
+                out[k++] = (struct term){.coeff = coeff, .exp = a[i].exp};
+            ++i;
+            ++j;
+        } else if (a[i].exp < b[j].exp) {
+            out[k++] = a[i++];
+        } else {
+            out[k++] = (struct term){.coeff = sign * b[j].coeff,
+                                     .exp = b[j].exp};
+            ++j;
         }
     }
-    return 1;
+    for (; i < na; ++i)
+        out[k++] = a[i];
+    for (; j < nb; ++j)
+        out[k++] = (struct term){.coeff = sign * b[j].coeff, .exp = b[j].exp};
+    return k;
 }
 
 void polynomial_add(struct polynomial *dest, const struct polynomial *a,
                     const struct polynomial *b) {
-    polynomial_init(dest);
-    int i, j;
-    for (i = 0, j = 0; i < a->size && j < b->size;) {
-        if (a->terms[i].exp == b->terms[j].exp) {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] =
-                (struct term){.exp = a->terms[i].exp,
-                              .coeff = a->terms[i].coeff + b->terms[j].coeff};
-            ++i;
-            ++j;
-        } else if (a->terms[i].exp < b->terms[j].exp) {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] = (struct term){
-                .exp = a->terms[i].exp, .coeff = a->terms[i].coeff};
-            ++i;
+    init_cap(dest, a->size + b->size);
+    dest->size = merge(dest->terms, a->terms, a->size, b->terms, b->size, 1);
+}
+
+void polynomial_sub(struct polynomial *dest, const struct polynomial *a,
+                    const struct polynomial *b) {
+    init_cap(dest, a->size + b->size);
+    dest->size = merge(dest->terms, a->terms, a->size, b->terms, b->size, -1);
+}
 
+// dest += sign * a. The merge runs from the top end of the reserved array
+// downwards, so it never overwrites a term of dest it has not read yet; a is
+// allowed to be dest itself.
+static void merge_inplace(struct polynomial *dest, const struct polynomial *a,
+                          double sign) {
+    int total = dest->size + a->size;
+    touch(dest);
+    polynomial_reserve(dest, total);
+    struct term *t = dest->terms;
+    const struct term *s = a->terms;
+    int i = dest->size - 1, j = a->size - 1, k = total;
+    while (i >= 0 && j >= 0) {
+        if (t[i].exp == s[j].exp) {
+            double coeff = t[i].coeff + sign * s[j].coeff;
+            int exp = t[i].exp;
+            --i;
+            --j;
+            if (coeff != 0)
+                t[--k] = (struct term){.coeff = coeff, .exp = exp};
+        } else if (t[i].exp > s[j].exp) {
+            t[--k] = t[i--];
         } else {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] = (struct term){
-                .exp = b->terms[j].exp, .coeff = b->terms[j].coeff};
-            ++j;
+            t[--k] = (struct term){.coeff = sign * s[j].coeff, .exp = s[j].exp};
+            --j;
         }
     }
-    for (; i < a->size; ++i) {
+    for (; j >= 0; --j)
+        t[--k] = (struct term){.coeff = sign * s[j].coeff, .exp = s[j].exp};
+    // the rest of dest is already in place, only the gap left by cancelled
+    // and combined terms has to close
+    if (i >= 0 && k > i + 1) {
+        memmove(t + i + 1, t + k, sizeof(struct term) * (total - k));
+        dest->size = total - k + i + 1;
+    } else if (i < 0) {
+        memmove(t, t + k, sizeof(struct term) * (total - k));
+        dest->size = total - k;
+    } else {
+        dest->size = total;
+    }
+}
+
+void polynomial_add_inplace(struct polynomial *dest,
+                            const struct polynomial *a) {
+    merge_inplace(dest, a, 1);
+}
+
+void polynomial_sub_inplace(struct polynomial *dest,
+                            const struct polynomial *a) {
+    merge_inplace(dest, a, -1);
+}
+
+static void fused(struct polynomial *dest, const struct polynomial *a,
+                  const struct polynomial *b, double sign) {
+    // the product cannot live in the scratch arena, the engines rewind it
+    struct polynomial prod;
+    polynomial_mul(&prod, a, b);
+    merge_inplace(dest, &prod, sign);
+    polynomial_release(&prod);
+}
+
+void polynomial_fma(struct polynomial *dest, const struct polynomial *a,
+                    const struct polynomial *b) {
+    fused(dest, a, b, 1);
+}
+
+void polynomial_fms(struct polynomial *dest, const struct polynomial *a,
+                    const struct polynomial *b) {
+    fused(dest, a, b, -1);
+}
+
+static void mul_heap(struct polynomial *dest, const struct polynomial *a,
+                     const struct polynomial *b) {
+    // rows come from the shorter operand so the heap stays small
+    if (a->size > b->size) {
+        const struct polynomial *t = a;
+        a = b;
+        b = t;
+    }
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    struct mul_node *heap =
+        arena_alloc(scratch, sizeof(struct mul_node) * (a->size + 1));
+    int *col = arena_alloc(scratch, sizeof(int) * a->size);
+    memset(col, 0, sizeof(int) * a->size);
+    int n = 0;
+    // Johnson's lazy insertion: row i + 1 enters the heap only once row i
+    // has produced its first term, since it cannot be smaller before that
+    heap_push(heap, &n, mul_key(a->terms[0].exp + b->terms[0].exp, 0));
+    while (n > 0) {
+        int exp = (int)((uint32_t)(heap[0].key >> 32) ^ 0x80000000u);
+        double coeff = 0;
+        // pop every product sharing this exponent and sum them
+        while (n > 0 && (int)((uint32_t)(heap[0].key >> 32) ^ 0x80000000u) ==
+                            exp) {
+            int row = (int)(uint32_t)heap[0].key;
+            coeff += a->terms[row].coeff * b->terms[col[row]].coeff;
+            if (++col[row] < b->size)
+                heap_replace_top(
+                    heap, n,
+                    mul_key(a->terms[row].exp + b->terms[col[row]].exp, row));
+            else
+                heap_pop(heap, &n);
+            if (col[row] == 1 && row + 1 < a->size)
+                heap_push(heap, &n,
+                          mul_key(a->terms[row + 1].exp + b->terms[0].exp,
+                                  row + 1));
+        }
+        if (coeff == 0)
+            continue;
         if (dest->size >= dest->cap) {
-            dest->cap *= 2;
-            dest->terms = realloc(dest->terms, dest->cap);
+            terms_grow(dest);
         }
-        dest->terms[dest->size++] =
-            (struct term){.exp = a->terms[i].exp, .coeff = a->terms[i].coeff};
+        dest->terms[dest->size++] = (struct term){.coeff = coeff, .exp = exp};
     }
-    for (; j < b->size; ++j) {
-        if (dest->size >= dest->cap) {
-            dest->cap *= 2;
-            dest->terms = realloc(dest->terms, dest->cap);
+    arena_rewind(scratch, mark);
+}
+
+// ---- parallel sparse product ----
+
+// Products with fewer term pairs than this stay on the calling thread, above
+// it the cost of starting the workers is lost in the noise
+#define MUL_PARALLEL_MIN_WORK (1 << 18)
+// chunks per thread, claimed dynamically so uneven chunks balance out
+#define MUL_CHUNKS_PER_THREAD 8
+
+static atomic_int mul_threads = 1;
+
+void polynomial_mul_set_threads(int n) {
+    if (n <= 0)
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    atomic_store(&mul_threads, n > 0 ? n : 1);
+}
+
+int polynomial_mul_threads(void) { return atomic_load(&mul_threads); }
+
+struct mul_chunk {
+    struct term *terms;
+    int size;
+};
+
+struct mul_job {
+    const struct polynomial *a, *b; // a holds the rows
+    long long lo, width;            // chunk c covers [lo + c * width, +width)
+    int chunks;
+    atomic_int next;
+    struct mul_chunk *out;
+};
+
+// The k-way merge of mul_heap restricted to output exponents in [lo, hi).
+// Every row starts at its first term reaching lo, so an exponent is summed
+// over the same rows in the same order as the serial merge would.
+static void mul_heap_range(struct mul_chunk *out, const struct polynomial *a,
+                           const struct polynomial *b, long long lo,
+                           long long hi, struct mul_node *heap, int *col) {
+    int n = 0, cap = 0;
+    out->terms = NULL;
+    out->size = 0;
+    heap[0].key = UINT64_MAX;
+    for (int row = 0; row < a->size; ++row) {
+        col[row] = lower_bound_exp(b->terms, b->size, lo - a->terms[row].exp);
+        if (col[row] < b->size &&
+            (long long)a->terms[row].exp + b->terms[col[row]].exp < hi)
+            heap_push(heap, &n,
+                      mul_key(a->terms[row].exp + b->terms[col[row]].exp,
+                              row));
+    }
+    while (n > 0) {
+        int exp = (int)((uint32_t)(heap[0].key >> 32) ^ 0x80000000u);
+        double coeff = 0;
+        while (n > 0 && (int)((uint32_t)(heap[0].key >> 32) ^ 0x80000000u) ==
+                            exp) {
+            int row = (int)(uint32_t)heap[0].key;
+            coeff += a->terms[row].coeff * b->terms[col[row]].coeff;
+            if (++col[row] < b->size &&
+                (long long)a->terms[row].exp + b->terms[col[row]].exp < hi)
+                heap_replace_top(
+                    heap, n,
+                    mul_key(a->terms[row].exp + b->terms[col[row]].exp, row));
+            else
+                heap_pop(heap, &n);
         }
-        dest->terms[dest->size++] =
-            (struct term){.exp = b->terms[j].exp, .coeff = b->terms[j].coeff};
+        if (coeff == 0)
+            continue;
+        if (out->size >= cap) {
+            cap = cap < 8 ? 16 : cap * 2;
+            out->terms = realloc(out->terms, sizeof(struct term) * cap);
+        }
+        out->terms[out->size++] = (struct term){.coeff = coeff, .exp = exp};
     }
 }
-void polynomial_sub(struct polynomial *dest, const struct polynomial *a,
+
+static void *mul_worker(void *arg) {
+    struct mul_job *job = arg;
+    // plain malloc, the current allocator belongs to the calling thread
+    struct mul_node *heap =
+        malloc(sizeof(struct mul_node) * (job->a->size + 1));
+    int *col = malloc(sizeof(int) * job->a->size);
+    int c;
+    while ((c = atomic_fetch_add(&job->next, 1)) < job->chunks) {
+        long long lo = job->lo + c * job->width;
+        mul_heap_range(&job->out[c], job->a, job->b, lo, lo + job->width,
+                       heap, col);
+    }
+    free(heap);
+    free(col);
+    return NULL;
+}
+
+// Split the output exponent range in chunks merged independently by the
+// workers and the calling thread, then copy them out in order. The only shared
+// state is the chunk counter.
+static void mul_heap_parallel(struct polynomial *dest,
+                              const struct polynomial *a,
+                              const struct polynomial *b, int threads) {
+    // same choice of rows as mul_heap, for the same summation order
+    if (a->size > b->size) {
+        const struct polynomial *t = a;
+        a = b;
+        b = t;
+    }
+    long long lo = (long long)a->terms[0].exp + b->terms[0].exp;
+    long long hi = (long long)a->terms[a->size - 1].exp +
+                   b->terms[b->size - 1].exp + 1;
+    struct mul_job job = {.a = a, .b = b, .lo = lo};
+    long long chunks = (long long)threads * MUL_CHUNKS_PER_THREAD;
+    job.width = (hi - lo + chunks - 1) / chunks;
+    job.chunks = (int)((hi - lo + job.width - 1) / job.width);
+    atomic_init(&job.next, 0);
+    job.out = malloc(sizeof(struct mul_chunk) * job.chunks);
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    int started = 0;
+    for (; started < threads - 1; ++started)
+        if (pthread_create(&workers[started], NULL, mul_worker, &job) != 0)
+            break; // the remaining chunks are picked up by whoever runs
+    mul_worker(&job);
+    for (int i = 0; i < started; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    int total = 0;
+    for (int c = 0; c < job.chunks; ++c)
+        total += job.out[c].size;
+    polynomial_reserve(dest, total);
+    for (int c = 0; c < job.chunks; ++c) {
+        memcpy(dest->terms + dest->size, job.out[c].terms,
+               sizeof(struct term) * job.out[c].size);
+        dest->size += job.out[c].size;
+        free(job.out[c].terms);
+    }
+    free(job.out);
+}
+
+// exponent span of a non-empty polynomial, i.e. the dense buffer length
+static inline long long span(const struct polynomial *p) {
+    return (long long)p->terms[p->size - 1].exp - p->terms[0].exp + 1;
+}
+
+static double *to_dense(struct arena *scratch, const struct polynomial *p) {
+    double *d = arena_alloc(scratch, sizeof(double) * span(p));
+    memset(d, 0, sizeof(double) * span(p));
+    for (int i = 0; i < p->size; ++i)
+        d[p->terms[i].exp - p->terms[0].exp] += p->terms[i].coeff;
+    return d;
+}
+
+// collect the non-zero coefficients of d[0..n) as terms x^(offset + i)
+static void from_dense(struct polynomial *dest, const double *d, int n,
+                       int offset) {
+    int count = 0;
+    for (int i = 0; i < n; ++i)
+        count += d[i] != 0;
+    dest->size = 0;
+    polynomial_reserve(dest, count);
+    for (int i = 0; i < n; ++i)
+        if (d[i] != 0)
+            dest->terms[dest->size++] =
+                (struct term){.coeff = d[i], .exp = offset + i};
+}
+
+// run a dense kernel on the exponent spans of both operands
+static void mul_dense(struct polynomial *dest, const struct polynomial *a,
+                      const struct polynomial *b,
+                      void (*kernel)(double *, const double *, int,
+                                     const double *, int)) {
+    int na = span(a), nb = span(b);
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    double *da = to_dense(scratch, a), *db = to_dense(scratch, b);
+    double *r = arena_alloc(scratch, sizeof(double) * (na + nb - 1));
+    kernel(r, da, na, db, nb);
+    from_dense(dest, r, na + nb - 1, a->terms[0].exp + b->terms[0].exp);
+    arena_rewind(scratch, mark);
+}
+
+static inline double log2_at_least_1(double x) {
+    return x > 2 ? log2(x) : 1;
+}
+
+// Estimated cost of the engines, the constants are ns per unit of work
+// measured on x86-64 at -O3. na and nb are term counts for the heap and
+// exponent spans for the dense engines.
+static double cost_heap(double na, double nb) {
+    return 2.0 * na * nb * log2_at_least_1(na < nb ? na : nb);
+}
+
+static double cost_fft(double na, double nb) {
+    double n = na + nb - 1;
+    // the transform turns memory bound once its buffers leave L2
+    return (n <= (1 << 15) ? 2.5 : 6.0) * n * log2_at_least_1(n) + 1.5 * n;
+}
+
+static double cost_toom3(double na, double nb) {
+    // Toom-3 works on slices as long as the shorter span
+    double n = na + nb - 1, lo = na < nb ? na : nb;
+    return (n - lo + 1) / lo * 2.8 * pow(lo, 1.465) + 1.5 * n;
+}
+
+enum polynomial_mul_algo polynomial_mul_select(const struct polynomial *a,
+                                               const struct polynomial *b) {
+    if (a->size == 0 || b->size == 0)
+        return POLY_MUL_HEAP;
+    if (span(a) + span(b) - 1 > POLY_DENSE_MAX_SPAN)
+        return POLY_MUL_HEAP;
+    double heap = cost_heap(a->size, b->size);
+    double fft = cost_fft(span(a), span(b));
+    double toom = cost_toom3(span(a), span(b));
+    if (toom < fft && toom < heap)
+        return POLY_MUL_TOOM3;
+    return fft < heap ? POLY_MUL_FFT : POLY_MUL_HEAP;
+}
+
+const char *polynomial_mul_algo_name(enum polynomial_mul_algo algo) {
+    switch (algo) {
+    case POLY_MUL_AUTO:
+        return "auto";
+    case POLY_MUL_HEAP:
+        return "heap";
+    case POLY_MUL_KARATSUBA:
+        return "karatsuba";
+    case POLY_MUL_TOOM3:
+        return "toom3";
+    case POLY_MUL_FFT:
+        return "fft";
+    }
+    return "unknown";
+}
+
+void polynomial_mul_with(struct polynomial *dest, const struct polynomial *a,
+                         const struct polynomial *b,
+                         enum polynomial_mul_algo algo) {
+    polynomial_init(dest);
+    if (a->size == 0 || b->size == 0)
+        return;
+    if (algo == POLY_MUL_AUTO)
+        algo = polynomial_mul_select(a, b);
+    if (algo != POLY_MUL_HEAP && span(a) + span(b) - 1 > POLY_DENSE_MAX_SPAN)
+        algo = POLY_MUL_HEAP;
+    switch (algo) {
+    case POLY_MUL_KARATSUBA:
+        mul_dense(dest, a, b, dense_mul_karatsuba);
+        break;
+    case POLY_MUL_TOOM3:
+        mul_dense(dest, a, b, dense_mul_toom3);
+        break;
+    case POLY_MUL_FFT:
+        mul_dense(dest, a, b, dense_mul_fft);
+        break;
+    default:
+        if (polynomial_mul_threads() > 1 &&
+            (double)a->size * b->size >= MUL_PARALLEL_MIN_WORK)
+            mul_heap_parallel(dest, a, b, polynomial_mul_threads());
+        else
+            mul_heap(dest, a, b);
+        break;
+    }
+}
+
+void polynomial_mul(struct polynomial *dest, const struct polynomial *a,
                     const struct polynomial *b) {
+    polynomial_mul_with(dest, a, b, POLY_MUL_AUTO);
+}
+
+// ---- powers ----
+
+// ns per coefficient of the result in pow_miller, and per term of p on top
+#define POW_MILLER_COST 10.0
+#define POW_MILLER_TERM_COST 2.0
+// longest chain of products by p considered instead of squaring
+#define POW_MAX_CHAIN 64
+// integers up to here are exact in a double
+#define MILLER_EXACT 9007199254740992.0
+
+// p^k has at most one term per multiset of k terms of p, and no more than its
+// exponent span
+static double pow_terms(double t, unsigned k, double span) {
+    double n = 1;
+    for (unsigned i = 1; i <= k && n < span; ++i)
+        n = n * (t + i - 1) / i;
+    return n < span ? n : span;
+}
+
+// J.C.P. Miller's recurrence. With p = x^e (q_0 + q_1 x + ...) and q_0 != 0
+// the coefficients of (q_0 + q_1 x + ...)^k are
+//   r_0 = q_0^k,  r_m = sum_i ((k + 1) i - m) q_i r_(m - i) / (m q_0)
+// where only the terms of p contribute, so every coefficient costs one step
+// per term of p instead of a whole product.
+//
+// The sums cancel, and in floating point the error grows without bound (to
+// 1e53 for the coefficient 1 of x^400 in (1 + x + x^2)^200). So it is only
+// used where it is exact or has nothing to cancel: for binomials, whose
+// coefficients are plain products, and for integer coefficients as long as
+// every sum stays below 2^53. Returns false, leaving dest alone, once a sum
+// gets past that.
+static bool pow_miller(struct polynomial *dest, const struct polynomial *p,
+                       unsigned k) {
+    int t = p->size - 1, e0 = p->terms[0].exp;
+    int n = (int)((long long)k * (span(p) - 1) + 1);
+    // integer inputs have integer powers, rounding every coefficient keeps
+    // the error from spreading through the recurrence
+    bool integral = true;
+    for (int i = 0; i < p->size; ++i)
+        integral &= p->terms[i].coeff == nearbyint(p->terms[i].coeff);
+    double q0 = p->terms[0].coeff;
+    if (t > 1 && (!integral || fabs(pow(q0, k)) >= MILLER_EXACT))
+        return false;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    double *r = arena_alloc(scratch, sizeof(double) * n);
+    // offsets and weights of the terms past q_0, read once per coefficient
+    int *d = arena_alloc(scratch, sizeof(int) * t);
+    double *w = arena_alloc(scratch, sizeof(double) * t);
+    double *kd = arena_alloc(scratch, sizeof(double) * t);
+    for (int i = 0; i < t; ++i) {
+        d[i] = p->terms[i + 1].exp - e0;
+        w[i] = p->terms[i + 1].coeff;
+        kd[i] = (double)(k + 1) * d[i];
+    }
+    // Exponents that no product of k terms reaches are zero, but the sum for
+    // them cancels only in exact arithmetic. The fewest terms of p that add
+    // up to every offset (past the ones of q_0) tell them apart.
+    unsigned *fewest = arena_alloc(scratch, sizeof(unsigned) * n);
+    r[0] = pow(q0, k);
+    fewest[0] = 0;
+    // terms [0, live) have offsets up to m
+    int live = 0;
+    for (int m = 1; m < n; ++m) {
+        for (; live < t && d[live] <= m; ++live)
+            ;
+        // the sum is exact while its terms add up to less than 2^53
+        double sum = 0, bound = 0;
+        unsigned least = UINT_MAX;
+        for (int i = 0; i < live; ++i) {
+            unsigned f = fewest[m - d[i]];
+            double term = (kd[i] - m) * w[i] * r[m - d[i]];
+            sum += term;
+            bound += fabs(term);
+            least = f < least ? f : least;
+        }
+        if (t > 1 && bound >= MILLER_EXACT) {
+            arena_rewind(scratch, mark);
+            return false;
+        }
+        fewest[m] = least == UINT_MAX ? least : least + 1;
+        if (fewest[m] > k)
+            r[m] = 0;
+        else if (integral)
+            r[m] = nearbyint(sum / (m * q0));
+        else
+            r[m] = sum / (m * q0);
+    }
     polynomial_init(dest);
-    int i, j;
-    for (i = 0, j = 0; i < a->size && j < b->size;) {
-        if (a->terms[i].exp == b->terms[j].exp) {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] =
-                (struct term){.exp = a->terms[i].exp,
-                              .coeff = a->terms[i].coeff - b->terms[j].coeff};
-            ++i;
-            ++j;
-        } else if (a->terms[i].exp < b->terms[j].exp) {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] = (struct term){
-                .exp = a->terms[i].exp, .coeff = a->terms[i].coeff};
-            ++i;
+    from_dense(dest, r, n, (int)((long long)k * e0));
+    arena_rewind(scratch, mark);
+    return true;
+}
 
-        } else {
-            if (dest->size >= dest->cap) {
-                dest->cap *= 2;
-                dest->terms = realloc(dest->terms, dest->cap);
-            }
-            dest->terms[dest->size++] = (struct term){
-                .exp = b->terms[j].exp, .coeff = -b->terms[j].coeff};
-            ++j;
+static void (*pick_dense(int na, int nb))(double *, const double *, int,
+                                          const double *, int) {
+    return cost_toom3(na, nb) < cost_fft(na, nb) ? dense_mul_toom3
+                                                 : dense_mul_fft;
+}
+
+// Square and multiply on dense buffers, which are allocated once for the
+// final length and reused by every step
+static void pow_dense(struct polynomial *dest, const struct polynomial *p,
+                      unsigned k) {
+    int len = span(p), n = (int)((long long)k * (len - 1) + 1);
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    double *base = to_dense(scratch, p);
+    double *acc = arena_alloc(scratch, sizeof(double) * n);
+    double *tmp = arena_alloc(scratch, sizeof(double) * n);
+    memcpy(acc, base, sizeof(double) * len);
+    int alen = len;
+    for (int bit = 30 - __builtin_clz(k); bit >= 0; --bit) {
+        pick_dense(alen, alen)(tmp, acc, alen, acc, alen);
+        alen = 2 * alen - 1;
+        double *t = acc;
+        acc = tmp;
+        tmp = t;
+        if (k >> bit & 1) {
+            pick_dense(alen, len)(tmp, acc, alen, base, len);
+            alen += len - 1;
+            t = acc;
+            acc = tmp;
+            tmp = t;
         }
     }
-    for (; i < a->size; ++i) {
-        if (dest->size >= dest->cap) {
-            dest->cap *= 2;
-            dest->terms = realloc(dest->terms, dest->cap);
+    polynomial_init(dest);
+    from_dense(dest, acc, n, (int)((long long)k * p->terms[0].exp));
+    arena_rewind(scratch, mark);
+}
+
+// Square and multiply through polynomial_mul, for results too sparse or too
+// wide for a dense buffer. With chain set it multiplies by p k - 1 times
+// instead, which is cheaper when p has only a few terms: every product then
+// costs about the size of the result rather than its square.
+static void pow_sparse(struct polynomial *dest, const struct polynomial *p,
+                       unsigned k, bool chain) {
+    struct polynomial acc, tmp;
+    polynomial_copy(&acc, p);
+    if (chain) {
+        for (unsigned i = 1; i < k; ++i) {
+            polynomial_mul(&tmp, &acc, p);
+            polynomial_release(&acc);
+            polynomial_move(&acc, &tmp);
         }
-        dest->terms[dest->size++] =
-            (struct term){.exp = a->terms[i].exp, .coeff = a->terms[i].coeff};
+        polynomial_move(dest, &acc);
+        return;
     }
-    for (; j < b->size; ++j) {
-        if (dest->size >= dest->cap) {
-            dest->cap *= 2;
-            dest->terms = realloc(dest->terms, dest->cap);
+    for (int bit = 30 - __builtin_clz(k); bit >= 0; --bit) {
+        polynomial_mul(&tmp, &acc, &acc);
+        polynomial_release(&acc);
+        polynomial_move(&acc, &tmp);
+        if (k >> bit & 1) {
+            polynomial_mul(&tmp, &acc, p);
+            polynomial_release(&acc);
+            polynomial_move(&acc, &tmp);
         }
-        dest->terms[dest->size++] =
-            (struct term){.exp = b->terms[j].exp, .coeff = -b->terms[j].coeff};
     }
+    polynomial_move(dest, &acc);
 }
-void polynomial_mul(struct polynomial *dest, const struct polynomial *a,
-                    const struct polynomial *b) {
-    polynomial_init(dest);
-    for (int i = 0; i < a->size; ++i) {
-        struct polynomial accumulator;
-        polynomial_init(&accumulator);
-        for (int j = 0; j < b->size; ++j) {
-            if (accumulator.size >= accumulator.cap) {
-                accumulator.cap *= 2;
-                accumulator.terms = realloc(accumulator.terms, accumulator.cap);
+
+int polynomial_pow(struct polynomial *dest, const struct polynomial *p,
+                   unsigned k) {
+    // every exponent of p^k, and of the powers on the way, lies between k
+    // times the lowest and k times the highest exponent of p
+    if (k > 1 && p->size > 0 &&
+        ((long long)k * p->terms[0].exp < INT_MIN ||
+         (long long)k * p->terms[p->size - 1].exp > INT_MAX)) {
+        polynomial_init(dest);
+        return -1;
+    }
+    if (k == 0 || p->size <= 1) {
+        polynomial_init(dest);
+        if (k == 0)
+            polynomial_add_term(dest, 0, 1);
+        else if (p->size == 1 && p->terms[0].coeff != 0)
+            polynomial_add_term(dest, (int)((long long)k * p->terms[0].exp),
+                                pow(p->terms[0].coeff, k));
+        return 0;
+    }
+    if (k == 1) {
+        polynomial_copy(dest, p);
+        return 0;
+    }
+    double t = p->size, n = (double)k * (span(p) - 1) + 1;
+    // products by p one at a time
+    double chain = INFINITY;
+    if (k <= POW_MAX_CHAIN) {
+        chain = 0;
+        for (unsigned i = 1; i < k; ++i)
+            chain += cost_heap(pow_terms(t, i, n), t);
+    }
+    // repeated squaring costs about as much as its last two products
+    double half = pow_terms(t, k / 2, n / 2 + 1);
+    double square = 2 * cost_heap(half, half);
+    double dense = INFINITY, miller = INFINITY;
+    if (n <= POLY_DENSE_MAX_SPAN) {
+        dense = 2 * cost_fft(n / 2 + 1, n / 2 + 1);
+        if (p->terms[0].coeff != 0)
+            miller = (POW_MILLER_COST + POW_MILLER_TERM_COST * t) * n;
+    }
+    if (miller <= dense && miller <= square && miller <= chain &&
+        pow_miller(dest, p, k))
+        return 0;
+    if (dense <= square && dense <= chain)
+        pow_dense(dest, p, k);
+    else
+        pow_sparse(dest, p, k, chain < square);
+    return 0;
+}
+
+// ---- division ----
+
+// residue the Newton path may leave above the remainder, relative to the
+// largest coefficient involved and per coefficient of the quotient
+#define DIVMOD_TOLERANCE (64 * DBL_EPSILON)
+
+// Sparse long division with a heap of the products q_j * b_i still to be
+// subtracted, keyed so the largest exponent comes first. Every step settles
+// one exponent: what is left of a there either is the next quotient term or
+// a remainder term. The cost is about |q| |b| log |q|, however many terms the
+// remainders in between would have had. Gives up and returns false, with q
+// and r left empty, once more than limit products were subtracted.
+static bool divmod_heap(struct polynomial *q, struct polynomial *r,
+                        const struct polynomial *a, const struct polynomial *b,
+                        int top, double limit) {
+    int db = b->terms[top].exp;
+    double lead = b->terms[top].coeff;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    // quotient terms are found largest first, row j of the heap belongs to
+    // quotient term j and walks b downwards from below its top term
+    int qcap = 16, nq = 0, n = 0;
+    struct term *qt = arena_alloc(scratch, sizeof(struct term) * qcap);
+    int *col = arena_alloc(scratch, sizeof(int) * qcap);
+    struct mul_node *heap =
+        arena_alloc(scratch, sizeof(struct mul_node) * (qcap + 1));
+    heap[0].key = UINT64_MAX;
+    // ~exp turns the min-heap into a max-heap on exponents
+    int ia = a->size - 1;
+    double products = 0;
+    while (ia >= 0 || n > 0) {
+        if (products > limit) {
+            if (r != NULL)
+                r->size = 0;
+            arena_rewind(scratch, mark);
+            return false;
+        }
+        int exp = ia >= 0 ? a->terms[ia].exp : INT_MIN;
+        if (n > 0 && ~mul_key_exp(heap[0].key) > exp)
+            exp = ~mul_key_exp(heap[0].key);
+        double coeff = 0, mag = 0;
+        int parts = 1;
+        if (ia >= 0 && a->terms[ia].exp == exp)
+            coeff = a->terms[ia--].coeff;
+        mag = fabs(coeff);
+        while (n > 0 && ~mul_key_exp(heap[0].key) == exp) {
+            int row = (int)(uint32_t)heap[0].key;
+            double x = qt[row].coeff * b->terms[col[row]].coeff;
+            coeff -= x;
+            mag += fabs(x);
+            parts++;
+            products++;
+            if (--col[row] >= 0)
+                heap_replace_top(
+                    heap, n,
+                    mul_key(~(qt[row].exp + b->terms[col[row]].exp), row));
+            else
+                heap_pop(heap, &n);
+        }
+        // What is left after the sum cancels within its rounding error is
+        // a zero that floating point missed, as a quotient term it would
+        // only feed more noise into the rows below. Exact integer sums are
+        // either zero or well above this bound.
+        if (fabs(coeff) <= parts * DBL_EPSILON * mag)
+            continue;
+        if (exp < db) {
+            if (r != NULL) {
+                if (r->size >= r->cap)
+                    terms_grow(r);
+                r->terms[r->size++] =
+                    (struct term){.coeff = coeff, .exp = exp};
             }
-            accumulator.terms[accumulator.size++] =
-                (struct term){.coeff = a->terms[i].coeff * b->terms[j].coeff,
-                              .exp = a->terms[i].exp + b->terms[j].exp};
+            continue;
+        }
+        if (nq == qcap) {
+            struct term *t =
+                arena_alloc(scratch, sizeof(struct term) * qcap * 2);
+            int *c = arena_alloc(scratch, sizeof(int) * qcap * 2);
+            struct mul_node *h =
+                arena_alloc(scratch, sizeof(struct mul_node) * (qcap * 2 + 1));
+            memcpy(t, qt, sizeof(struct term) * nq);
+            memcpy(c, col, sizeof(int) * nq);
+            memcpy(h, heap, sizeof(struct mul_node) * (n + 1));
+            qt = t;
+            col = c;
+            heap = h;
+            qcap *= 2;
+        }
+        qt[nq] = (struct term){.coeff = coeff / lead, .exp = exp - db};
+        col[nq] = top - 1;
+        if (top > 0)
+            heap_push(heap, &n,
+                      mul_key(~(qt[nq].exp + b->terms[top - 1].exp), nq));
+        nq++;
+    }
+    // both came out largest first
+    polynomial_reserve(q, nq);
+    for (int i = 0; i < nq; ++i)
+        q->terms[i] = qt[nq - 1 - i];
+    q->size = nq;
+    if (r != NULL)
+        for (int i = 0, j = r->size - 1; i < j; ++i, --j) {
+            struct term t = r->terms[i];
+            r->terms[i] = r->terms[j];
+            r->terms[j] = t;
         }
-        // tmp = dest + accumulator
-        // dest = tmp
-        struct polynomial tmp;
-        polynomial_add(&tmp, dest, &accumulator);
-        dest->cap = tmp.cap;
-        dest->size = tmp.size;
-        free(dest->terms);
-        dest->terms = tmp.terms;
-        free(accumulator.terms);
+    arena_rewind(scratch, mark);
+    return true;
+}
+
+// g = 1 / f mod x^n by Newton's iteration g' = g (2 - f g), which doubles the
+// number of correct coefficients every step. g needs room for n coefficients.
+static void dense_inverse(double *g, const double *f, int n,
+                          struct arena *scratch) {
+    double *e = arena_alloc(scratch, sizeof(double) * 2 * n);
+    double *h = arena_alloc(scratch, sizeof(double) * 2 * n);
+    g[0] = 1 / f[0];
+    for (int len = 1; len < n;) {
+        int next = len * 2 < n ? len * 2 : n;
+        // e = 2 - f g mod x^next
+        pick_dense(next, len)(e, f, next, g, len);
+        for (int i = 0; i < next; ++i)
+            e[i] = -e[i];
+        e[0] += 2;
+        // g = g e mod x^next
+        pick_dense(len, next)(h, g, len, e, next);
+        memcpy(g, h, sizeof(double) * next);
+        len = next;
+    }
+}
+
+// Division through the reversed operands: with L = deg a - deg b + 1, the
+// quotient reversed is the reversed a times 1 / (the reversed b), modulo x^L.
+// Only the top L coefficients of both operands take part, so they are read
+// into dense buffers of that length whatever their lower terms look like.
+// returns whether q is exact, which it is for integer operands with a leading
+// coefficient of +-1
+static bool divmod_newton(struct polynomial *q, const struct polynomial *a,
+                          const struct polynomial *b, int top) {
+    int da = a->terms[a->size - 1].exp, db = b->terms[top].exp;
+    int len = da - db + 1;
+    struct arena *scratch = arena_scratch();
+    struct arena_mark mark = arena_mark(scratch);
+    double *ra = arena_alloc(scratch, sizeof(double) * len);
+    double *rb = arena_alloc(scratch, sizeof(double) * len);
+    memset(ra, 0, sizeof(double) * len);
+    memset(rb, 0, sizeof(double) * len);
+    for (int i = a->size - 1; i >= 0 && da - a->terms[i].exp < len; --i)
+        ra[da - a->terms[i].exp] = a->terms[i].coeff;
+    for (int i = top; i >= 0 && db - b->terms[i].exp < len; --i)
+        rb[db - b->terms[i].exp] = b->terms[i].coeff;
+    // then the quotient is an integer one, rounding makes it exact
+    bool integral = fabs(rb[0]) == 1;
+    for (int i = 0; i < a->size && integral; ++i)
+        integral = a->terms[i].coeff == nearbyint(a->terms[i].coeff);
+    for (int i = 0; i <= top && integral; ++i)
+        integral = b->terms[i].coeff == nearbyint(b->terms[i].coeff);
+    double *g = arena_alloc(scratch, sizeof(double) * len);
+    dense_inverse(g, rb, len, scratch);
+    double *rq = arena_alloc(scratch, sizeof(double) * (2 * len - 1));
+    pick_dense(len, len)(rq, ra, len, g, len);
+    // reverse the low len coefficients back into ascending order
+    for (int i = 0, j = len - 1; i < j; ++i, --j) {
+        double t = rq[i];
+        rq[i] = rq[j];
+        rq[j] = t;
+    }
+    // the transforms leave rounding noise where the quotient has no terms
+    double big = 0;
+    for (int i = 0; i < len; ++i)
+        big = fmax(big, fabs(rq[i]));
+    for (int i = 0; i < len; ++i)
+        if (integral)
+            rq[i] = nearbyint(rq[i]);
+        else if (fabs(rq[i]) <= DIVMOD_TOLERANCE * len * big)
+            rq[i] = 0;
+    from_dense(q, rq, len, 0);
+    arena_rewind(scratch, mark);
+    return integral;
+}
+
+int polynomial_divmod(struct polynomial *q, struct polynomial *r,
+                      const struct polynomial *a,
+                      const struct polynomial *b) {
+    polynomial_init(q);
+    if (r != NULL)
+        polynomial_init(r);
+    // the leading term of b, zero terms above it do not count
+    int top = b->size - 1;
+    while (top >= 0 && b->terms[top].coeff == 0)
+        --top;
+    if (top < 0) {
+        polynomial_release(q);
+        if (r != NULL)
+            polynomial_release(r);
+        return -1;
     }
+    int db = b->terms[top].exp;
+    if (a->size == 0 || a->terms[a->size - 1].exp < db) {
+        if (r != NULL) {
+            polynomial_release(r);
+            polynomial_copy(r, a);
+        }
+        return 0;
+    }
+    // The quotient spans len exponents. Long division multiplies every
+    // quotient term with b, the Newton path costs a handful of dense products
+    // of length len. How many terms the quotient has is only known once it is
+    // found, so long division gets to run until it has done as much work as
+    // the Newton path would.
+    double len = (double)a->terms[a->size - 1].exp - db + 1;
+    if (len > POLY_DENSE_MAX_SPAN) {
+        divmod_heap(q, r, a, b, top, INFINITY);
+        return 0;
+    }
+    double newton = 6 * cost_fft(len, len);
+    if (divmod_heap(q, r, a, b, top,
+                    newton / (2 * log2_at_least_1(len < a->size ? len
+                                                               : a->size))))
+        return 0;
+    bool exact = divmod_newton(q, a, b, top);
+    // r = a - q b, whose terms from deg b up cancel in exact arithmetic. The
+    // reciprocal of the reversed b can grow exponentially where the quotient
+    // itself does not, if they do not cancel the quotient is recomputed by
+    // long division.
+    struct polynomial qb, rest;
+    polynomial_mul(&qb, q, b);
+    polynomial_sub(&rest, a, &qb);
+    double scale = 0, err = 0;
+    for (int i = 0; i < a->size; ++i)
+        scale = fmax(scale, fabs(a->terms[i].coeff));
+    for (int i = 0; i < qb.size; ++i)
+        scale = fmax(scale, fabs(qb.terms[i].coeff));
+    polynomial_release(&qb);
+    int keep = lower_bound_exp(rest.terms, rest.size, db);
+    // written so that a NaN counts as an error
+    for (int i = keep; i < rest.size; ++i)
+        if (!(fabs(rest.terms[i].coeff) <= err))
+            err = fabs(rest.terms[i].coeff);
+    double tolerance = exact ? 0 : DIVMOD_TOLERANCE * len * scale;
+    if (!(err <= tolerance)) {
+        polynomial_release(&rest);
+        polynomial_release(q);
+        polynomial_init(q);
+        divmod_heap(q, r, a, b, top, INFINITY);
+        return 0;
+    }
+    // the remainder has the same residue where its terms cancel
+    int k = 0;
+    for (int i = 0; i < keep; ++i)
+        if (fabs(rest.terms[i].coeff) > tolerance)
+            rest.terms[k++] = rest.terms[i];
+    if (k < rest.size) {
+        rest.size = k;
+        touch(&rest);
+    }
+    if (r != NULL) {
+        polynomial_release(r);
+        polynomial_move(r, &rest);
+    } else {
+        polynomial_release(&rest);
+    }
+    return 0;
 }
@@ -1,6 +1,8 @@
 #ifndef POLYNOMIAL_H
 #define POLYNOMIAL_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 struct term {
@@ -8,19 +10,78 @@ struct term {
     int exp;
 };
 
+struct allocator;
+
+// terms a polynomial keeps in the struct itself before it needs the heap
+#define POLY_INLINE_TERMS 8
+
 struct polynomial {
     int size, cap;
+    // small, or an array of cap terms from alloc
     struct term *terms;
+    // owner of terms, the allocator current at polynomial_init
+    const struct allocator *alloc;
+    // Stamped from polynomial_stamp whenever the library creates or changes
+    // the terms, so two polynomials with the same version hold the same terms.
+    uint64_t version;
+    // Short polynomials live here without an allocation of their own. Since
+    // terms may point into the struct, a polynomial is moved with
+    // polynomial_move rather than by assignment.
+    struct term small[POLY_INLINE_TERMS];
 };
 
+// Fix up to after it was copied bytewise from from, which must still be
+// intact (hash tables call this on the data they copy, see
+// table_set_move_callback). from is given up to to.
+static inline void polynomial_moved(struct polynomial *to,
+                                    const struct polynomial *from) {
+    if (from->terms == from->small)
+        to->terms = to->small;
+}
+
+static inline void polynomial_move(struct polynomial *dest,
+                                   struct polynomial *src) {
+    *dest = *src;
+    polynomial_moved(dest, src);
+}
+
+// a version no polynomial has had before, never 0
+uint64_t polynomial_stamp(void);
+
 void polynomial_init(struct polynomial *);
+// grow the term array to hold at least cap terms
+void polynomial_reserve(struct polynomial *, int cap);
+// release the term array, for polynomials that are not heap allocated
+void polynomial_release(struct polynomial *);
+// release the term array and the polynomial itself
 void polynomial_free(struct polynomial *);
+// initialize dest with the terms (and the version) of src
+void polynomial_copy(struct polynomial *dest, const struct polynomial *src);
 struct polynomial *polynomial_parser(const char *);
+// Parse the n characters at str (no terminator needed) into dest, which gets
+// initialized. Returns 0, or -1 with the offset of the offending character
+// stored in err_pos (if not NULL) and dest left released.
+int polynomial_parse(struct polynomial *dest, const char *str, size_t n,
+                     size_t *err_pos);
 
 void polynomial_print_fp(const struct polynomial *, FILE *fp);
+// Print n terms that continue a polynomial. lead is set once anything has
+// been printed and tells later calls to print a sign before their first term.
+void polynomial_print_terms(const struct term *, int n, int *lead, FILE *fp);
 double polynomial_get_term(const struct polynomial *, int exp);
+// returns 1 if there is a term x^exp
+int polynomial_has_term(const struct polynomial *, int exp);
+// set the coefficient of x^exp
 void polynomial_add_term(struct polynomial *, int exp, double coeff);
+// returns 1 if there is no x^exp
 int polynomial_remove_term(struct polynomial *, int exp);
+// Set the coefficients of n terms in one pass over the polynomial, in
+// O(size + n log n). Of several terms with the same exponent the last one
+// counts, and a zero coefficient removes the term.
+void polynomial_set_terms(struct polynomial *, const struct term *terms,
+                          int n);
+// remove every x^exps[i] in one pass, returns the number of terms removed
+int polynomial_remove_terms(struct polynomial *, const int *exps, int n);
 
 void polynomial_add(struct polynomial *dest, const struct polynomial *a,
                     const struct polynomial *b);
@@ -29,4 +90,66 @@ void polynomial_sub(struct polynomial *dest, const struct polynomial *a,
 void polynomial_mul(struct polynomial *dest, const struct polynomial *a,
                     const struct polynomial *b);
 
+// dest = p^k, dest gets initialized. Powers of binomials, and of sparse
+// polynomials with integer coefficients while the result stays below 2^53,
+// come from J.C.P. Miller's recurrence (exact for the latter); the others
+// square and multiply. The recurrence is unstable in floating point in
+// general, so it is never used where it would have to round. Returns 0, or
+// -1 if an exponent of p^k does not fit in an int, leaving dest released.
+int polynomial_pow(struct polynomial *dest, const struct polynomial *p,
+                   unsigned k);
+
+// Divide a by b: a = q b + r where q has no negative exponents and every term
+// of r is below the leading term of b. q and r get initialized, r may be
+// NULL. Large dense quotients are computed from a Newton-iteration reciprocal
+// and fast multiplication (checked against a - q b, falling back when the
+// reciprocal is ill-conditioned), the others by sparse long division.
+// Returns 0, or -1 if b is zero, leaving q and r released.
+int polynomial_divmod(struct polynomial *q, struct polynomial *r,
+                      const struct polynomial *a, const struct polynomial *b);
+
+// In-place variants, dest must be initialized and may be the same as a:
+// dest += a, dest -= a, dest += a * b and dest -= a * b
+void polynomial_add_inplace(struct polynomial *dest,
+                            const struct polynomial *a);
+void polynomial_sub_inplace(struct polynomial *dest,
+                            const struct polynomial *a);
+void polynomial_fma(struct polynomial *dest, const struct polynomial *a,
+                    const struct polynomial *b);
+void polynomial_fms(struct polynomial *dest, const struct polynomial *a,
+                    const struct polynomial *b);
+
+// Value at x (exponents may be negative). polynomial_eval_many fills ys[i]
+// with the value at xs[i]; it runs on AVX2 or AVX-512 when the CPU has them,
+// where the fused multiply-add may round the last bit differently than
+// polynomial_eval.
+double polynomial_eval(const struct polynomial *, double x);
+void polynomial_eval_many(const struct polynomial *, const double *xs,
+                          double *ys, size_t n);
+
+// longest dense buffer (in terms) a multiplication engine may allocate
+#define POLY_DENSE_MAX_SPAN (1 << 24)
+
+enum polynomial_mul_algo {
+    POLY_MUL_AUTO, // pick by size and exponent span of the operands
+    POLY_MUL_HEAP,      // sparse k-way merge
+    POLY_MUL_KARATSUBA, // dense Karatsuba, never picked by POLY_MUL_AUTO
+    POLY_MUL_TOOM3,     // dense Toom-3 for mid-sized operands
+    POLY_MUL_FFT,       // dense floating-point FFT
+};
+
+// Threads the sparse engine may use for large products, 1 (the default) keeps
+// every product on the calling thread and 0 means one per online CPU. The
+// result is bit-identical for any thread count.
+void polynomial_mul_set_threads(int n);
+int polynomial_mul_threads(void);
+
+// The engine polynomial_mul would use for these operands
+enum polynomial_mul_algo polynomial_mul_select(const struct polynomial *a,
+                                               const struct polynomial *b);
+const char *polynomial_mul_algo_name(enum polynomial_mul_algo);
+void polynomial_mul_with(struct polynomial *dest, const struct polynomial *a,
+                         const struct polynomial *b,
+                         enum polynomial_mul_algo algo);
+
 #endif
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE // accept4 and writer-preferring rwlocks
+#include "server.h"
+#include "alloc.h"
+#include "batch.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// input taken from a connection before its commands run, so one client
+// flooding the server cannot hold a worker forever
+#define SERVER_READ_CHUNK ((size_t)1 << 20)
+// a client sending a longer line is disconnected
+#define SERVER_MAX_LINE ((size_t)1 << 24)
+
+struct conn {
+    int fd;
+    bool listener;
+    struct batch view; // made by the first worker serving the connection
+    // received but not executed yet
+    char *buf;
+    size_t len, cap;
+    struct conn *prev, *next;
+};
+
+struct server {
+    struct batch session;
+    // shared by read-only commands, exclusive for everything else
+    pthread_rwlock_t lock;
+    int epfd;
+    // Connections with input, handed from the event loop to the workers.
+    // EPOLLONESHOT keeps a connection out of the queue until the worker
+    // serving it is done, so its commands run in order.
+    pthread_mutex_t mu;
+    pthread_cond_t ready;
+    struct conn **queue;
+    size_t head, count, cap;
+    // every connection, closed at shutdown
+    struct conn *conns;
+    bool stop;
+};
+
+static volatile sig_atomic_t stop_signal;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_signal = 1;
+}
+
+static void watch(struct server *s, struct conn *c, int op) {
+    struct epoll_event ev = {.data.ptr = c};
+    ev.events = c->listener ? EPOLLIN : EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    epoll_ctl(s->epfd, op, c->fd, &ev);
+}
+
+static void add_conn(struct server *s, int fd, bool listener) {
+    struct conn *c = calloc(1, sizeof(struct conn));
+    c->fd = fd;
+    c->listener = listener;
+    pthread_mutex_lock(&s->mu);
+    c->next = s->conns;
+    if (s->conns != NULL)
+        s->conns->prev = c;
+    s->conns = c;
+    pthread_mutex_unlock(&s->mu);
+    watch(s, c, EPOLL_CTL_ADD);
+}
+
+static void drop_conn(struct server *s, struct conn *c) {
+    pthread_mutex_lock(&s->mu);
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        s->conns = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    pthread_mutex_unlock(&s->mu);
+    close(c->fd); // leaves the epoll set with it
+    free(c->buf);
+    free(c);
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    // a socket left behind by an earlier run, never any other file
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_tcp(int port) {
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_port = htons((uint16_t)port),
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_all(struct server *s, int listener) {
+    for (;;) {
+        // blocking, reads ask for MSG_DONTWAIT themselves
+        int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        add_conn(s, fd, false);
+    }
+}
+
+static void enqueue(struct server *s, struct conn *c) {
+    pthread_mutex_lock(&s->mu);
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 64;
+        struct conn **queue = malloc(sizeof(struct conn *) * cap);
+        for (size_t i = 0; i < s->count; ++i)
+            queue[i] = s->queue[(s->head + i) % s->cap];
+        free(s->queue);
+        s->queue = queue;
+        s->head = 0;
+        s->cap = cap;
+    }
+    s->queue[(s->head + s->count++) % s->cap] = c;
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->mu);
+}
+
+// Read what the client has sent so far, up to SERVER_READ_CHUNK. Returns
+// false once it has closed its end or the connection failed.
+static bool receive(struct conn *c) {
+    for (size_t got = 0; got < SERVER_READ_CHUNK;) {
+        // one byte stays free for terminating a last line without newline
+        if (c->cap - c->len < 4096) {
+            c->cap = c->cap ? c->cap * 2 : 65536;
+            c->buf = realloc(c->buf, c->cap);
+        }
+        ssize_t n =
+            recv(c->fd, c->buf + c->len, c->cap - c->len - 1, MSG_DONTWAIT);
+        if (n > 0) {
+            c->len += n;
+            got += n;
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN &&
+                              errno != EWOULDBLOCK)) {
+            return false;
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    return true;
+}
+
+static void send_all(int fd, const char *data, size_t n) {
+    while (n > 0) {
+        ssize_t sent = send(fd, data, n, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return; // the next receive notices
+        data += sent;
+        n -= sent;
+    }
+}
+
+static int exec(struct server *s, struct batch *view, char *line) {
+    pthread_rwlock_rdlock(&s->lock);
+    if (!batch_read_only(view, line)) {
+        // a product is computed beside the readers, only defining it needs
+        // the lock to itself
+        batch_prepare(view, line);
+        pthread_rwlock_unlock(&s->lock);
+        pthread_rwlock_wrlock(&s->lock);
+    }
+    int ret = batch_exec(view, line);
+    pthread_rwlock_unlock(&s->lock);
+    return ret;
+}
+
+// Run every complete line the client has sent, and the last one once it has
+// closed its end, then send all results at once. Returns false when the
+// connection is done.
+static bool serve(struct server *s, struct conn *c) {
+    bool open = receive(c);
+    // not on accept, where waiting for the lock would stall the event loop
+    if (c->view.session == NULL) {
+        pthread_rwlock_rdlock(&s->lock);
+        batch_view(&c->view, &s->session, NULL);
+        pthread_rwlock_unlock(&s->lock);
+    }
+    char *text = NULL;
+    size_t size = 0, done = 0;
+    FILE *out = open_memstream(&text, &size);
+    c->view.out = c->view.err = out;
+    bool quit = false;
+    while (!quit && done < c->len) {
+        char *line = c->buf + done;
+        char *eol = memchr(line, '\n', c->len - done);
+        if (eol == NULL && open)
+            break;
+        if (eol == NULL)
+            eol = c->buf + c->len;
+        *eol = 0;
+        done = eol - c->buf + (eol < c->buf + c->len);
+        c->view.line++;
+        quit = exec(s, &c->view, line) < 0;
+        // scratch memory never outlives a command
+        arena_reset(arena_scratch());
+    }
+    c->len -= done;
+    memmove(c->buf, c->buf + done, c->len);
+    if (open && !quit && c->len >= SERVER_MAX_LINE) {
+        fprintf(out, "line %ld: error: line too long\n", c->view.line + 1);
+        open = false;
+    }
+    fclose(out);
+    send_all(c->fd, text, size);
+    free(text);
+    return open && !quit;
+}
+
+static void *worker(void *arg) {
+    struct server *s = arg;
+    for (;;) {
+        pthread_mutex_lock(&s->mu);
+        while (s->count == 0 && !s->stop)
+            pthread_cond_wait(&s->ready, &s->mu);
+        if (s->stop) {
+            pthread_mutex_unlock(&s->mu);
+            break;
+        }
+        struct conn *c = s->queue[s->head];
+        s->head = (s->head + 1) % s->cap;
+        s->count--;
+        pthread_mutex_unlock(&s->mu);
+        if (serve(s, c))
+            watch(s, c, EPOLL_CTL_MOD);
+        else
+            drop_conn(s, c);
+    }
+    arena_destroy(arena_scratch());
+    return NULL;
+}
+
+int server_run(const struct server_config *cfg) {
+    struct server *s = calloc(1, sizeof(struct server));
+    batch_init(&s->session, stdout);
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // a steady stream of readers must not starve the writers
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&s->lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    int ret = 0;
+    if (cfg->path != NULL) {
+        int fd = listen_unix(cfg->path);
+        if (fd < 0) {
+            perror(cfg->path);
+            ret = -1;
+        } else {
+            add_conn(s, fd, true);
+        }
+    }
+    if (ret == 0 && cfg->port > 0) {
+        int fd = listen_tcp(cfg->port);
+        if (fd < 0) {
+            fprintf(stderr, "127.0.0.1:%d: %s\n", cfg->port, strerror(errno));
+            ret = -1;
+        } else {
+            add_conn(s, fd, true);
+        }
+    }
+
+    int nworkers = 0;
+    pthread_t *workers = NULL;
+    if (ret == 0) {
+        // the workers leave the stop signals to this thread
+        sigset_t block, old;
+        sigemptyset(&block);
+        sigaddset(&block, SIGINT);
+        sigaddset(&block, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &block, &old);
+        nworkers = cfg->threads > 0 ? cfg->threads
+                                    : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (nworkers < 1)
+            nworkers = 1;
+        workers = malloc(sizeof(pthread_t) * nworkers);
+        for (int i = 0; i < nworkers; ++i)
+            pthread_create(&workers[i], NULL, worker, s);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        struct sigaction sa = {.sa_handler = on_signal};
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        while (!stop_signal) {
+            struct epoll_event ev[64];
+            int n = epoll_wait(s->epfd, ev, 64, -1);
+            for (int i = 0; i < n; ++i) {
+                struct conn *c = ev[i].data.ptr;
+                if (c->listener)
+                    accept_all(s, c->fd);
+                else
+                    enqueue(s, c);
+            }
+            if (n < 0 && errno != EINTR) {
+                perror("epoll_wait");
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&s->mu);
+    s->stop = true;
+    pthread_cond_broadcast(&s->ready);
+    pthread_mutex_unlock(&s->mu);
+    for (int i = 0; i < nworkers; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    while (s->conns != NULL)
+        drop_conn(s, s->conns);
+    if (cfg->path != NULL && ret == 0)
+        unlink(cfg->path);
+    close(s->epfd);
+    free(s->queue);
+    batch_free(&s->session);
+    pthread_rwlock_destroy(&s->lock);
+    pthread_mutex_destroy(&s->mu);
+    pthread_cond_destroy(&s->ready);
+    free(s);
+    return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Local server for the batch command language (see batch.h). Clients connect
+// to a Unix domain socket, or to a TCP port on the loopback interface, and
+// send commands one per line; results and diagnostics come back on the same
+// connection in the order of the commands. A client may send any number of
+// commands without waiting for their results.
+//
+// Every client works on the same polynomials. Commands that only read them
+// (see batch_read_only) run concurrently under a shared lock, every other
+// command holds the lock exclusively; a mul multiplies under the shared lock
+// and takes it exclusively only to define the product (see batch_prepare).
+// quit ends the connection only, and threads is refused since it would
+// change the setting for every client.
+struct server_config {
+    const char *path; // Unix socket, NULL for none
+    int port;         // TCP port on 127.0.0.1, 0 for none
+    int threads;      // workers, 0 for one per CPU
+};
+
+// Serve until SIGINT or SIGTERM. Returns 0, or -1 if a socket cannot be set
+// up (with a message on stderr).
+int server_run(const struct server_config *);
+
+#endif
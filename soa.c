@@ -0,0 +1,368 @@
+#include "soa.h"
+#include "alloc.h"
+#include "polynomial.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SOA_X86 1
+#endif
+
+#define SOA_ALIGN 64
+// terms soa_print_fp hands to the printer at once
+#define SOA_PRINT_BLOCK 64
+
+static inline size_t align_up(size_t n) {
+    return (n + SOA_ALIGN - 1) & ~(size_t)(SOA_ALIGN - 1);
+}
+
+static inline size_t block_size(int cap) {
+    return align_up(sizeof(int) * cap) + sizeof(double) * cap + SOA_ALIGN;
+}
+
+// point exp and coeff into a block of block_size(cap) bytes
+static void soa_layout(struct poly_soa *p, void *block, int cap) {
+    uintptr_t base = align_up((uintptr_t)block);
+    p->block = block;
+    p->cap = cap;
+    p->exp = (int *)base;
+    p->coeff = (double *)(base + align_up(sizeof(int) * cap));
+}
+
+void soa_init(struct poly_soa *p, int cap) {
+    if (cap < 16)
+        cap = 16;
+    p->size = 0;
+    p->alloc = allocator_current();
+    void *block = allocator_alloc(p->alloc, block_size(cap));
+    assert(block != NULL);
+    soa_layout(p, block, cap);
+}
+
+void soa_release(struct poly_soa *p) {
+    allocator_release(p->alloc, p->block, block_size(p->cap));
+    p->block = NULL;
+    p->exp = NULL;
+    p->coeff = NULL;
+    p->size = p->cap = 0;
+}
+
+// the arrays move relative to the block, so growing copies them over
+void soa_reserve(struct poly_soa *p, int cap) {
+    if (p->cap >= cap)
+        return;
+    struct poly_soa grown = {.size = p->size, .alloc = p->alloc};
+    void *block = allocator_alloc(p->alloc, block_size(cap));
+    assert(block != NULL);
+    soa_layout(&grown, block, cap);
+    memcpy(grown.exp, p->exp, sizeof(int) * p->size);
+    memcpy(grown.coeff, p->coeff, sizeof(double) * p->size);
+    allocator_release(p->alloc, p->block, block_size(p->cap));
+    *p = grown;
+}
+
+void soa_from_terms(struct poly_soa *dest, const struct polynomial *src) {
+    soa_init(dest, src->size);
+    for (int i = 0; i < src->size; ++i) {
+        dest->exp[i] = src->terms[i].exp;
+        dest->coeff[i] = src->terms[i].coeff;
+    }
+    dest->size = src->size;
+}
+
+void soa_to_terms(struct polynomial *dest, const struct poly_soa *src) {
+    polynomial_init(dest);
+    polynomial_reserve(dest, src->size);
+    for (int i = 0; i < src->size; ++i)
+        dest->terms[i] = (struct term){.coeff = src->coeff[i],
+                                       .exp = src->exp[i]};
+    dest->size = src->size;
+}
+
+double soa_get_term(const struct poly_soa *p, int exp) {
+    int lo = 0, hi = p->size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (p->exp[mid] < exp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < p->size && p->exp[lo] == exp ? p->coeff[lo] : 0;
+}
+
+// the terms go to the printer a block at a time
+void soa_print_fp(const struct poly_soa *p, FILE *fp) {
+    struct term block[SOA_PRINT_BLOCK];
+    int lead = 0, i = 0;
+    do {
+        int n = p->size - i < SOA_PRINT_BLOCK ? p->size - i : SOA_PRINT_BLOCK;
+        for (int j = 0; j < n; ++j)
+            block[j] = (struct term){.coeff = p->coeff[i + j],
+                                     .exp = p->exp[i + j]};
+        polynomial_print_terms(block, n, &lead, fp);
+        i += n;
+    } while (i < p->size);
+}
+
+// ---- compaction ----
+
+static int compact_scalar(int *exp, double *coeff, int from, int n) {
+    int k = from;
+    for (int i = from; i < n; ++i) {
+        // always store, advance only past non-zero terms
+        exp[k] = exp[i];
+        coeff[k] = coeff[i];
+        k += coeff[i] != 0;
+    }
+    return k;
+}
+
+#ifdef SOA_X86
+__attribute__((target("avx512f,avx512vl"))) static int
+compact_avx512(int *exp, double *coeff, int from, int n) {
+    int k = from, i = from;
+    __m512d zero = _mm512_setzero_pd();
+    for (; i + 8 <= n; i += 8) {
+        __m512d c = _mm512_loadu_pd(coeff + i);
+        __m256i e = _mm256_loadu_si256((const __m256i *)(exp + i));
+        __mmask8 keep = _mm512_cmp_pd_mask(c, zero, _CMP_NEQ_UQ);
+        // k never passes i, so the stores only touch what was read already
+        _mm512_mask_compressstoreu_pd(coeff + k, keep, c);
+        _mm256_mask_compressstoreu_epi32(exp + k, keep, e);
+        k += __builtin_popcount(keep);
+    }
+    for (; i < n; ++i) {
+        exp[k] = exp[i];
+        coeff[k] = coeff[i];
+        k += coeff[i] != 0;
+    }
+    return k;
+}
+#endif
+
+// the compaction for the running CPU, picked once by select_compact
+static int (*compact)(int *, double *, int, int);
+static pthread_once_t compact_once = PTHREAD_ONCE_INIT;
+
+static void select_compact(void) {
+    int (*k)(int *, double *, int, int) = compact_scalar;
+#ifdef SOA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vl"))
+        k = compact_avx512;
+#endif
+    compact = k;
+}
+
+int soa_compact(struct poly_soa *p) {
+    int from = 0;
+    // nothing moves before the first zero
+    while (from < p->size && p->coeff[from] != 0)
+        ++from;
+    if (from == p->size)
+        return 0;
+    pthread_once(&compact_once, select_compact);
+    int k = compact(p->exp, p->coeff, from, p->size);
+    int dropped = p->size - k;
+    p->size = k;
+    return dropped;
+}
+
+// ---- element-wise ----
+
+// cloned for the vector extensions and picked when the program loads
+__attribute__((target_clones("avx512f", "avx2", "default"))) static void
+scale(double *coeff, int n, double c) {
+    for (int i = 0; i < n; ++i)
+        coeff[i] *= c;
+}
+
+void soa_scale(struct poly_soa *p, double c) {
+    scale(p->coeff, p->size, c);
+    soa_compact(p);
+}
+
+void soa_neg(struct poly_soa *p) { scale(p->coeff, p->size, -1); }
+
+// ---- merge ----
+
+// v if cond is 1, +0 if it is 0, without a branch or a multiplication that
+// would turn an infinity into a NaN
+static inline double keep_if(double v, int cond) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits &= -(uint64_t)cond;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// out = a + sign * b. Every step takes the smaller exponent, or both when
+// they are equal, through selects rather than branches, and only advances the
+// output past non-zero sums, so cancelled terms never become visible.
+static int merge_scalar(int *oe, double *oc, const int *ae, const double *ac,
+                        int na, const int *be, const double *bc, int nb,
+                        double sign) {
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        int x = ae[i], y = be[j];
+        int take_a = x <= y, take_b = x >= y;
+        double c = keep_if(ac[i], take_a) + keep_if(sign * bc[j], take_b);
+        oe[k] = x < y ? x : y;
+        oc[k] = c;
+        i += take_a;
+        j += take_b;
+        k += c != 0;
+    }
+    memcpy(oe + k, ae + i, sizeof(int) * (na - i));
+    memcpy(oc + k, ac + i, sizeof(double) * (na - i));
+    k += na - i;
+    for (; j < nb; ++j, ++k) {
+        oe[k] = be[j];
+        oc[k] = sign * bc[j];
+    }
+    return k;
+}
+
+#ifdef SOA_X86
+#define SOA_AVX512 __attribute__((target("avx512f,avx512vl")))
+
+// One step of a bitonic merge within each 8-lane vector: every lane meets the
+// lane perm names, and the lanes of high keep the larger key of the two.
+SOA_AVX512 static inline __m512i bitonic_step(__m512i x, __m512i perm,
+                                              __mmask8 high) {
+    __m512i y = _mm512_permutexvar_epi64(perm, x);
+    return _mm512_mask_blend_epi64(high, _mm512_min_epi64(x, y),
+                                   _mm512_max_epi64(x, y));
+}
+
+// sort a bitonic sequence of 8 keys
+SOA_AVX512 static inline __m512i bitonic_sort8(__m512i x) {
+    x = bitonic_step(x, _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4), 0xf0);
+    x = bitonic_step(x, _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2), 0xcc);
+    return bitonic_step(x, _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1), 0xaa);
+}
+
+// Write the terms of keep, 8 lanes are stored whatever keep holds
+SOA_AVX512 static inline int emit(int *oe, double *oc, __mmask8 keep,
+                                  __m512i e, __m512d c) {
+    _mm256_storeu_si256((__m256i *)oe,
+                        _mm256_maskz_compress_epi32(
+                            keep, _mm512_cvtepi64_epi32(e)));
+    _mm512_storeu_pd(oc, _mm512_maskz_compress_pd(keep, c));
+    return __builtin_popcount(keep);
+}
+
+// Merges 8 terms of each operand at a time. The exponents of both blocks
+// are widened to 64-bit keys that carry the lane they came from in their low
+// 4 bits and sorted together by a bitonic network; the lanes then fetch
+// their coefficients by permutation. Like terms land next to each other
+// (the one of a first) and are summed into the first. Only the exponents up
+// to the smaller of the two last ones are final, the blocks start again from
+// the first term that is not. A block that lies wholly before the other one
+// is copied as it is. The output is written in whole vectors, past the terms
+// kept but never past the a->size + b->size terms it has room for.
+SOA_AVX512 static int merge_avx512(int *oe, double *oc, const int *ae,
+                                   const double *ac, int na, const int *be,
+                                   const double *bc, int nb, double sign) {
+    const __m512i rev = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m512i next = _mm512_set_epi64(8, 7, 6, 5, 4, 3, 2, 1);
+    const __m512i lane_a = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i lane_b = _mm512_set_epi64(15, 14, 13, 12, 11, 10, 9, 8);
+    const __m512i low = _mm512_set1_epi64(15);
+    const __m512d vsign = _mm512_set1_pd(sign), zero = _mm512_setzero_pd();
+    int i = 0, j = 0, k = 0;
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i xa = _mm256_loadu_si256((const __m256i *)(ae + i));
+        __m256i xb = _mm256_loadu_si256((const __m256i *)(be + j));
+        __m512d ca = _mm512_loadu_pd(ac + i);
+        __m512d cb = _mm512_mul_pd(_mm512_loadu_pd(bc + j), vsign);
+        int last_a = ae[i + 7], last_b = be[j + 7];
+        if (last_a < be[j] || last_b < ae[i]) {
+            int first_a = last_a < be[j];
+            __m256i x = first_a ? xa : xb;
+            __m512d c = first_a ? ca : cb;
+            k += emit(oe + k, oc + k, _mm512_cmp_pd_mask(c, zero, _CMP_NEQ_UQ),
+                      _mm512_cvtepi32_epi64(x), c);
+            i += first_a ? 8 : 0;
+            j += first_a ? 0 : 8;
+            continue;
+        }
+        __m512i ka = _mm512_add_epi64(
+            _mm512_slli_epi64(_mm512_cvtepi32_epi64(xa), 4), lane_a);
+        __m512i kb = _mm512_add_epi64(
+            _mm512_slli_epi64(_mm512_cvtepi32_epi64(xb), 4), lane_b);
+        kb = _mm512_permutexvar_epi64(rev, kb);
+        __m512i lo = bitonic_sort8(_mm512_min_epi64(ka, kb));
+        __m512i hi = bitonic_sort8(_mm512_max_epi64(ka, kb));
+        __m512d clo = _mm512_permutex2var_pd(ca, _mm512_and_si512(lo, low), cb);
+        __m512d chi = _mm512_permutex2var_pd(ca, _mm512_and_si512(hi, low), cb);
+        lo = _mm512_srai_epi64(lo, 4);
+        hi = _mm512_srai_epi64(hi, 4);
+        // a lane and the one after it hold like terms
+        __mmask8 like_lo = _mm512_cmpeq_epi64_mask(
+            lo, _mm512_permutex2var_epi64(lo, next, hi));
+        __mmask8 like_hi = _mm512_cmpeq_epi64_mask(
+                               hi, _mm512_permutex2var_epi64(hi, next, hi)) &
+                           0x7f;
+        clo = _mm512_mask_add_pd(clo, like_lo, clo,
+                                 _mm512_permutex2var_pd(clo, next, chi));
+        chi = _mm512_mask_add_pd(chi, like_hi, chi,
+                                 _mm512_permutex2var_pd(chi, next, chi));
+        __m512i m = _mm512_set1_epi64(last_a < last_b ? last_a : last_b);
+        __mmask8 keep_lo = _mm512_cmple_epi64_mask(lo, m) &
+                           _mm512_cmp_pd_mask(clo, zero, _CMP_NEQ_UQ) &
+                           (__mmask8)~(like_lo << 1);
+        __mmask8 keep_hi = _mm512_cmple_epi64_mask(hi, m) &
+                           _mm512_cmp_pd_mask(chi, zero, _CMP_NEQ_UQ) &
+                           (__mmask8)~(like_hi << 1 | like_lo >> 7);
+        k += emit(oe + k, oc + k, keep_lo, lo, clo);
+        k += emit(oe + k, oc + k, keep_hi, hi, chi);
+        __m256i vm = _mm256_set1_epi32(last_a < last_b ? last_a : last_b);
+        i += __builtin_popcount(_mm256_cmple_epi32_mask(xa, vm));
+        j += __builtin_popcount(_mm256_cmple_epi32_mask(xb, vm));
+    }
+    return k + merge_scalar(oe + k, oc + k, ae + i, ac + i, na - i, be + j,
+                            bc + j, nb - j, sign);
+}
+#endif
+
+// the merge for the running CPU, picked once by select_merge
+static int (*merge)(int *, double *, const int *, const double *, int,
+                    const int *, const double *, int, double);
+static pthread_once_t merge_once = PTHREAD_ONCE_INIT;
+
+static void select_merge(void) {
+    int (*k)(int *, double *, const int *, const double *, int, const int *,
+             const double *, int, double) = merge_scalar;
+#ifdef SOA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512vl"))
+        k = merge_avx512;
+#endif
+    merge = k;
+}
+
+static void add_signed(struct poly_soa *dest, const struct poly_soa *a,
+                       const struct poly_soa *b, double sign) {
+    soa_init(dest, a->size + b->size);
+    pthread_once(&merge_once, select_merge);
+    dest->size = merge(dest->exp, dest->coeff, a->exp, a->coeff, a->size,
+                       b->exp, b->coeff, b->size, sign);
+}
+
+void soa_add(struct poly_soa *dest, const struct poly_soa *a,
+             const struct poly_soa *b) {
+    add_signed(dest, a, b, 1);
+}
+
+void soa_sub(struct poly_soa *dest, const struct poly_soa *a,
+             const struct poly_soa *b) {
+    add_signed(dest, a, b, -1);
+}
@@ -0,0 +1,55 @@
+#ifndef SOA_H
+#define SOA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Structure-of-arrays polynomial: exponents and coefficients in separate
+// arrays, each 64 byte aligned, so a cache line holds 16 exponents or 8
+// coefficients instead of 4 padded terms. Terms are sorted by exponent like
+// in struct polynomial and the two layouts convert into each other. The
+// layout command of batch.h keeps polynomials in it.
+//
+// add and sub merge 8 terms of each operand at a time with AVX-512 when the
+// CPU has it: a sorting network orders the exponents of both blocks, like
+// terms are summed in the registers and the compress instructions drop the
+// ones that cancel. Otherwise, and for the tail, a branchless scalar merge
+// steps over cancelled terms as it writes, so an unpredictable interleaving
+// of the operands costs no mispredictions. Scaling is vectorized as well.
+struct allocator;
+struct polynomial;
+
+struct poly_soa {
+    int size, cap;
+    int *exp;
+    double *coeff;
+    void *block; // holds both arrays
+    // owner of block, the allocator current at soa_init
+    const struct allocator *alloc;
+};
+
+void soa_init(struct poly_soa *, int cap);
+void soa_release(struct poly_soa *);
+// grow both arrays to hold at least cap terms
+void soa_reserve(struct poly_soa *, int cap);
+
+// dest gets initialized
+void soa_from_terms(struct poly_soa *dest, const struct polynomial *src);
+void soa_to_terms(struct polynomial *dest, const struct poly_soa *src);
+
+double soa_get_term(const struct poly_soa *, int exp);
+// same output as polynomial_print_fp
+void soa_print_fp(const struct poly_soa *, FILE *fp);
+
+// dest = a + b and dest = a - b, dest gets initialized
+void soa_add(struct poly_soa *dest, const struct poly_soa *a,
+             const struct poly_soa *b);
+void soa_sub(struct poly_soa *dest, const struct poly_soa *a,
+             const struct poly_soa *b);
+// multiply every coefficient by c, dropping the terms that become zero
+void soa_scale(struct poly_soa *, double c);
+void soa_neg(struct poly_soa *);
+// drop terms with a zero coefficient, returns how many were dropped
+int soa_compact(struct poly_soa *);
+
+#endif
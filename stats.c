@@ -0,0 +1,183 @@
+#include "stats.h"
+
+#ifdef POLY_STATS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+// values below 16 get a bucket each, every power of two above is split in 8
+#define SUB_BITS 3
+#define LINEAR (2 << SUB_BITS)
+#define BUCKETS (LINEAR + (64 - SUB_BITS - 1) * (1 << SUB_BITS))
+
+struct histogram {
+    atomic_uint_fast64_t count, sum, max;
+    atomic_uint_fast64_t buckets[BUCKETS];
+};
+
+static const char *counter_names[STATS_NCOUNTERS] = {
+    "allocs",         "alloc_bytes",   "resizes",
+    "resize_bytes",   "releases",      "scratch_bytes",
+    "term_copies",    "table_lookups", "table_collisions",
+    "table_rehashes", "spill_bytes"};
+
+static const char *histogram_names[STATS_NHISTOGRAMS] = {"table_probe"};
+
+static atomic_uint_fast64_t counters[STATS_NCOUNTERS];
+static struct histogram histograms[STATS_NHISTOGRAMS];
+
+// latency histograms by name, an entry is complete before nlatency counts it
+static struct {
+    char name[16];
+    struct histogram h;
+} latency[STATS_MAX_LATENCY];
+static atomic_int nlatency;
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int bucket_of(uint64_t v) {
+    if (v < LINEAR)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    return LINEAR + (e - SUB_BITS - 1) * (1 << SUB_BITS) +
+           (int)((v >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+}
+
+// largest value that falls into bucket i
+static uint64_t bucket_top(int i) {
+    if (i < LINEAR)
+        return (uint64_t)i;
+    int e = (i - LINEAR) / (1 << SUB_BITS) + SUB_BITS + 1;
+    uint64_t sub = (uint64_t)((i - LINEAR) % (1 << SUB_BITS));
+    uint64_t width = (uint64_t)1 << (e - SUB_BITS);
+    return ((uint64_t)1 << e) + (sub + 1) * width - 1;
+}
+
+static void add(struct histogram *h, uint64_t v) {
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(v)], 1,
+                              memory_order_relaxed);
+    uint_fast64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (v > max && !atomic_compare_exchange_weak_explicit(
+                          &h->max, &max, v, memory_order_relaxed,
+                          memory_order_relaxed))
+        ;
+}
+
+void stats_count(enum stats_counter c, uint64_t n) {
+    atomic_fetch_add_explicit(&counters[c], n, memory_order_relaxed);
+}
+
+void stats_record(enum stats_histogram h, uint64_t value) {
+    add(&histograms[h], value);
+}
+
+uint64_t stats_clock(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+
+static struct histogram *find_latency(const char *name) {
+    int n = atomic_load_explicit(&nlatency, memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        if (strcmp(latency[i].name, name) == 0)
+            return &latency[i].h;
+    return NULL;
+}
+
+void stats_latency(const char *name, uint64_t ns) {
+    struct histogram *h = find_latency(name);
+    if (h == NULL && strlen(name) < sizeof(latency[0].name)) {
+        pthread_mutex_lock(&latency_lock);
+        h = find_latency(name);
+        int n = atomic_load_explicit(&nlatency, memory_order_relaxed);
+        if (h == NULL && n < STATS_MAX_LATENCY) {
+            strcpy(latency[n].name, name);
+            h = &latency[n].h;
+            atomic_store_explicit(&nlatency, n + 1, memory_order_release);
+        }
+        pthread_mutex_unlock(&latency_lock);
+    }
+    if (h != NULL)
+        add(h, ns);
+}
+
+// smallest bucket top that at least q of the values do not exceed
+static uint64_t percentile(const struct histogram *h, uint64_t count,
+                           double q) {
+    uint64_t want = (uint64_t)(q * count + 0.5), seen = 0;
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if (seen >= want && seen > 0)
+            return bucket_top(i) < max ? bucket_top(i) : max;
+    }
+    return max;
+}
+
+static void print_histogram(FILE *fp, const char *name,
+                            const struct histogram *h) {
+    uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    uint64_t sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+    fprintf(fp,
+            "\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%llu,"
+            "\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+            name, (unsigned long long)count,
+            count > 0 ? (double)sum / count : 0.0,
+            (unsigned long long)percentile(h, count, 0.5),
+            (unsigned long long)percentile(h, count, 0.9),
+            (unsigned long long)percentile(h, count, 0.99),
+            (unsigned long long)atomic_load_explicit(&h->max,
+                                                     memory_order_relaxed));
+}
+
+void stats_print_json(FILE *fp) {
+    fprintf(fp, "{\"enabled\":true,\"counters\":{");
+    for (int i = 0; i < STATS_NCOUNTERS; ++i)
+        fprintf(fp, "%s\"%s\":%llu", i > 0 ? "," : "", counter_names[i],
+                (unsigned long long)atomic_load_explicit(
+                    &counters[i], memory_order_relaxed));
+    fprintf(fp, "},\"histograms\":{");
+    for (int i = 0; i < STATS_NHISTOGRAMS; ++i) {
+        if (i > 0)
+            fputc(',', fp);
+        print_histogram(fp, histogram_names[i], &histograms[i]);
+    }
+    fprintf(fp, "},\"latency_ns\":{");
+    int n = atomic_load_explicit(&nlatency, memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        if (i > 0)
+            fputc(',', fp);
+        print_histogram(fp, latency[i].name, &latency[i].h);
+    }
+    fprintf(fp, "}}\n");
+}
+
+static void clear(struct histogram *h) {
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+    for (int i = 0; i < BUCKETS; ++i)
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+}
+
+void stats_reset(void) {
+    for (int i = 0; i < STATS_NCOUNTERS; ++i)
+        atomic_store_explicit(&counters[i], 0, memory_order_relaxed);
+    for (int i = 0; i < STATS_NHISTOGRAMS; ++i)
+        clear(&histograms[i]);
+    int n = atomic_load_explicit(&nlatency, memory_order_acquire);
+    for (int i = 0; i < n; ++i)
+        clear(&latency[i].h);
+}
+
+#else
+
+void stats_print_json(FILE *fp) { fprintf(fp, "{\"enabled\":false}\n"); }
+
+void stats_reset(void) {}
+
+#endif
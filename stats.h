@@ -0,0 +1,68 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Instrumentation of the library: event counters and log-linear histograms
+// (in the style of HdrHistogram, 8 buckets per power of two, so a percentile
+// is off by at most 12.5%). It is compiled in with -DPOLY_STATS (make
+// stats); without it the STATS_* hooks expand to nothing and cost nothing.
+//
+// Everything is global and updated with relaxed atomics, so threads can
+// record at the same time and a snapshot is only roughly consistent.
+
+enum stats_counter {
+    STATS_ALLOCS,           // allocator_alloc calls
+    STATS_ALLOC_BYTES,      // and the bytes they asked for
+    STATS_RESIZES,          // allocator_resize calls
+    STATS_RESIZE_BYTES,     // and the bytes they grew or shrank by
+    STATS_RELEASES,         // allocator_release calls
+    STATS_SCRATCH_BYTES,    // taken from arenas
+    STATS_TERM_COPIES,      // terms moved by copies and reallocations
+    STATS_TABLE_LOOKUPS,    // hash table searches by key
+    STATS_TABLE_COLLISIONS, // slots whose hash byte matched another key
+    STATS_TABLE_REHASHES,
+    STATS_SPILL_BYTES,      // written to temporary files by extmul
+    STATS_NCOUNTERS
+};
+
+// histograms with a fixed name, named ones come from stats_latency
+enum stats_histogram {
+    STATS_TABLE_PROBE, // groups a hash table search visits
+    STATS_NHISTOGRAMS
+};
+
+#ifdef POLY_STATS
+
+void stats_count(enum stats_counter, uint64_t n);
+void stats_record(enum stats_histogram, uint64_t value);
+// monotonic clock in nanoseconds
+uint64_t stats_clock(void);
+// Add ns to the latency histogram of name (say a command), created on first
+// use. Names beyond the first STATS_MAX_LATENCY are not recorded.
+#define STATS_MAX_LATENCY 64
+void stats_latency(const char *name, uint64_t ns);
+
+#define STATS_COUNT(counter, n) stats_count((counter), (n))
+#define STATS_RECORD(histogram, value) stats_record((histogram), (value))
+#define STATS_TIMER(start) uint64_t start = stats_clock()
+#define STATS_LATENCY(name, start)                                          \
+    stats_latency((name), stats_clock() - (start))
+
+#else
+
+#define STATS_COUNT(counter, n) ((void)0)
+#define STATS_RECORD(histogram, value) ((void)0)
+#define STATS_TIMER(start) ((void)0)
+#define STATS_LATENCY(name, start) ((void)0)
+
+#endif
+
+// Write every counter and histogram as one JSON object, or {"enabled":
+// false} when compiled without POLY_STATS.
+void stats_print_json(FILE *fp);
+// zero everything, the named histograms are kept
+void stats_reset(void);
+
+#endif
@@ -0,0 +1,376 @@
+#include "store.h"
+#include "alloc.h"
+#include "polynomial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE_MAGIC "POLYSTO\0"
+#define STORE_VERSION 1
+#define STORE_BYTE_ORDER 0x01020304u
+
+struct store_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // STORE_BYTE_ORDER as written
+    uint32_t term_size;  // sizeof(struct term) of the writer
+    uint32_t pad;
+    uint64_t count;
+    uint64_t index_offset; // count entries
+    uint64_t names_offset; // names_size bytes of NUL terminated names
+    uint64_t names_size;
+    uint64_t terms_offset; // 16 byte aligned
+    uint64_t file_size;
+};
+
+struct store_entry {
+    uint64_t hash;
+    uint64_t name; // offset into the names
+    uint64_t terms; // index of the first term
+    uint64_t size;
+};
+
+struct store {
+    struct allocator alloc;
+    unsigned char *map;
+    size_t map_size;
+    const struct store_header *header;
+    const struct store_entry *index;
+    const char *names;
+    struct term *terms;
+    size_t term_count;
+};
+
+// ---- writer ----
+
+struct save_item {
+    uint64_t hash;
+    const char *name;
+    const struct polynomial *p;
+};
+
+static int save_item_comp(const void *_a, const void *_b) {
+    const struct save_item *a = _a, *b = _b;
+    if (a->hash != b->hash)
+        return a->hash < b->hash ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+static inline uint64_t align16(uint64_t n) { return (n + 15) & ~(uint64_t)15; }
+
+static int write_all(FILE *fp, const void *data, size_t size) {
+    return fwrite(data, 1, size, fp) == size ? 0 : -1;
+}
+
+// terms go through a zeroed buffer so the padding of struct term is written
+// as zeros rather than whatever the heap held
+static int write_terms(FILE *fp, const struct term *t, size_t count) {
+    struct term buf[256];
+    memset(buf, 0, sizeof(buf));
+    for (size_t i = 0; i < count;) {
+        size_t n = 0;
+        for (; n < 256 && i < count; ++n, ++i) {
+            buf[n].coeff = t[i].coeff;
+            buf[n].exp = t[i].exp;
+        }
+        if (write_all(fp, buf, sizeof(struct term) * n))
+            return -1;
+    }
+    return 0;
+}
+
+static int write_store(FILE *fp, const struct save_item *items, size_t count) {
+    struct store_header h = {.magic = STORE_MAGIC,
+                             .version = STORE_VERSION,
+                             .byte_order = STORE_BYTE_ORDER,
+                             .term_size = sizeof(struct term),
+                             .count = count};
+    h.index_offset = sizeof(h);
+    h.names_offset = h.index_offset + sizeof(struct store_entry) * count;
+    uint64_t term_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        h.names_size += strlen(items[i].name) + 1;
+        term_count += items[i].p->size;
+    }
+    h.terms_offset = align16(h.names_offset + h.names_size);
+    h.file_size = h.terms_offset + sizeof(struct term) * term_count;
+    if (write_all(fp, &h, sizeof(h)))
+        return -1;
+
+    uint64_t name = 0, terms = 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct store_entry e = {.hash = items[i].hash,
+                                .name = name,
+                                .terms = terms,
+                                .size = items[i].p->size};
+        if (write_all(fp, &e, sizeof(e)))
+            return -1;
+        name += strlen(items[i].name) + 1;
+        terms += items[i].p->size;
+    }
+    for (size_t i = 0; i < count; ++i)
+        if (write_all(fp, items[i].name, strlen(items[i].name) + 1))
+            return -1;
+    static const char zeros[16];
+    if (write_all(fp, zeros, h.terms_offset - h.names_offset - h.names_size))
+        return -1;
+    for (size_t i = 0; i < count; ++i)
+        if (write_terms(fp, items[i].p->terms, items[i].p->size))
+            return -1;
+    return 0;
+}
+
+// files are written next to their path and renamed over it when complete
+static char *temp_path(const char *path) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    return tmp;
+}
+
+// close fp and move it in place if everything went well (ret is 0), or
+// remove it
+static int finish(FILE *fp, const char *tmp, const char *path, int ret) {
+    if (fclose(fp) != 0)
+        ret = -1;
+    if (ret == 0)
+        ret = rename(tmp, path);
+    if (ret != 0) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+    }
+    return ret;
+}
+
+int store_save(HashTable *table, const char *path) {
+    size_t count = table != NULL ? table->size : 0;
+    struct save_item *items = malloc(sizeof(struct save_item) * (count + 1));
+    if (items == NULL)
+        return -1;
+    size_t pos = 0, n = 0;
+    for (Item *itm; (itm = table_next(table, &pos)) != NULL; ++n)
+        items[n] = (struct save_item){itm->hash, itm->key, itm->data};
+    qsort(items, n, sizeof(struct save_item), save_item_comp);
+
+    char *tmp = temp_path(path);
+    int ret = -1;
+    FILE *fp = fopen(tmp, "wb");
+    if (fp != NULL) {
+        setvbuf(fp, NULL, _IOFBF, 1 << 20);
+        ret = finish(fp, tmp, path, write_store(fp, items, n));
+    }
+    free(tmp);
+    free(items);
+    return ret;
+}
+
+// ---- streaming writer ----
+
+// The layout of a single polynomial is known up to its size, which is
+// patched into the header and the index entry at the end.
+struct store_writer {
+    FILE *fp;
+    char *path, *tmp;
+    struct store_header h;
+    struct store_entry e;
+};
+
+struct store_writer *store_writer_open(const char *path, const char *name) {
+    struct store_writer *w = calloc(1, sizeof(struct store_writer));
+    w->tmp = temp_path(path);
+    w->fp = fopen(w->tmp, "wb");
+    if (w->fp == NULL) {
+        int err = errno;
+        free(w->tmp);
+        free(w);
+        errno = err;
+        return NULL;
+    }
+    setvbuf(w->fp, NULL, _IOFBF, 1 << 20);
+    size_t len = strlen(path) + 1;
+    w->path = malloc(len);
+    memcpy(w->path, path, len);
+
+    struct store_header *h = &w->h;
+    *h = (struct store_header){.magic = STORE_MAGIC,
+                               .version = STORE_VERSION,
+                               .byte_order = STORE_BYTE_ORDER,
+                               .term_size = sizeof(struct term),
+                               .count = 1};
+    h->index_offset = sizeof(*h);
+    h->names_offset = h->index_offset + sizeof(struct store_entry);
+    h->names_size = strlen(name) + 1;
+    h->terms_offset = align16(h->names_offset + h->names_size);
+    w->e = (struct store_entry){.hash = hash_str(name)};
+    static const char zeros[16];
+    if (write_all(w->fp, h, sizeof(*h)) ||
+        write_all(w->fp, &w->e, sizeof(w->e)) ||
+        write_all(w->fp, name, h->names_size) ||
+        write_all(w->fp, zeros,
+                  h->terms_offset - h->names_offset - h->names_size)) {
+        store_writer_close(w, false);
+        return NULL;
+    }
+    return w;
+}
+
+int store_writer_put(struct store_writer *w, const struct term *terms,
+                     size_t n) {
+    w->e.size += n;
+    return write_terms(w->fp, terms, n);
+}
+
+int store_writer_close(struct store_writer *w, bool commit) {
+    int ret = -1;
+    if (commit) {
+        w->h.file_size = w->h.terms_offset + sizeof(struct term) * w->e.size;
+        if (fseek(w->fp, 0, SEEK_SET) == 0 &&
+            !write_all(w->fp, &w->h, sizeof(w->h)) &&
+            !write_all(w->fp, &w->e, sizeof(w->e)))
+            ret = 0;
+    }
+    ret = finish(w->fp, w->tmp, w->path, ret);
+    free(w->tmp);
+    free(w->path);
+    free(w);
+    return ret;
+}
+
+// ---- reader ----
+
+static inline bool in_map(const struct store *s, const void *p) {
+    return (const unsigned char *)p >= s->map &&
+           (const unsigned char *)p < s->map + s->map_size;
+}
+
+// Term arrays inside the mapping are never handed to the heap: growing one
+// copies it out, releasing one does nothing.
+static void *store_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *store_resize(void *ctx, void *p, size_t old_size, size_t size) {
+    if (!in_map(ctx, p))
+        return realloc(p, size);
+    void *q = malloc(size);
+    if (q != NULL)
+        memcpy(q, p, old_size < size ? old_size : size);
+    return q;
+}
+
+static void store_release(void *ctx, void *p, size_t size) {
+    (void)size;
+    if (!in_map(ctx, p))
+        free(p);
+}
+
+static bool header_valid(const struct store_header *h, size_t size) {
+    if (memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != STORE_VERSION || h->byte_order != STORE_BYTE_ORDER ||
+        h->term_size != sizeof(struct term) || h->file_size != size)
+        return false;
+    // every section in order and inside the file
+    return h->index_offset == sizeof(*h) &&
+           h->count <= (size - h->index_offset) / sizeof(struct store_entry) &&
+           h->names_offset ==
+               h->index_offset + sizeof(struct store_entry) * h->count &&
+           h->names_size <= size - h->names_offset &&
+           h->terms_offset == align16(h->names_offset + h->names_size) &&
+           h->terms_offset <= size &&
+           (size - h->terms_offset) % sizeof(struct term) == 0;
+}
+
+struct store *store_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    size_t size = st.st_size;
+    void *map = MAP_FAILED;
+    if (size >= sizeof(struct store_header))
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int err = size < sizeof(struct store_header) ? EINVAL : errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return NULL;
+    }
+    const struct store_header *h = map;
+    if (!header_valid(h, size) ||
+        (h->names_size > 0 &&
+         ((const char *)map)[h->names_offset + h->names_size - 1] != 0)) {
+        munmap(map, size);
+        errno = EINVAL;
+        return NULL;
+    }
+    struct store *s = malloc(sizeof(struct store));
+    s->alloc = (struct allocator){store_alloc, store_resize, store_release, s};
+    s->map = map;
+    s->map_size = size;
+    s->header = h;
+    s->index = (const struct store_entry *)(s->map + h->index_offset);
+    s->names = (const char *)(s->map + h->names_offset);
+    s->terms = (struct term *)(s->map + h->terms_offset);
+    s->term_count = (size - h->terms_offset) / sizeof(struct term);
+    return s;
+}
+
+void store_close(struct store *s) {
+    if (s == NULL)
+        return;
+    munmap(s->map, s->map_size);
+    free(s);
+}
+
+size_t store_count(const struct store *s) { return s->header->count; }
+
+const char *store_name(const struct store *s, size_t i) {
+    uint64_t name = s->index[i].name;
+    return name < s->header->names_size ? s->names + name : "";
+}
+
+long store_find(const struct store *s, const char *name) {
+    uint64_t hash = hash_str(name);
+    size_t lo = 0, hi = s->header->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->index[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < s->header->count && s->index[lo].hash == hash; ++lo)
+        if (strcmp(store_name(s, lo), name) == 0)
+            return (long)lo;
+    return -1;
+}
+
+int store_view(const struct store *s, size_t i, struct polynomial *p) {
+    const struct store_entry *e = &s->index[i];
+    if (e->terms > s->term_count || e->size > s->term_count - e->terms ||
+        e->size > INT32_MAX)
+        return -1;
+    p->size = p->cap = (int)e->size;
+    // an empty view has nothing in the mapping to point at
+    p->terms = e->size > 0 ? s->terms + e->terms : NULL;
+    p->alloc = &s->alloc;
+    p->version = polynomial_stamp();
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "hash_map.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Binary workspace file: a header, a name index sorted by hash_str of the
+// name, the names and then every term array back to back, stored as
+// struct term in the byte order of the machine that wrote it.
+//
+// An opened store is mapped copy-on-write, so the polynomials it hands out
+// read their terms straight from the mapping. Writing to them only touches
+// private pages, and growing them copies the terms to the heap first; the file
+// is never modified. Every view must be released before store_close.
+struct polynomial;
+struct store;
+struct term;
+
+// Write every item of table, whose data must be struct polynomial, to path.
+// The file is written next to path and renamed over it when complete.
+// Returns 0, or -1 with errno set.
+int store_save(HashTable *table, const char *path);
+
+// Write a store holding the single polynomial name, whose terms are passed
+// in ascending order of exponent and in any number of chunks, without ever
+// holding it in memory. Like store_save, nothing appears at path before
+// store_writer_close commits. store_writer_open and store_writer_put return
+// NULL or -1 with errno set on failure; the writer must still be closed
+// after a failed put.
+struct store_writer;
+struct store_writer *store_writer_open(const char *path, const char *name);
+int store_writer_put(struct store_writer *, const struct term *terms,
+                     size_t n);
+// Finish the file, or discard it if commit is false. Returns 0, or -1 with
+// errno set.
+int store_writer_close(struct store_writer *, bool commit);
+
+// Map a file written by store_save, NULL with errno set if it cannot be opened
+// or is not a store. Takes constant time, entries are checked on access.
+struct store *store_open(const char *path);
+void store_close(struct store *);
+
+size_t store_count(const struct store *);
+const char *store_name(const struct store *, size_t i);
+// index of name, or -1 if it is not stored
+long store_find(const struct store *, const char *name);
+// Point p at the terms of entry i, returns -1 if the entry is corrupt
+int store_view(const struct store *, size_t i, struct polynomial *p);
+
+#endif